@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vertex_format.h>
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+// First fit allocator over [0, capacity), a freed range is merged with its free neighbours
+class RangeAllocator
+{
+public:
+	explicit RangeAllocator(size_t capacity = 0);
+
+	// false when no free range is large enough
+	bool allocate(size_t size, size_t& offset);
+	void free(size_t offset, size_t size);
+
+	size_t getCapacity() const { return capacity; }
+	size_t getUsed() const { return used; }
+	size_t getFreeRangeCount() const { return freeRanges.size(); }
+	size_t getLargestFreeRange() const;
+
+private:
+	size_t capacity;
+	size_t used = 0;
+	std::map<size_t, size_t> freeRanges;	// offset -> size
+};
+
+// Where a mesh lives in its arena
+struct ArenaBlock {
+	unsigned int page;
+	unsigned int baseVertex;	// for glDrawElementsBaseVertex
+	unsigned int vertexCount;
+	size_t indexOffset;			// bytes
+	size_t indexBytes;			// rounded up to 4 bytes
+};
+
+class BufferArena;
+
+// Owns one block of a BufferArena, freed with the allocation. Move only
+class ArenaAllocation
+{
+public:
+	ArenaAllocation() = default;
+	~ArenaAllocation();
+
+	ArenaAllocation(const ArenaAllocation&) = delete;
+	ArenaAllocation& operator=(const ArenaAllocation&) = delete;
+	ArenaAllocation(ArenaAllocation&& other) noexcept;
+	ArenaAllocation& operator=(ArenaAllocation&& other) noexcept;
+
+	explicit operator bool() const { return arena != nullptr; }
+	BufferArena& getArena() const { return *arena; }
+	// Offsets can change when the arena is defragmented, read them at draw time
+	const ArenaBlock& getBlock() const;
+
+private:
+	friend class BufferArena;
+
+	ArenaAllocation(BufferArena* arena, unsigned int block) : arena(arena), block(block) {}
+
+	BufferArena* arena = nullptr;
+	unsigned int block = 0;
+};
+
+// Vertex and index data of every mesh of one vertex format, suballocated from a few large buffers ("pages").
+// Each page has the only VAO its meshes draw through, so consecutive meshes don't rebind anything
+// Freed ranges are merged right away, defragment() compacts the pages left with holes. GL thread only
+class BufferArena
+{
+public:
+	static constexpr size_t VERTEX_PAGE_SIZE = 32 * 1024 * 1024;
+	static constexpr size_t INDEX_PAGE_SIZE = 16 * 1024 * 1024;
+
+	struct Stats {
+		unsigned int pageCount = 0;
+		unsigned int blockCount = 0;
+		size_t vertexBytesUsed = 0;
+		size_t vertexBytesCapacity = 0;
+		size_t indexBytesUsed = 0;
+		size_t indexBytesCapacity = 0;
+		unsigned int compactionCount = 0;
+
+		void merge(const Stats& other);
+	};
+
+	static BufferArena& getInstance(VertexFormat format);
+	// Deletes the pages of every arena, outstanding allocations become dangling: only call at shutdown
+	static void clearAll();
+	// Summed over every arena
+	static Stats getTotalStats();
+	// Once per frame: defragments the arenas whose holes pass holeFraction of their capacity, or that have an empty
+	// page more than the one kept. Nothing is copied until then
+	static void defragmentAll(float holeFraction = 0.25f);
+
+	BufferArena(const BufferArena&) = delete;
+	BufferArena& operator=(const BufferArena&) = delete;
+
+	// vertices holds vertexCount vertices of this arena's format, a mesh larger than a page gets a page of its own
+	ArenaAllocation allocate(const void* vertices, unsigned int vertexCount, const void* indices, size_t indexBytes);
+
+	// Binds the VAO of the page unless it is already bound
+	void bind(unsigned int page) const;
+	// For the RenderQueue, which binds the VAOs itself and calls unbind() once done
+	unsigned int getVertexArray(unsigned int page) const { return pages[page].VAO; }
+	// Once done drawing, binds no VAO
+	static void unbind();
+
+	// Compacts the pages that have holes and deletes the empty ones but one
+	void defragment();
+	bool needsDefragment(float holeFraction) const;
+
+	VertexFormat getFormat() const { return format; }
+	const ArenaBlock& getBlock(unsigned int block) const { return blocks[block]; }
+	Stats getStats() const;
+
+private:
+	friend class ArenaAllocation;
+
+	struct Page {
+		unsigned int VAO = 0;
+		unsigned int VBO = 0;
+		unsigned int EBO = 0;
+		RangeAllocator vertices;	// in vertices
+		RangeAllocator indices;		// in bytes
+		unsigned int blockCount = 0;
+		bool fragmented = false;
+	};
+
+	VertexFormat format;
+	unsigned int stride;
+	std::vector<Page> pages;	// deleted pages keep their slot, with VAO 0
+	std::vector<ArenaBlock> blocks;
+	std::vector<bool> liveBlocks;
+	std::vector<unsigned int> freeBlocks;
+	unsigned int compactionCount = 0;
+
+	explicit BufferArena(VertexFormat format);
+
+	unsigned int createPage(size_t vertexCapacity, size_t indexCapacity);
+	void deletePage(unsigned int page);
+	void setupVertexArray(const Page& page) const;
+	void compact(unsigned int page);
+	void free(unsigned int block);
+	void clear();
+};
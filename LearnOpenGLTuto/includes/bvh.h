@@ -0,0 +1,70 @@
+#pragma once
+
+#include <frustum.h>
+
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over the world boxes of objects, an object is its index in the boxes it is built from.
+// Built top down with the surface area heuristic for content that stays put; objects moving afterwards only refit
+// the nodes above them, the tree keeps its topology and loosens until the next build
+class Bvh
+{
+public:
+	static constexpr unsigned int MAX_LEAF_OBJECTS = 4;
+	// Candidate split planes per axis of the binned SAH
+	static constexpr unsigned int BIN_COUNT = 16;
+
+	struct Stats {
+		unsigned int objectCount = 0;
+		unsigned int nodeCount = 0;
+		unsigned int depth = 0;
+		double buildMs = 0.0;
+
+		// Of the last refit
+		unsigned int refitNodeCount = 0;
+		double refitMs = 0.0;
+
+		// Of the last query
+		unsigned int visitedNodeCount = 0;
+		unsigned int acceptedNodeCount = 0;		// inside the frustum, taken whole
+		unsigned int rejectedNodeCount = 0;		// outside, skipped whole
+		unsigned int visibleObjectCount = 0;
+		double queryMs = 0.0;
+	};
+
+	void build(const std::vector<BoundingBox>& boxes);
+	// The box of an object changed, its leaf and the ancestors are refit on the next refit()
+	void update(uint32_t object, const BoundingBox& box);
+	void refit();
+
+	// Replaces visible with the objects whose box touches the frustum, in no particular order
+	void query(const Frustum& frustum, std::vector<uint32_t>& visible);
+
+	unsigned int getObjectCount() const { return static_cast<unsigned int>(objectBoxes.size()); }
+	const BoundingBox& getObjectBox(uint32_t object) const { return objectBoxes[object]; }
+	const Stats& getStats() const { return stats; }
+
+private:
+	// Nodes come before their children, each covers the range of objectOrder below it
+	struct Node {
+		BoundingBox box;
+		uint32_t firstObject = 0;
+		uint32_t objectCount = 0;
+		uint32_t left = 0;		// 0 for a leaf, the right child follows the left one
+		uint32_t parent = 0;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> objectOrder;
+	std::vector<uint32_t> objectLeaves;
+	std::vector<BoundingBox> objectBoxes;
+	std::vector<uint32_t> dirtyNodes;
+	std::vector<uint8_t> nodeDirty;
+	std::vector<uint32_t> traversal;
+
+	Stats stats;
+
+	uint32_t split(const Node& node, const std::vector<glm::vec3>& centroids);
+	BoundingBox getLeafBox(const Node& node) const;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Axis aligned box, in the space of whatever it bounds
+struct BoundingBox {
+	glm::vec3 min = glm::vec3(0.0f);
+	glm::vec3 max = glm::vec3(0.0f);
+
+	glm::vec3 getCenter() const { return (min + max) * 0.5f; }
+	glm::vec3 getExtent() const { return (max - min) * 0.5f; }
+	bool operator==(const BoundingBox& other) const { return min == other.min && max == other.max; }
+	bool operator!=(const BoundingBox& other) const { return !(*this == other); }
+	// Box around this one once transformed (Arvo): the extent goes through the absolute value of the matrix
+	BoundingBox transform(const glm::mat4& matrix) const;
+};
+
+struct BoundingSphere {
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 0.0f;
+};
+
+// The 6 planes of a clip matrix, normals pointing inside (Gribb & Hartmann). Any projection works, the perspective to
+// orthographic blend of lerpProjectionMatrices included. From projection * view the planes are in world space,
+// from projection * view * model in object space
+class Frustum
+{
+public:
+	enum Containment {
+		OUTSIDE,
+		INTERSECTS,
+		INSIDE
+	};
+
+	Frustum() = default;
+	explicit Frustum(const glm::mat4& clip);
+
+	// Conservative: a volume crossing two planes outside of a corner may pass
+	bool intersects(const BoundingSphere& sphere) const;
+	bool intersects(const BoundingBox& box) const;
+	// INSIDE when the box is on the inner side of every plane, what it holds needs no further test
+	Containment classify(const BoundingBox& box) const;
+
+private:
+	glm::vec4 planes[6];
+};
+
+// World space frustum of the frame and what went through it, the counters accumulate until reset
+struct FrustumCulling {
+	Frustum frustum;
+	bool enabled = true;
+
+	unsigned int visibleCount = 0;
+	unsigned int culledCount = 0;
+
+	// Counts the object, always visible when disabled. objectBox is in the space model places in the world
+	bool isVisible(const BoundingBox& objectBox, const glm::mat4& model);
+	bool isVisible(const BoundingBox& worldBox);
+};
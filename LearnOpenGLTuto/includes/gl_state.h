@@ -0,0 +1,82 @@
+#pragma once
+
+// Shadow of the GL state the renderer changes the most, a call setting the value already current is filtered
+// out before it reaches the driver. Everything that changes this state goes through it, GL thread only.
+// Other code changing it behind its back (ImGui) has to be followed by invalidate()
+class GLState
+{
+public:
+	// Texture units whose bindings are shadowed, binds on the others are always issued
+	static constexpr unsigned int TEXTURE_UNITS = 16;
+
+	enum Call {
+		PROGRAM,
+		VERTEX_ARRAY,
+		ACTIVE_TEXTURE,
+		TEXTURE,
+		VIEWPORT,
+		DEPTH_FUNC,
+		LINE_WIDTH,
+		CALL_COUNT
+	};
+
+	struct Stats {
+		unsigned int issued[CALL_COUNT] = {};
+		unsigned int filtered[CALL_COUNT] = {};
+
+		unsigned int getIssued() const;
+		unsigned int getFiltered() const;
+	};
+
+	static GLState& getInstance();
+	static const char* getCallName(Call call);
+
+	GLState(const GLState&) = delete;
+	GLState& operator=(const GLState&) = delete;
+
+	// Each returns true when the call was issued
+	bool useProgram(unsigned int program);
+	bool bindVertexArray(unsigned int vertexArray);
+	bool activeTexture(unsigned int unit);
+	// On the active unit, GL_TEXTURE_2D and GL_TEXTURE_BUFFER are shadowed
+	bool bindTexture(unsigned int target, unsigned int texture);
+	// Makes unit active first
+	bool bindTexture(unsigned int unit, unsigned int target, unsigned int texture);
+	bool viewport(int x, int y, int width, int height);
+	bool depthFunc(unsigned int func);
+	bool lineWidth(float width);
+
+	// Deleting an object unbinds it and its name can be reused: call before glDelete*
+	void onDeleteTexture(unsigned int texture);
+	void onDeleteVertexArray(unsigned int vertexArray);
+	// Forgets everything, the next call of each kind is issued
+	void invalidate();
+
+	// Calls since the last take, once per frame
+	Stats takeStats();
+
+private:
+	// Values no call sets, the state is unknown
+	static constexpr unsigned int UNKNOWN = ~0u;
+
+	enum TextureTarget {
+		TARGET_2D,
+		TARGET_BUFFER,
+		TARGET_COUNT
+	};
+
+	unsigned int program = UNKNOWN;
+	unsigned int vertexArray = UNKNOWN;
+	unsigned int activeUnit = UNKNOWN;
+	unsigned int textures[TEXTURE_UNITS][TARGET_COUNT];
+	int viewportBox[4] = {};
+	bool viewportKnown = false;
+	unsigned int depthFuncValue = UNKNOWN;
+	float lineWidthValue = -1.0f;
+
+	Stats stats;
+
+	GLState();
+
+	bool count(Call call, bool issued);
+};
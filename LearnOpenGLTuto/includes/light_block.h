@@ -0,0 +1,114 @@
+#pragma once
+
+#include <directional_light.h>
+#include <point_light.h>
+#include <spot_light.h>
+#include <shader.h>
+#include <light_grid.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// std140 mirror of the structs of the phong fragment shaders, keep both in sync
+// vec3 members are 16 bytes aligned, the scalars are packed in the 4th component of the vec3 before them.
+// Point and spot lights are read from a buffer texture with the same packing, one RGBA32F texel per vec4
+namespace std140 {
+	struct DirectionalLight {
+		glm::vec3 direction;
+		float padding0;
+		glm::vec3 ambient;
+		float padding1;
+		glm::vec3 diffuse;
+		float padding2;
+		glm::vec3 specular;
+		float padding3;
+	};
+
+	struct PointLight {
+		glm::vec3 position;
+		float constant;
+		glm::vec3 ambient;
+		float linear;
+		glm::vec3 diffuse;
+		float quadratic;
+		glm::vec3 specular;
+		float padding;
+	};
+
+	struct SpotLight {
+		glm::vec3 position;
+		float innerCutOff;
+		glm::vec3 direction;
+		float outerCutOff;
+		glm::vec3 ambient;
+		float constant;
+		glm::vec3 diffuse;
+		float linear;
+		glm::vec3 specular;
+		float quadratic;
+	};
+}
+
+// Lights shared by every lit program, filled once per frame:
+// - the LightBlock uniform block: directional light and cluster grid parameters
+// - buffer textures: every enabled point and spot light, the LightGrid clusters and their light indices
+// A fragment finds its cluster from its pixel and depth and only iterates the lights listed there
+class LightBlock
+{
+public:
+	static constexpr unsigned int BINDING = 0;
+	// Texture units of the buffer textures, past the ones a Material can take
+	static constexpr unsigned int LIGHT_DATA_UNIT = 8;
+	static constexpr unsigned int CLUSTERS_UNIT = 9;
+	static constexpr unsigned int LIGHT_INDICES_UNIT = 10;
+
+	struct Data {
+		int directionalLightCount;	// 0 or 1
+		int pointLightCount;		// the spot lights follow the point lights in the light data
+		int spotLightCount;
+		int padding;
+		glm::vec4 viewDepthPlane;	// dot(viewDepthPlane, vec4(world position, 1)) = view depth
+		glm::vec4 clusterScale;		// tiles per pixel in xy, LightGrid slice scale and bias in zw
+		glm::ivec4 clusterCount;	// tiles in x and y, slices
+		std140::DirectionalLight directionalLight;
+	};
+
+	static LightBlock& getInstance();
+
+	// Points the LightBlock of the program at BINDING and its light samplers at their units,
+	// returns false when the program doesn't declare the block
+	static bool bindProgram(Shader& shader);
+
+	LightBlock(const LightBlock&) = delete;
+	LightBlock& operator=(const LightBlock&) = delete;
+
+	// GL thread: packs the enabled lights, sorts them in the clusters of the camera and uploads everything
+	void update(const DirectionalLight& directionalLight, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights,
+		const glm::mat4& view, const glm::mat4& projection, float nearDepth, float farDepth, int framebufferWidth, int framebufferHeight);
+	// Deletes the buffers, at shutdown
+	void clear();
+
+	const Data& getData() const { return data; }
+	const LightGrid::Stats& getGridStats() const { return grid.getStats(); }
+
+private:
+	unsigned int UBO = 0;
+	unsigned int lightDataBuffer = 0;
+	unsigned int lightDataTexture = 0;
+	unsigned int clustersBuffer = 0;
+	unsigned int clustersTexture = 0;
+	unsigned int lightIndicesBuffer = 0;
+	unsigned int lightIndicesTexture = 0;
+	size_t maxTexels = 0;
+
+	Data data = {};
+	LightGrid grid;
+	std::vector<LightSphere> pointSpheres;
+	std::vector<LightSphere> spotSpheres;
+	std::vector<glm::vec4> lightData;	// the packed point lights then the spot lights
+
+	LightBlock() = default;
+
+	void createBuffers();
+};
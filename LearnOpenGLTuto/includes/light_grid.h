@@ -0,0 +1,106 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// View space sphere out of which a light adds nothing visible
+struct LightSphere {
+	glm::vec3 center;
+	float radius;
+};
+
+// Distance past which a light of the phong shaders, attenuated by 1 / (1 + constant + linear * d + quadratic * d^2),
+// adds less than 1/256 to any channel. intensity is its brightest channel, FLT_MAX when it never fades out
+float getAttenuationRange(float constant, float linear, float quadratic, float intensity);
+
+// Clustered forward lighting: the view frustum is cut in screen tiles times exponential depth slices ("froxels"),
+// and each cluster gets the list of the point and spot lights whose sphere touches it
+// A fragment then only iterates the lights of its cluster, its cost follows the local light density
+class LightGrid
+{
+public:
+	static constexpr unsigned int TILE_COUNT_X = 16;
+	static constexpr unsigned int TILE_COUNT_Y = 9;
+	static constexpr unsigned int SLICE_COUNT = 24;
+	static constexpr unsigned int CLUSTER_COUNT = TILE_COUNT_X * TILE_COUNT_Y * SLICE_COUNT;
+	// Light indices and per cluster counts are 16 bits, the lights past this are dropped
+	static constexpr unsigned int MAX_LIGHTS = 0xFFFF;
+
+	// Lights of cluster (x, y, slice) at index (slice * TILE_COUNT_Y + y) * TILE_COUNT_X + x, tile y = 0 at the bottom
+	struct Cluster {
+		uint32_t offset;	// first index in getLightIndices(), the point lights then the spot lights
+		uint32_t counts;	// point light count | spot light count << 16
+	};
+
+	struct Stats {
+		unsigned int pointLightCount = 0;
+		unsigned int spotLightCount = 0;
+		unsigned int usedClusterCount = 0;
+		unsigned int maxClusterLightCount = 0;
+		size_t lightIndexCount = 0;
+		bool truncated = false;		// light indices past maxLightIndices were dropped
+		double buildMs = 0.0;
+	};
+
+	// Fits the clusters to the camera, projection can be perspective, orthographic or in between.
+	// Depth slices are exponential between nearDepth and farDepth
+	void setup(const glm::mat4& projection, float nearDepth, float farDepth);
+
+	// Builds the light lists of every cluster, the indices refer to the positions in pointLights and spotLights
+	// Slices are shared between the calling thread and the pool, which can be null
+	void build(const std::vector<LightSphere>& pointLights, const std::vector<LightSphere>& spotLights, ThreadPool* pool, size_t maxLightIndices);
+
+	const std::vector<Cluster>& getClusters() const { return clusters; }
+	const std::vector<uint16_t>& getLightIndices() const { return lightIndices; }
+	// slice = floor(log(depth) * sliceScale + sliceBias)
+	float getSliceScale() const { return sliceScale; }
+	float getSliceBias() const { return sliceBias; }
+	const Stats& getStats() const { return stats; }
+
+private:
+	// Tiles are padded so that the last SIMD load of a row stays in bounds
+	static constexpr unsigned int TILE_ROW_SIZE = TILE_COUNT_X + 4;
+
+	struct LightRange {
+		unsigned int firstSlice;
+		unsigned int lastSlice;	// firstSlice > lastSlice when the light is out of the depth range
+	};
+
+	// Lists built by one slice, kept between frames to reuse their memory
+	struct SliceLists {
+		std::vector<std::vector<uint16_t>> pointLights;	// one per tile
+		std::vector<std::vector<uint16_t>> spotLights;
+	};
+
+	float nearDepth = 0.1f;
+	float farDepth = 100.0f;
+	float sliceScale = 0.0f;
+	float sliceBias = 0.0f;
+	// View space bounds of each cluster: x only depends on the tile column and the slice, y on the row and the slice
+	// Depths are positive, -z in view space
+	float sliceDepths[SLICE_COUNT + 1];
+	float tileMinX[SLICE_COUNT][TILE_ROW_SIZE];
+	float tileMaxX[SLICE_COUNT][TILE_ROW_SIZE];
+	float tileMinY[SLICE_COUNT][TILE_COUNT_Y];
+	float tileMaxY[SLICE_COUNT][TILE_COUNT_Y];
+
+	const std::vector<LightSphere>* pointLights = nullptr;
+	const std::vector<LightSphere>* spotLights = nullptr;
+	std::vector<LightRange> pointRanges;
+	std::vector<LightRange> spotRanges;
+	std::vector<SliceLists> slices;
+
+	std::vector<Cluster> clusters;
+	std::vector<uint16_t> lightIndices;
+	Stats stats;
+
+	unsigned int getSlice(float depth) const;
+	void computeRanges(const std::vector<LightSphere>& lights, std::vector<LightRange>& ranges) const;
+	void buildSlice(unsigned int slice);
+	void cullLights(unsigned int slice, const std::vector<LightSphere>& lights, const std::vector<LightRange>& ranges, std::vector<std::vector<uint16_t>>& lists) const;
+	void gatherLists(size_t maxLightIndices);
+};
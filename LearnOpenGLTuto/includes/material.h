@@ -0,0 +1,62 @@
+#pragma once
+
+#include <shader.h>
+#include <shader_variants.h>
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+struct Texture {
+	unsigned int ID;
+	std::string name;
+	std::string path;
+};
+
+// Textures of a mesh with the texture unit and sampler uniform of each, worked out once at load
+// Drawing then binds a precomputed list of (unit, texture) pairs: no uniform name is built per draw, and
+// uniform handles are only resolved the first time the material meets a program
+class Material
+{
+public:
+	Material() = default;
+	// The first "diffuse", "specular", "emission", "normal" and "height" textures go to material.<name>,
+	// the shaders sample no other texture and they get no unit
+	explicit Material(const std::vector<Texture>& textures, float shininess = 16.0f);
+
+	// GL thread: binds the textures and sets the samplers and material.shininess of the program in use
+	void bind(const Shader& shader) const;
+
+	unsigned int getTextureCount() const { return (unsigned int)bindings.size(); }
+	// ShaderFeature bits of the maps, to pick the program variant sampling them
+	uint32_t getFeatures() const { return features; }
+	// Equal for the materials binding the same textures to the same samplers with the same shininess
+	uint64_t getStateKey() const { return stateKey; }
+
+	struct ProgramLocations {
+		unsigned int program;
+		std::vector<UniformHandle<int>> samplers;	// one per binding, invalid when the program doesn't use it
+		UniformHandle<float> shininess;
+		// Of the mesh drawing with the material, for its compact vertices
+		UniformHandle<glm::vec3> positionCenter;
+		UniformHandle<glm::vec3> positionExtent;
+	};
+
+	const ProgramLocations& getLocations(const Shader& shader) const;
+
+private:
+	struct Binding {
+		unsigned int unit;
+		unsigned int textureID;
+		std::string uniform;
+	};
+
+	std::vector<Binding> bindings;
+	float shininess = 16.0f;
+	uint32_t features = 0;
+	uint64_t stateKey = 0;
+
+	// A mesh is drawn by a few programs (float or compact vertices, variants of the light set), a linear search is enough
+	mutable std::vector<ProgramLocations> programs;
+};
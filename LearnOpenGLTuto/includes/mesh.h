@@ -1,7 +1,13 @@
 #pragma once
 
+#include <buffer_arena.h>
+#include <frustum.h>
+#include <material.h>
+#include <render_queue.h>
 #include <shader.h>
+#include <vertex_format.h>
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <glm/glm.hpp>
@@ -14,27 +20,151 @@ struct Vertex {
 	glm::vec3 Bitangent;
 };
 
-struct Texture {
-	unsigned int ID;
-	std::string name;
-	std::string path;
+// Range of the index buffer drawing one level of detail, LOD 0 being the full mesh
+struct MeshLod {
+	unsigned int indexOffset;
+	unsigned int indexCount;
+	float error;	// object space distance to LOD 0, see simplifyMesh
+};
+
+// Small cluster of LOD 0 triangles (at most 64 vertices, 124 triangles) with what it takes to cull it on its own
+struct Meshlet {
+	glm::vec3 center;			// bounding sphere, object space
+	float radius;
+	glm::vec3 coneAxis;			// average facing of the triangles
+	float coneCutoff;			// sine of the normal cone half angle, 1 when the cone is too wide to cull anything
+	unsigned int indexOffset;	// contiguous range of the LOD 0 indices
+	unsigned int triangleCount;
+	unsigned int vertexCount;
+};
+
+// Node of an imported hierarchy (aiNode), the nodes of a model come parent first. Its meshes are a contiguous range
+// of the model's, in the order the hierarchy is walked
+struct ModelNode {
+	static constexpr uint32_t NO_PARENT = ~0u;
+
+	glm::mat4 transform;		// relative to the parent
+	uint32_t parent;
+	uint32_t firstMesh;
+	uint32_t meshCount;
+	uint32_t padding;
+};
+
+// Inputs of Mesh::enqueueClusters, the counters accumulate over every draw until reset
+struct ClusterCulling {
+	glm::vec3 cameraPosition;
+	bool backfaceCulling = true;	// the normal cone test only holds for a perspective projection
+
+	unsigned int clusterCount = 0;
+	unsigned int visibleClusterCount = 0;
+	unsigned int triangleCount = 0;
+	unsigned int visibleTriangleCount = 0;
+};
+
+// Per frame inputs of the LOD selection
+struct LodSelection {
+	glm::mat4 viewProjection;
+	float pixelScale;			// pixels per unit at clip w = 1
+	float perspectiveFactor;	// how much clip w grows with depth, 0 when orthographic
+	float errorThreshold;		// pixels
+	float hysteresis;			// a coarser LOD is only picked under (1 - hysteresis) * errorThreshold
+
+	LodSelection(const glm::mat4& projection, const glm::mat4& view, float viewportHeight, float errorThreshold = 1.0f, float hysteresis = 0.25f);
+};
+
+// Non-owning view over vertex/index data, either from a MeshData or from a mapped mesh cache
+struct MeshView {
+	const Vertex* vertices;
+	unsigned int vertexCount;
+	const void* indices;
+	unsigned int indexCount;
+	unsigned int indexSize;	// 2 or 4 bytes
+	const MeshLod* lods;	// indices holds every LOD one after the other
+	unsigned int lodCount;
+	const Meshlet* meshlets;
+	unsigned int meshletCount;
+
+	unsigned int getIndex(unsigned int i) const {
+		return indexSize == 2 ? static_cast<const uint16_t*>(indices)[i] : static_cast<const unsigned int*>(indices)[i];
+	}
+};
+
+// CPU-side mesh as produced by the importer
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	// Replaces indices once packed, see packIndices
+	std::vector<uint16_t> shortIndices;
+	// Empty until generateLods, a single LOD covering every index is assumed then
+	std::vector<MeshLod> lods;
+	// Empty until buildMeshlets
+	std::vector<Meshlet> meshlets;
+	std::vector<Texture> textures;
+
+	MeshView getView() const;
 };
 
 class Mesh
 {
 public:
-	// Mesh data
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
+	// Mesh data (lives on the GPU only)
+	unsigned int vertexCount;
+	unsigned int indexCount;
 	std::vector<Texture> textures;
 
-	Mesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, const std::vector<Texture>& textures);
-	void Draw(Shader shader) const;
+	// Compact formats are converted here, error (may be nullptr) accumulates their precision loss
+	// Vertices and indices go to the BufferArena of the format, the mesh keeps no GL object of its own
+	Mesh(const MeshView& data, const std::vector<Texture>& textures, VertexFormat format = VertexFormat::Float, VertexFormatError* error = nullptr);
+	Mesh(const Mesh&) = delete;
+	Mesh& operator=(const Mesh&) = delete;
+	Mesh(Mesh&&) = default;
+	Mesh& operator=(Mesh&&) = default;
+
+	// Leaves the arena's VAO bound for the next mesh, see BufferArena::unbind
+	void Draw(const Shader& shader, unsigned int lod = 0) const;
+	// Adds the draw of a LOD to the queue, item already holds the pass, program, model matrix and depth
+	void enqueue(RenderQueue& queue, DrawItem item, unsigned int lod = 0) const;
+	// LOD 0, skipping the meshlets outside the frustum or facing away from the camera, returns the number of triangles queued
+	unsigned int enqueueClusters(RenderQueue& queue, DrawItem item, const LodSelection& selection, ClusterCulling& culling) const;
+	// Once the IDs of textures are known
+	void buildMaterial() { material = Material(textures); }
+
+	VertexFormat getFormat() const { return format; }
+	// ShaderFeature bits of the material maps
+	uint32_t getMaterialFeatures() const { return material.getFeatures(); }
+	unsigned int getLodCount() const { return (unsigned int)lods.size(); }
+	const MeshLod& getLod(unsigned int lod) const { return lods[lod]; }
+	bool hasMeshlets() const { return !meshlets.empty(); }
+	// Object space, of the vertices at upload
+	const BoundingBox& getBounds() const { return bounds; }
+	BoundingSphere getBoundingSphere() const { return { boundsCenter, boundsRadius }; }
+	// Coarsest LOD whose error projects under selection.errorThreshold pixels, currentLod is kept while it is good enough
+	unsigned int selectLod(unsigned int currentLod, const glm::mat4& model, const LodSelection& selection) const;
 
 private:
 	// Render data
-	unsigned int VAO, VBO, EBO;
+	ArenaAllocation allocation;
+	Material material;
+	unsigned int indexType;
+	unsigned int indexSize;
+	VertexFormat format;
+	VertexQuantization quantization;
+	std::vector<MeshLod> lods;
+	std::vector<Meshlet> meshlets;
 
-	void setupMesh();
-};
+	// Visible ranges of enqueueClusters before they are copied to the queue, kept to avoid allocating every frame
+	mutable std::vector<int> drawCounts;
+	mutable std::vector<const void*> drawOffsets;
+
+	// Object space, the sphere is around the box
+	BoundingBox bounds;
+	glm::vec3 boundsCenter;
+	float boundsRadius;
 
+	void bindMaterial(const Shader& shader) const;
+	// Where the compact positions decode to, nothing to set for float vertices
+	void setQuantization(const Shader& shader) const;
+	// The item with this mesh's vertex array, material and uniforms
+	void fillDrawItem(DrawItem& item) const;
+	void setupCompactMesh(const MeshView& data, VertexFormatError* error);
+};
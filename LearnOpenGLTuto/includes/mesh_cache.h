@@ -0,0 +1,111 @@
+#pragma once
+
+#include <mesh.h>
+#include <mapped_file.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Cooked binary version of an imported model, stored next to the source as "<source>.meshcache"
+//
+// Layout (every blob 16 bytes aligned):
+//   MeshCacheHeader
+//   MeshCacheEntry[meshCount]
+//   MeshCacheTexture[textureCount]
+//   MeshLod[lodCount]
+//   Meshlet[meshletCount]
+//   ModelNode[nodeCount]
+//   MeshCacheDependency[dependencyCount]
+//   string table (NUL-terminated texture names and paths, dependency paths)
+//   per mesh: Vertex[vertexCount], uint16_t or unsigned int[indexCount] (see MeshCacheEntry::indexSize)
+//
+// Vertex and index blobs are handed to glBufferData straight from the mapping.
+struct MeshCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t importFlags;
+	uint32_t meshCount;
+	uint32_t textureCount;
+	uint32_t lodCount;
+	uint32_t meshletCount;
+	uint32_t nodeCount;
+	uint32_t dependencyCount;
+	uint32_t vertexSize;
+	uint64_t stringTableOffset;
+	uint64_t stringTableSize;
+
+	// Source identity, the cache is stale when none of these match
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	uint64_t sourceHash;
+};
+
+struct MeshCacheEntry {
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t firstTexture;
+	uint32_t textureCount;
+	uint32_t indexSize;
+	uint32_t firstLod;
+	uint32_t lodCount;
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+	uint32_t padding;
+};
+
+struct MeshCacheTexture {
+	uint32_t nameOffset;
+	uint32_t pathOffset;
+};
+
+// Other file the import read, like the material library of an OBJ: the cache is stale when one changes as well
+struct MeshCacheDependency {
+	uint32_t pathOffset;
+	uint32_t padding;
+	uint64_t size;
+	int64_t time;
+	uint64_t hash;
+};
+
+class MeshCache
+{
+public:
+	static constexpr uint32_t MAGIC = 0x434D4F4C; // "LOMC"
+	static constexpr uint32_t VERSION = 9;
+
+	static std::string getCachePath(const std::string& sourcePath);
+
+	// Writes the cache for sourcePath (meshes as optimized, see mesh_optimizer.h), returns false on I/O failure
+	// dependencies: the other files the import read, stamped with the source
+	static bool write(const std::string& sourcePath, unsigned int importFlags, const std::vector<MeshData>& meshes, const std::vector<ModelNode>& nodes,
+		const std::vector<std::string>& dependencies);
+
+	// Maps the cache for sourcePath, returns false if it is missing, corrupt or stale
+	bool open(const std::string& sourcePath, unsigned int importFlags);
+	void close();
+
+	unsigned int getMeshCount() const;
+	MeshView getMesh(unsigned int index) const;
+	// Returned textures only carry name and path, IDs are left to the caller
+	std::vector<Texture> getTextures(unsigned int index) const;
+	unsigned int getNodeCount() const;
+	const ModelNode& getNode(unsigned int index) const;
+
+private:
+	MappedFile file;
+
+	const MeshCacheHeader* header = nullptr;
+	const MeshCacheEntry* entries = nullptr;
+	const MeshCacheTexture* textures = nullptr;
+	const MeshLod* lods = nullptr;
+	const Meshlet* meshlets = nullptr;
+	const ModelNode* nodes = nullptr;
+	const MeshCacheDependency* dependencies = nullptr;
+	const char* strings = nullptr;
+
+	// Checks the header and that every offset stays inside the mapping, resolves the table pointers
+	bool validate();
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <mesh.h>
+
+#include <string>
+#include <vector>
+
+// Import-time optimization of a MeshData, in this order:
+//   weldVertices:        merges bitwise identical vertices (Assimp emits them once per face)
+//   optimizeVertexCache: reorders triangles for the post-transform vertex cache (Forsyth)
+//   optimizeOverdraw:    reorders clusters of triangles front to back without hurting the above much
+//   optimizeVertexFetch: reorders vertices by first use so fetches go through memory linearly
+// buildMeshlets then splits LOD 0 in clusters, generateLods appends simplified versions of the mesh to its
+// index buffer, and meshes with fewer than 65536 vertices get 16-bit indices, see packIndices
+
+// Average cache miss ratio: transformed vertices per triangle with a FIFO cache, 0.5 at best, 3 at worst
+float computeACMR(const std::vector<unsigned int>& indices, unsigned int cacheSize = 16);
+
+void weldVertices(MeshData& mesh);
+void optimizeVertexCache(std::vector<unsigned int>& indices, unsigned int vertexCount);
+// Clusters are only reordered if the ACMR stays within threshold times the current one
+void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, float threshold = 1.05f);
+void optimizeVertexFetch(MeshData& mesh);
+// Quadric error edge collapse (Garland & Heckbert) down to targetIndexCount, or until a collapse would move the
+// surface further than maxError (object space). The result indexes the same vertices. Borders are kept as is,
+// UV/normal seams only shorten along themselves with both sides collapsed together, where seams meet stays put.
+// resultError receives the error reached
+std::vector<unsigned int> simplifyMesh(const std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, size_t targetIndexCount, float maxError, float* resultError);
+// Moves indices into shortIndices when the mesh has fewer than 65536 vertices, true if it did
+bool packIndices(MeshData& mesh);
+
+// Totals over every mesh of a model
+struct MeshOptimizationStats {
+	unsigned int meshCount = 0;
+	unsigned int triangleCount = 0;
+	unsigned int vertexCountBefore = 0;
+	unsigned int vertexCountAfter = 0;
+	unsigned int shortIndexMeshCount = 0;
+	unsigned int lodCount = 0;
+	unsigned int lodTriangleCount = 0;	// Every LOD but LOD 0
+	unsigned int meshletCount = 0;
+	// Transformed vertices, i.e. ACMR * triangles
+	double transformsBefore = 0.0;
+	double transformsAfter = 0.0;
+
+	void print(const std::string& name) const;
+};
+
+// Runs the four optimization steps on one mesh, stats may be nullptr
+void optimizeMesh(MeshData& mesh, MeshOptimizationStats* stats);
+// Fills mesh.lods, halving the triangle count per LOD as long as simplification keeps up, stats may be nullptr
+void generateLods(MeshData& mesh, MeshOptimizationStats* stats, unsigned int maxLodCount = 4);
+// Splits the LOD 0 triangles, in their current order, into meshlets of at most maxVertices unique vertices and
+// maxTriangles triangles, stats may be nullptr. Must run before generateLods
+void buildMeshlets(MeshData& mesh, MeshOptimizationStats* stats, unsigned int maxVertices = 64, unsigned int maxTriangles = 124);
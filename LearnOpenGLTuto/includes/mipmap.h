@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct TextureImage;
+enum class TextureCompression;
+
+// CPU mip chains, built on the loader workers instead of glGenerateMipmap on the GL thread
+// Every level is RGBA8, the 2x2 box filter uses SSE2 (AVX2 as well when compiled with /arch:AVX2)
+enum class MipFilter {
+	Linear,		// plain average: data and color maps stored without gamma
+	SRGB,		// color maps with gamma: averaged in linear space then encoded back, alpha stays linear
+	Normal		// tangent space normal maps: averaged then renormalized
+};
+
+struct MipLevel {
+	unsigned int width;
+	unsigned int height;
+	size_t offset;		// in TextureImage::mipData
+	size_t size;
+};
+
+// Normal maps are the BC5 ones, see getTextureCompression
+MipFilter getMipFilter(bool gamma, TextureCompression compression);
+const char* getMipFilterName(MipFilter filter);
+unsigned int getMipCount(unsigned int width, unsigned int height);
+
+// 1 to 4 channels to RGBA8, grey is replicated to RGB like the BC4 swizzle does
+std::vector<unsigned char> expandToRGBA8(const unsigned char* data, unsigned int width, unsigned int height, int channelsNumber);
+// Next level of an RGBA8 image: max(1, width / 2) x max(1, height / 2)
+void downsampleRGBA8(const unsigned char* source, unsigned int width, unsigned int height, MipFilter filter, unsigned char* destination);
+// Same without SIMD, the reference for the benchmark
+void downsampleRGBA8Scalar(const unsigned char* source, unsigned int width, unsigned int height, MipFilter filter, unsigned char* destination);
+// Whole chain down to 1x1 in one buffer, level 0 included
+void buildMipChain(const unsigned char* rgba, unsigned int width, unsigned int height, MipFilter filter, std::vector<unsigned char>& data, std::vector<MipLevel>& levels);
+
+// GL thread, once the context exists: immutable storage needs GL 4.2 or ARB_texture_storage
+void initMipmaps();
+// GL thread only: uploads image.mipData, into glTexStorage2D storage when available
+unsigned int uploadMipChain(const TextureImage& image, bool gamma = false);
+
+// Every texture of a folder decoded once, then mipmapped by the driver and by both CPU builders
+struct MipmapBenchmark {
+	unsigned int textureCount = 0;
+	size_t texelCount = 0;
+	double driverMs = 0.0;		// glGenerateMipmap, glFinish included
+	double scalarMs = 0.0;
+	double simdMs = 0.0;
+
+	void print(const std::string& name) const;
+};
+// GL thread only
+MipmapBenchmark benchmarkMipmaps(const std::string& folderPath);
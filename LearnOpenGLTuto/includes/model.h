@@ -1,8 +1,14 @@
 #pragma once
 
 #include <shader.h>
+#include <shader_variants.h>
 #include <mesh.h>
+#include <mesh_cache.h>
+#include <scene_graph.h>
+#include <texture_cache.h>
 
+#include <chrono>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -12,21 +18,93 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+class TextureLoader;
+
+// CPU side of a model load, everything that can be built without the GL context
+struct ModelData {
+	std::string path;
+	std::string directory;
+
+	// Mapped when the mesh cache is up to date, imported through Assimp otherwise
+	MeshCache cache;
+	std::vector<MeshData> meshesData;
+
+	// One entry per mesh, pointing into either of the above
+	std::vector<MeshView> meshViews;
+	std::vector<std::vector<Texture>> meshTextures;
+	// The aiNode hierarchy, parent first, see Model::processNode
+	std::vector<ModelNode> nodes;
+
+	// Of the meshes placed by their nodes
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+};
+
 class Model
 {
 public:
-	Model(const std::string& path);
+	// Part of the mesh cache key, changing them invalidates every cooked model
+	static constexpr unsigned int IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_CalcTangentSpace;
+
+	// Loads synchronously, see ModelHandle for the asynchronous version
+	Model(const std::string& path, VertexFormat vertexFormat = VertexFormat::Float);
+	// Gives the meshes' ranges back to the BufferArena, BufferArena::defragmentAll() compacts it later
+	~Model();
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+
+	// Full resolution
 	void Draw(const Shader& shader);
+	// Queues a draw per mesh with its LOD, and the variant of lightFeatures and of the mesh's material maps,
+	// returns the number of triangles queued. depth is the view depth the meshes are sorted on
+	// With culling, meshes at LOD 0 only draw their meshlets in the frustum and facing the camera
+	// With frustumCulling, nothing is queued when the model's box is out of the frustum, then each mesh is tested on its own
+	// Each mesh is placed by model then the transforms of its node in the hierarchy
+	unsigned int enqueue(RenderQueue& queue, ShaderVariants& variants, uint32_t lightFeatures, const glm::mat4& model, float depth,
+		const LodSelection& selection, ClusterCulling* culling = nullptr, FrustumCulling* frustumCulling = nullptr);
+	// One instanced draw per mesh for every matrix of models, returns the number of triangles queued
+	// The meshes take the LOD of the instance nearestInstance, and draw it whole: meshlets are culled per instance
+	unsigned int enqueueInstances(RenderQueue& queue, ShaderVariants& variants, uint32_t lightFeatures, const glm::mat4* models,
+		unsigned int instanceCount, unsigned int nearestInstance, float depth, const LodSelection& selection);
+
+	const glm::vec3& getBoundsMin() const { return boundsMin; }
+	const glm::vec3& getBoundsMax() const { return boundsMax; }
+	BoundingBox getBounds() const { return { boundsMin, boundsMax }; }
+	VertexFormat getVertexFormat() const { return vertexFormat; }
+	// A node per aiNode in the order of ModelData::nodes, setting a local matrix moves its meshes from the next enqueue
+	SceneGraph& getHierarchy() { return hierarchy; }
 
 private:
+	friend class ModelHandle;
+
 	std::vector<Mesh> meshes;
 	std::string directory;
+	SceneGraph hierarchy;
+	std::vector<uint32_t> meshNodes;	// node of each mesh in hierarchy
+	// Current LOD of each mesh, kept from one frame to the next for the hysteresis
+	std::vector<unsigned int> meshLods;
+	// Same for the instanced draws, picked for the nearest instance
+	std::vector<unsigned int> instancedMeshLods;
 
-	std::vector<Texture> texturesLoaded;
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
 
-	void loadModel(const std::string& path);
-	void processNode(aiNode* node, const aiScene* scene);
-	Mesh processMesh(aiMesh* mesh, const aiScene* scene);
-	std::vector<Texture> loadMaterialTextures(aiMaterial* material, aiTextureType type, std::string typeName);
-};
+	VertexFormat vertexFormat = VertexFormat::Float;
+	VertexFormatError vertexFormatError;
 
+	// Keeps this model's textures alive in the TextureCache
+	std::vector<TextureHandle> texturesLoaded;
+
+	explicit Model(VertexFormat vertexFormat) : vertexFormat(vertexFormat) {}
+
+	// Any thread: maps the mesh cache or imports the model (and cooks the cache), nullptr on failure
+	static std::unique_ptr<ModelData> loadData(const std::string& path);
+	// Walks the hierarchy depth first, the node and its meshes before its children
+	static void processNode(aiNode* node, const aiScene* scene, uint32_t parent, std::vector<MeshData>& meshesData, std::vector<ModelNode>& nodes);
+	static MeshData processMesh(aiMesh* mesh, const aiScene* scene);
+	static std::vector<Texture> loadMaterialTextures(aiMaterial* material, aiTextureType type, std::string typeName);
+
+	// GL thread: creates meshes then uploads textures until done or past the deadline, true once complete
+	bool upload(ModelData& data, TextureLoader& textureLoader, std::chrono::steady_clock::time_point deadline);
+	void resolveTextures(const TextureLoader& textureLoader);
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <model.h>
+#include <texture_loader.h>
+#include <thread_pool.h>
+
+#include <future>
+#include <memory>
+#include <string>
+
+// Model loaded in the background: import (or cache mapping) and vertex conversion run on a
+// ThreadPool worker, the GL upload is then spread over several frames by update()
+class ModelHandle
+{
+public:
+	explicit ModelHandle(const std::string& path, VertexFormat vertexFormat = VertexFormat::Float, ThreadPool& pool = ThreadPool::getInstance());
+	~ModelHandle();
+
+	ModelHandle(const ModelHandle&) = delete;
+	ModelHandle& operator=(const ModelHandle&) = delete;
+
+	// GL thread, once per frame: spends at most budgetMilliseconds finalizing the upload
+	void update(double budgetMilliseconds = 2.0);
+
+	bool isReady() const { return ready; }
+	bool hasFailed() const { return failed; }
+	// Known as soon as the background import is done, before the model is ready
+	bool hasBounds() const { return data != nullptr || ready; }
+	glm::vec3 getBoundsMin() const;
+	glm::vec3 getBoundsMax() const;
+
+	// nullptr until ready
+	Model* get() const { return ready ? model.get() : nullptr; }
+	const std::string& getPath() const { return path; }
+
+private:
+	std::string path;
+	VertexFormat vertexFormat;
+
+	std::future<std::unique_ptr<ModelData>> pendingData;
+	std::unique_ptr<ModelData> data;
+	std::unique_ptr<TextureLoader> textureLoader;
+	std::unique_ptr<Model> model;
+
+	bool ready = false;
+	bool failed = false;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Driver-specific binary of a linked program, stored next to its vertex shader as
+// "<vertex shader>.<fragment shader file name>[.<variant>].progbin"
+struct ProgramBinaryHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t binaryFormat;	// from glGetProgramBinary
+	uint32_t binarySize;	// bytes following the header
+	// The binary is stale when one of these changed: the GLSL sources, or the vendor, renderer and version strings
+	uint64_t sourceHash;
+	uint64_t driverHash;
+};
+
+// Saves linked programs with glGetProgramBinary and reloads them with glProgramBinary on the next runs,
+// skipping compilation and linking. The binary is invalidated when the sources or the driver change,
+// and whenever the driver rejects it: the program is then built from source and the binary rewritten
+class ProgramCache
+{
+public:
+	static constexpr uint32_t MAGIC = 0x42504F4C; // "LOPB"
+	static constexpr uint32_t VERSION = 1;
+
+	struct Stats {
+		unsigned int hits = 0;
+		unsigned int misses = 0;			// no binary yet
+		unsigned int invalidations = 0;		// stale or rejected binary
+		double buildMs = 0.0;				// spent building programs, from binaries or from source
+	};
+
+	static ProgramCache& getInstance();
+	// variant tells apart the programs built from the same files with different #defines
+	static std::string getCachePath(const std::string& vertexPath, const std::string& fragmentPath, const std::string& variant = "");
+
+	ProgramCache(const ProgramCache&) = delete;
+	ProgramCache& operator=(const ProgramCache&) = delete;
+
+	// GL thread, once the context is current: loads the entry points (core in 4.1 only) and hashes the driver
+	// identity. The cache stays disabled without them or when the driver has no binary format
+	void init();
+	bool isEnabled() const { return enabled; }
+
+	// GL thread: a linked program built from the binary, or 0 to build it from source
+	unsigned int load(const std::string& cachePath, uint64_t sourceHash);
+	// GL thread, before glLinkProgram: some drivers only keep a retrievable binary when asked to
+	void prepare(unsigned int program) const;
+	// GL thread: writes the binary of a linked program, returns false if there is none or on I/O failure
+	bool save(const std::string& cachePath, uint64_t sourceHash, unsigned int program);
+
+	void addBuildTime(double ms) { stats.buildMs += ms; }
+	const Stats& getStats() const { return stats; }
+	void printStats() const;
+
+private:
+	bool enabled = false;
+	uint64_t driverHash = 0;
+	Stats stats;
+
+	ProgramCache() = default;
+};
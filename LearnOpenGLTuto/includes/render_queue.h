@@ -0,0 +1,162 @@
+#pragma once
+
+#include <shader.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+class Material;
+
+// Arguments of the draw call of a DrawItem
+struct DrawCall {
+	unsigned int mode = 0;		// GL_TRIANGLES, GL_LINES, ...
+	unsigned int count = 0;		// vertices or indices
+	unsigned int indexType = 0;	// 0 for glDrawArrays
+	size_t first = 0;			// first vertex, or byte offset of the first index
+	int baseVertex = 0;
+	// When rangeCount > 0: glMultiDrawElementsBaseVertex over the ranges added with RenderQueue::addRanges, count is unused
+	unsigned int rangeOffset = 0;
+	unsigned int rangeCount = 0;
+	// When instanceCount > 0: one instanced draw of the matrices added with RenderQueue::addInstances, read by the
+	// vertex shader from the attribute at RenderQueue::INSTANCE_MODEL_LOCATION instead of the model uniform. Not with ranges
+	unsigned int firstInstance = 0;
+	unsigned int instanceCount = 0;
+};
+
+// Everything a draw needs, collected during the frame and submitted by the RenderQueue
+struct DrawItem {
+	unsigned int pass = 0;
+	Shader* shader = nullptr;
+	unsigned int vertexArray = 0;
+	// Binds its textures and sets its samplers, or textures[unit] is bound when null (0: left as is)
+	const Material* material = nullptr;
+	unsigned int textures[4] = { 0, 0, 0, 0 };
+	float depth = 0.0f;			// view space, the closer draws go first within a state
+	glm::mat4 model = glm::mat4(1.0f);	// unused by instanced draws
+	// Uniforms other than model, for the few draws that have some. Called right before the draw
+	std::function<void(Shader&)> setUniforms;
+	// Items with the same non-zero key set the same uniforms, they can share a batch. 0: setUniforms is unique to the item
+	uint64_t uniformKey = 0;
+	DrawCall call = {};
+};
+
+// Draws of a frame sorted on a 64-bit key (pass, program, textures, vertex array, depth) and submitted in that order,
+// binding a state only when it differs from the previous draw's. State changes per frame follow the number of
+// unique states rather than the number of draws.
+// Consecutive indexed draws of the same state are then merged into batches, one multi-draw each: the meshes of a model
+// sharing a material, or the instanced draws of a state whatever their matrices when glMultiDrawElementsIndirect is there
+class RenderQueue
+{
+public:
+	static constexpr unsigned int MAX_PASSES = 16;
+	static constexpr unsigned int TEXTURE_UNITS = 4;
+	// mat4 per instance, over 4 vec4 attributes from this one. After the attributes of every VertexFormat
+	static constexpr unsigned int INSTANCE_MODEL_LOCATION = 6;
+
+	struct Stats {
+		unsigned int itemCount = 0;
+		unsigned int programChanges = 0;
+		unsigned int textureChanges = 0;
+		unsigned int vertexArrayChanges = 0;
+		unsigned int instanceCount = 0;		// drawn by instanced items
+		unsigned int batchCount = 0;		// draw calls once merged
+		double sortMs = 0.0;
+	};
+
+	// GL thread, once at startup: glMultiDrawElementsIndirect and the base instances of its commands (GL 4.3), when the
+	// driver has them. Without them only the non instanced draws are merged, with glMultiDrawElementsBaseVertex
+	static void initMultiDrawIndirect();
+	static bool hasMultiDrawIndirect();
+
+	// Called around the draws of a pass when it has any: viewport, depth clear, line width, ...
+	void setPass(unsigned int pass, std::function<void()> begin, std::function<void()> end = nullptr);
+	// Depth past which the depth part of the keys saturates
+	void setFarDepth(float farDepth) { this->farDepth = farDepth; }
+
+	void add(DrawItem item);
+	// Ranges of a multi-draw, returns the rangeOffset of the DrawCall
+	unsigned int addRanges(const int* counts, const void* const* offsets, unsigned int rangeCount, int baseVertex);
+	// Model matrices of an instanced draw, returns the firstInstance of the DrawCall
+	unsigned int addInstances(const glm::mat4* models, unsigned int instanceCount);
+
+	// GL thread: sorts and draws everything added since the last submit, then leaves no program, vertex array or texture bound
+	void submit();
+
+	// Deletes the instance and indirect buffers, at shutdown
+	void clear();
+
+	const Stats& getStats() const { return stats; }
+
+private:
+	struct SortEntry {
+		uint64_t key;
+		uint32_t item;
+	};
+
+	struct Pass {
+		std::function<void()> begin;
+		std::function<void()> end;
+	};
+
+	// Sorted entries drawn by one call
+	struct Batch {
+		uint32_t firstEntry;
+		uint32_t entryCount;
+		uint32_t commandOffset;	// when merged, in the indirect commands or in the ranges
+	};
+
+	// Layout glMultiDrawElementsIndirect reads
+	struct DrawElementsIndirectCommand {
+		uint32_t count;
+		uint32_t instanceCount;
+		uint32_t firstIndex;
+		int32_t baseVertex;
+		uint32_t baseInstance;
+	};
+
+	Pass passes[MAX_PASSES];
+	float farDepth = 100.0f;
+
+	std::vector<DrawItem> items;
+	std::vector<SortEntry> entries;
+	std::vector<SortEntry> sortBuffer;
+	std::vector<int> rangeCounts;
+	std::vector<const void*> rangeOffsets;
+	std::vector<int> rangeBaseVertices;
+	std::vector<glm::mat4> instanceModels;
+	std::vector<Batch> batches;
+	std::vector<DrawElementsIndirectCommand> indirectCommands;
+
+	// Every instance of the frame in one buffer, respecified at each submit. It only grows, the attributes of
+	// vertex arrays pointed at it last frame never point past its end
+	unsigned int instanceBuffer = 0;
+	size_t instanceCapacity = 0;
+	// The commands of the frame, respecified at each submit
+	unsigned int indirectBuffer = 0;
+	size_t indirectCapacity = 0;
+
+	// Ranks of the states in order of first use this frame, the key fields
+	std::unordered_map<const Shader*, uint32_t> shaderRanks;
+	std::unordered_map<uint64_t, uint32_t> textureRanks;
+	std::unordered_map<unsigned int, uint32_t> vertexArrayRanks;
+
+	// program -> model handle, resolved the first time the queue draws with the program
+	std::unordered_map<unsigned int, UniformHandle<glm::mat4>> modelUniforms;
+
+	Stats stats;
+
+	uint64_t makeKey(const DrawItem& item);
+	UniformHandle<glm::mat4> getModelUniform(const Shader& shader);
+	void sortEntries();
+	void uploadInstances();
+	// Points the instance attributes of the bound vertex array at the instances from firstInstance
+	void bindInstances(unsigned int firstInstance) const;
+	void buildBatches();
+	void uploadCommands();
+	void draw(const DrawItem& item) const;
+	void drawBatch(const Batch& batch) const;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Hierarchy of transforms, one array per field with the nodes in parent before child order. Setting a local matrix
+// marks the node dirty, update() then recomputes the world matrices below the dirty nodes in one sweep over the
+// arrays: parents are always done by the time their children are reached. Nothing to do while no node moves
+class SceneGraph
+{
+public:
+	static constexpr uint32_t NO_PARENT = ~0u;
+
+	struct Stats {
+		unsigned int nodeCount = 0;
+		// Of the last update
+		unsigned int sweptNodeCount = 0;	// from the first dirty node to the end
+		unsigned int updatedNodeCount = 0;
+		double updateMs = 0.0;
+	};
+
+	// The parent has to exist already, which keeps parents before their children
+	uint32_t addNode(const glm::mat4& local, uint32_t parent = NO_PARENT);
+	void reserve(size_t nodeCount);
+	void clear();
+
+	void setLocal(uint32_t node, const glm::mat4& local);
+	const glm::mat4& getLocal(uint32_t node) const { return locals[node]; }
+	// As of the last update, consecutive nodes have consecutive matrices
+	const glm::mat4& getWorld(uint32_t node) const { return worlds[node]; }
+	uint32_t getParent(uint32_t node) const { return parents[node]; }
+	unsigned int getNodeCount() const { return static_cast<unsigned int>(parents.size()); }
+
+	void update();
+	// Nodes whose world matrix the last update recomputed, in order
+	const std::vector<uint32_t>& getUpdatedNodes() const { return updatedNodes; }
+	const Stats& getStats() const { return stats; }
+
+private:
+	std::vector<glm::mat4> locals;
+	std::vector<glm::mat4> worlds;
+	std::vector<uint32_t> parents;
+	std::vector<uint8_t> dirty;
+	uint32_t firstDirty = NO_PARENT;
+
+	std::vector<uint32_t> updatedNodes;
+	Stats stats;
+
+	void markDirty(uint32_t node);
+};
@@ -2,20 +2,98 @@
 
 #include <glm/glm.hpp>
 
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// FNV-1a, constexpr so that the names of uniforms known at compile time are hashed by the compiler
+constexpr uint32_t hashUniformName(const char* name) {
+	uint32_t hash = 2166136261u;
+	while (*name) {
+		hash ^= (uint32_t)(unsigned char)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// A uniform name with its hash, e.g. static constexpr UniformName VIEW("view");
+struct UniformName {
+	uint32_t hash;
+	const char* name;
+
+	constexpr UniformName(const char* name) : hash(hashUniformName(name)), name(name) {}
+	UniformName(const std::string& name) : UniformName(name.c_str()) {}
+};
+
+// Location of a uniform of GLSL type T, resolved once with Shader::getUniform. -1 when the program doesn't use it,
+// setting it is then a no-op like for glUniform
+template <typename T>
+struct UniformHandle {
+	int location = -1;
+
+	explicit operator bool() const { return location >= 0; }
+};
 
 class Shader {
 public:
+	enum class Status {
+		Compiling,
+		Ready,
+		Failed
+	};
+
 	unsigned int ID;
 
-	Shader(const char* vertexPath, const char* fragmentPath);
+	// Loads GL_KHR_parallel_shader_compile when available, the driver then compiles async programs on its own threads
+	static void initParallelCompile();
+	static bool hasParallelCompile();
+
+	// With async, compiling and linking are only kicked off: submit every program first, then poll() them
+	// Otherwise the program is ready, or failed, once constructed
+	Shader(const char* vertexPath, const char* fragmentPath, bool async = false);
+	// Each define is inserted as "#define <define>" after the #version line of both shaders, see ShaderVariants
+	Shader(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines, bool async = false);
+
+	// The program belongs to a single Shader, moved ones included
+	Shader(const Shader&) = delete;
+	Shader& operator=(const Shader&) = delete;
+	Shader(Shader&& other) noexcept;
+
+	// Finishes the program once the driver is done with it, true when no longer compiling
+	// Doesn't block with parallel compile, else it waits for the driver like finish()
+	bool poll();
+	// Waits for the driver and finishes the program
+	void finish();
+	Status getStatus() const { return status; }
+	bool isReady() const { return status == Status::Ready; }
+	// Called once the program is ready, right away if it already is: sampler units and other constant uniforms
+	void setOnReady(std::function<void(Shader&)> callback);
 
 	void use();
 	static void release();
 
+	// Supported types: bool, int (samplers included), float, glm::vec3, glm::vec4 and glm::mat4
+	// Warns and returns an invalid handle when the uniform exists with another type
+	template <typename T>
+	UniformHandle<T> getUniform(const UniformName& name) const;
+
+	// Points the uniform block at a buffer binding point, returns false when the program has no such block
+	bool bindUniformBlock(const char* name, unsigned int binding) const;
+
+	void set(UniformHandle<bool> uniform, bool value) const;
+	void set(UniformHandle<int> uniform, int value) const;
+	void set(UniformHandle<float> uniform, float value) const;
+	void set(UniformHandle<glm::vec3> uniform, const glm::vec3& value) const;
+	void set(UniformHandle<glm::vec4> uniform, const glm::vec4& value) const;
+	void set(UniformHandle<glm::mat4> uniform, const glm::mat4& value) const;
+
+	// Slow path for occasional uniforms: the name is hashed and looked up on every call,
+	// per frame uniforms go through a UniformHandle
 	void setBool(const std::string& name, bool value) const;
 	void setInt(const std::string& name, int value) const;
 	void setFloat(const std::string& name, float value) const;
@@ -27,4 +105,30 @@ public:
 	void setFloat4(const std::string& name, float r, float g, float b, float a) const;
 
 	void setMatrixFloat4v(const std::string& name, int count, const glm::mat4& mat) const;
-};
\ No newline at end of file
+
+private:
+	Status status = Status::Compiling;
+	unsigned int vertexShader = 0;
+	unsigned int fragmentShader = 0;
+	std::string cachePath;
+	uint64_t sourceHash = 0;
+	std::function<void(Shader&)> onReady;
+
+	struct Uniform {
+		std::string name;
+		int location;
+		unsigned int type;	// GL_FLOAT_VEC3, GL_SAMPLER_2D, ...
+		int size;			// element count for arrays
+	};
+
+	// Active uniforms, reflected once after linking. Each element of an array is registered as "name[i]",
+	// the first one also as "name"
+	std::vector<Uniform> uniforms;
+	std::unordered_multimap<uint32_t, unsigned int> uniformIndices;	// name hash -> index in uniforms
+
+	void compile(const std::string& vertexCode, const std::string& fragmentCode);
+	void reflectUniforms();
+	void addUniform(const std::string& name, int location, unsigned int type, int size);
+	const Uniform* findUniform(const UniformName& name) const;
+	int getLocation(const std::string& name) const;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <shader.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Bits of a variant key, each one a #define of the same name in both shaders
+namespace ShaderFeature {
+	// Maps of the material, the missing ones aren't sampled
+	constexpr uint32_t SPECULAR_MAP = 1 << 0;
+	constexpr uint32_t EMISSION_MAP = 1 << 1;
+	constexpr uint32_t NORMAL_MAP = 1 << 2;
+	constexpr uint32_t HEIGHT_MAP = 1 << 3;
+	// Kinds of lights in the light set, the code of the others is left out
+	constexpr uint32_t DIRECTIONAL_LIGHT = 1 << 4;
+	constexpr uint32_t POINT_LIGHTS = 1 << 5;
+	constexpr uint32_t SPOT_LIGHTS = 1 << 6;
+	// Model matrix read per instance, see DrawCall::instanceCount
+	constexpr uint32_t INSTANCED = 1 << 7;
+
+	constexpr uint32_t MATERIAL_MASK = SPECULAR_MAP | EMISSION_MAP | NORMAL_MAP | HEIGHT_MAP;
+	constexpr uint32_t LIGHT_MASK = DIRECTIONAL_LIGHT | POINT_LIGHTS | SPOT_LIGHTS;
+
+	std::vector<std::string> getDefines(uint32_t features);
+}
+
+// Programs built from one vertex/fragment shader pair, specialized on ShaderFeature bits
+// A variant is compiled asynchronously the first time it is asked for, then kept under its feature bits
+class ShaderVariants
+{
+public:
+	// onReady sets the constant uniforms of every variant, see Shader::setOnReady
+	// fallback draws while neither the variant nor a stand-in is ready, instancedFallback for the INSTANCED variants
+	ShaderVariants(const std::string& vertexPath, const std::string& fragmentPath, Shader& fallback, Shader& instancedFallback,
+		std::function<void(Shader&)> onReady = nullptr);
+	ShaderVariants(const ShaderVariants&) = delete;
+	ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+	// GL thread: the variant of features, compiling it if it is new. While it compiles the variant with every light
+	// stands in, the shaders still read the light counts. The fallback is returned when that one isn't ready either
+	Shader& get(uint32_t features);
+	// GL thread, once per frame: finishes the variants the driver is done with, returns how many still compile
+	unsigned int poll();
+	// Every ready variant, to set the uniforms they share
+	void forEachReady(const std::function<void(Shader&)>& callback);
+
+	unsigned int getVariantCount() const { return (unsigned int)variants.size(); }
+
+private:
+	std::string vertexPath;
+	std::string fragmentPath;
+	Shader& fallback;
+	Shader& instancedFallback;
+	std::function<void(Shader&)> onReady;
+	// Heap allocated: onReady callbacks and callers keep references to the variants
+	std::unordered_map<uint32_t, std::unique_ptr<Shader>> variants;
+
+	Shader& request(uint32_t features);
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <utils.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Reference to a texture owned by the TextureCache, the GL texture is deleted with its last handle
+class TextureHandle
+{
+public:
+	TextureHandle() = default;
+	~TextureHandle();
+
+	TextureHandle(const TextureHandle& other);
+	TextureHandle& operator=(const TextureHandle& other);
+	TextureHandle(TextureHandle&& other) noexcept;
+	TextureHandle& operator=(TextureHandle&& other) noexcept;
+
+	unsigned int getID() const { return ID; }
+	explicit operator bool() const { return ID != 0; }
+
+private:
+	friend class TextureCache;
+
+	// Takes a reference that was already counted
+	explicit TextureHandle(unsigned int ID) : ID(ID) {}
+
+	unsigned int ID = 0;
+};
+
+// Process-wide texture registry shared by every Model and the free-standing textures
+// Textures are found by canonical path first, then by hash of the file content, so the same image
+// is only uploaded once even when it lives in several folders. GL thread only.
+class TextureCache
+{
+public:
+	static TextureCache& getInstance();
+
+	// Empty handle when the path hasn't been loaded yet
+	TextureHandle find(const std::string& folderPath, const std::string& name, bool gamma = false);
+	// Uploads the image unless the same content is already cached, and registers its path
+	TextureHandle add(const TextureImage& image, bool gamma = false);
+	// Synchronous find-or-load
+	TextureHandle load(const std::string& folderPath, const std::string& name, bool gamma = false);
+
+	// Deletes every texture, outstanding handles become dangling: only call at shutdown
+	void clear();
+
+	size_t getTextureCount() const { return entries.size(); }
+	unsigned int getPathHits() const { return pathHits; }
+	unsigned int getContentHits() const { return contentHits; }
+
+private:
+	struct Entry {
+		unsigned int refCount = 0;
+		uint64_t contentKey = 0;
+		std::vector<std::string> pathKeys;
+	};
+
+	std::unordered_map<std::string, unsigned int> texturesByPath;
+	std::unordered_map<uint64_t, unsigned int> texturesByContent;
+	std::unordered_map<unsigned int, Entry> entries;
+
+	unsigned int pathHits = 0;
+	unsigned int contentHits = 0;
+
+	TextureCache() = default;
+
+	static std::string getPathKey(const std::string& path, bool gamma);
+	static uint64_t getContentKey(uint64_t contentHash, bool gamma);
+
+	TextureHandle acquire(unsigned int textureID);
+
+	friend class TextureHandle;
+	void addReference(unsigned int textureID);
+	void release(unsigned int textureID);
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <mipmap.h>
+
+#include <cstddef>
+#include <string>
+
+struct TextureImage;
+
+// Block compression of model textures, 4x4 texels per block
+//   BC1: RGB, 8 bytes per block        (diffuse maps without alpha)
+//   BC3: RGBA, 16 bytes per block      (diffuse maps with alpha)
+//   BC4: R, 8 bytes per block          (specular maps, sampled as grey through a swizzle)
+//   BC5: RG, 16 bytes per block        (normal maps, xy only, z has to be rebuilt when sampled)
+// Compressed mip chains are written once next to the source as "<source>.bc1.dds" and so on, one per compression (DX10 header)
+enum class TextureCompression {
+	None,
+	BC1,
+	BC3,
+	BC4,
+	BC5
+};
+
+struct CompressedMip {
+	unsigned int width;
+	unsigned int height;
+	size_t offset;		// in TextureImage::compressedData
+	size_t size;
+};
+
+// GL thread, once the context exists: BC1 and BC3 need EXT_texture_compression_s3tc, BC4/BC5 are core
+void initTextureCompression();
+
+const char* getTextureCompressionName(TextureCompression compression);
+// .obj files list normal maps as bump maps, which Assimp reports as height maps: *_ddn are normal maps whatever the type
+bool isNormalMap(const std::string& typeName, const std::string& path);
+// Diffuse and emission maps hold sRGB encoded colors: sampled through sRGB formats, mipmapped in linear space
+bool isColorMap(const std::string& typeName);
+// From the Assimp texture type ("diffuse", "specular", "normal", "height") and the file name (*_ddn are normal maps)
+TextureCompression getTextureCompression(const std::string& typeName, const std::string& path);
+// One copy per compression, the same image can be used in several roles
+std::string getCompressedTexturePath(const std::string& sourcePath, TextureCompression compression);
+
+// Any thread: encodes image.data with its whole mip chain, BC1 is promoted to BC3 when the image has alpha
+bool compressTexture(TextureImage& image, TextureCompression compression, MipFilter filter = MipFilter::Linear);
+// Any thread: the source stamp is stored along the blocks to detect stale copies. compression is the one
+// compressTexture was asked for, image.compression may be BC3 for BC1
+bool writeCompressedTexture(const std::string& sourcePath, const TextureImage& image, TextureCompression compression);
+// Any thread: false if the compressed copy is missing, corrupt, older than the source or in another format
+bool readCompressedTexture(const std::string& sourcePath, TextureImage& image, TextureCompression compression);
+
+// GL thread only
+unsigned int uploadCompressedTexture(const TextureImage& image, bool gamma = false);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <utils.h>
+#include <thread_pool.h>
+#include <texture_cache.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Decodes images on a ThreadPool and uploads them on the GL thread as soon as each one is ready
+// Images already in the TextureCache are neither decoded nor uploaded again
+class TextureLoader
+{
+public:
+	explicit TextureLoader(ThreadPool& pool = ThreadPool::getInstance());
+	~TextureLoader();
+
+	TextureLoader(const TextureLoader&) = delete;
+	TextureLoader& operator=(const TextureLoader&) = delete;
+
+	// Queues a decode, a path already requested or cached is ignored
+	// With a compression, the block compressed copy is read (or written) on the worker
+	void request(const std::string& folderPath, const std::string& name, bool gamma = false, TextureCompression compression = TextureCompression::None);
+
+	// GL thread only: uploads what has finished decoding, at most maxUploads (0 => no limit), returns the number uploaded
+	unsigned int uploadReady(unsigned int maxUploads = 0);
+	// GL thread only: blocks until every requested texture is uploaded
+	void uploadAll();
+
+	bool isDone() const;
+	// Empty until the texture has been uploaded
+	TextureHandle getTexture(const std::string& name) const;
+
+private:
+	struct DecodedTexture {
+		TextureImage image;
+		bool gamma;
+	};
+
+	ThreadPool& pool;
+
+	mutable std::mutex mutex;
+	std::condition_variable decoded;
+	std::deque<DecodedTexture> finished;
+	unsigned int pendingDecodes = 0;
+
+	// GL thread only
+	std::unordered_map<std::string, TextureHandle> textures;
+	unsigned int pendingUploads = 0;
+
+	void upload(DecodedTexture& texture);
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads consuming a FIFO of tasks
+class ThreadPool
+{
+public:
+	// 0 => one worker per hardware thread, minus the one running the GL context
+	explicit ThreadPool(unsigned int threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Shared pool used by the loaders
+	static ThreadPool& getInstance();
+
+	unsigned int getThreadCount() const { return (unsigned int)workers.size(); }
+
+	template<typename F>
+	auto submit(F&& task) -> std::future<decltype(task())> {
+		using Result = decltype(task());
+		auto packagedTask = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+		std::future<Result> future = packagedTask->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.emplace([packagedTask]() { (*packagedTask)(); });
+		}
+		taskAvailable.notify_one();
+		return future;
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable taskAvailable;
+	bool stopping = false;
+
+	void workerLoop();
+};
@@ -7,12 +7,18 @@
 #include <imgui/imgui.h>
 //#include <imgui_bezier.h>
 
+#include <mipmap.h>
+#include <texture_compression.h>
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/matrix_interpolation.hpp>
 
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 #include <map>
 #include <thread>
@@ -27,8 +33,57 @@ struct glfwDeleter
 	}
 };
 
+struct stbiDeleter
+{
+	void operator()(unsigned char* data)
+	{
+		stbi_image_free(data);
+	}
+};
+
+// Decoded image waiting to be uploaded
+struct TextureImage {
+	std::string name;
+	std::string path;
+	uint64_t contentHash = 0;	// of the encoded file
+	int width = 0;
+	int height = 0;
+	int channelsNumber = 0;
+	std::unique_ptr<unsigned char, stbiDeleter> data;
+
+	// RGBA8 mip chain built on the decoding thread, uploaded instead of data when present
+	std::vector<unsigned char> mipData;
+	std::vector<MipLevel> mips;
+
+	// Block compressed mip chain, uploaded instead of data when present
+	TextureCompression compression = TextureCompression::None;
+	std::vector<unsigned char> compressedData;
+	std::vector<CompressedMip> compressedMips;
+
+	bool isValid() const { return data != nullptr || !mips.empty() || !compressedMips.empty(); }
+};
+
+// Size and modification time, enough to tell most source changes without reading the file
+struct SourceStamp {
+	uint64_t size = 0;
+	int64_t time = 0;
+};
+
 void showImguiDemo();
+// FNV-1a
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
+// 0 when the file can't be read
+uint64_t hashFile(const std::string& path);
+bool getSourceStamp(const std::string& path, SourceStamp& stamp);
+// GL thread only
+bool hasGLExtension(const char* name);
 unsigned int createTexture(const std::string& folderPath, const std::string& name, bool gamma = false);
+// Thread safe, doesn't touch the GL context
+// With a compression, the compressed copy next to the file is used, or written on the first load
+// Otherwise the mip chain is built here, filtered in linear space when gamma is set
+bool decodeTexture(const std::string& folderPath, const std::string& name, TextureImage& image, TextureCompression compression = TextureCompression::None, bool gamma = false);
+// GL thread only
+unsigned int uploadTexture(const TextureImage& image, bool gamma = false);
 
 void processInput(GLFWwindow* window, double deltaTime);
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
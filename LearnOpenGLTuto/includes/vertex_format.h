@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct Vertex;
+
+// GPU layout of a Mesh's vertices
+//   Float:   the 56 bytes Vertex as is
+//   Half:    CompactVertex, half-float positions relative to the mesh bounds
+//   Snorm16: CompactVertex, snorm16 positions relative to the mesh bounds
+// Compact layouts store octahedral normal/tangent and rebuild the bitangent from a sign,
+// they need shader_texture_phong_materials_compact.vert to decode them
+enum class VertexFormat {
+	Float,
+	Half,
+	Snorm16
+};
+
+// 20 bytes
+struct CompactVertex {
+	uint16_t Position[4];	// xyz in [-1, 1] of the bounds, w: bitangent sign (+-1)
+	int16_t Normal[2];		// octahedral, snorm16
+	int16_t Tangent[2];		// octahedral, snorm16
+	uint16_t TexCoords[2];	// half-float
+};
+
+// Position = Center + Extent * decoded position
+struct VertexQuantization {
+	glm::vec3 Center = glm::vec3(0.0f);
+	glm::vec3 Extent = glm::vec3(1.0f);
+};
+
+// Compact vs float reference, accumulated over one or several meshes
+struct VertexFormatError {
+	unsigned int vertexCount = 0;
+	float maxPositionError = 0.0f;		// object space units
+	double sumPositionError = 0.0;
+	float maxNormalAngle = 0.0f;		// degrees
+	float maxTangentAngle = 0.0f;		// degrees
+	float maxBitangentAngle = 0.0f;		// degrees, rebuilt from normal, tangent and sign
+	float maxTexCoordError = 0.0f;
+
+	void merge(const VertexFormatError& other);
+	void print(VertexFormat format) const;
+};
+
+const char* getVertexFormatName(VertexFormat format);
+unsigned int getVertexSize(VertexFormat format);
+
+glm::vec2 encodeOctahedral(const glm::vec3& direction);
+glm::vec3 decodeOctahedral(const glm::vec2& encoded);
+
+// error may be nullptr when no report is needed
+std::vector<CompactVertex> compressVertices(const Vertex* vertices, unsigned int vertexCount, VertexFormat format, VertexQuantization& quantization, VertexFormatError* error);
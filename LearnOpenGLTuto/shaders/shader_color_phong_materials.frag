@@ -7,42 +7,54 @@ struct Material {
 	float shininess;
 };
 
+// std140, mirrored in light_block.h: the scalars fill the 4th component of the vec3 before them
 struct DirectionalLight {
 	vec3 direction;
-	
 	vec3 ambient;
 	vec3 diffuse;
 	vec3 specular;
 };
 
+// Read from lightData, 4 texels
 struct PointLight {
 	vec3 position;
-
 	float constant;
-	float linear;
-	float quadratic;
-
 	vec3 ambient;
+	float linear;
 	vec3 diffuse;
+	float quadratic;
 	vec3 specular;
 };
 
+// Read from lightData after the point lights, 5 texels
 struct SpotLight {
 	vec3 position;
-	vec3 direction;
-
 	float innerCutOff;
+	vec3 direction;
 	float outerCutOff;
-
+	vec3 ambient;
 	float constant;
+	vec3 diffuse;
 	float linear;
+	vec3 specular;
 	float quadratic;
+};
 
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
+// Shared by every lit program, see LightBlock and LightGrid
+layout (std140) uniform LightBlock {
+	int					directionalLightCount;
+	int					pointLightCount;
+	int					spotLightCount;
+	vec4				viewDepthPlane;
+	vec4				clusterScale;		// tiles per pixel in xy, slice scale and bias in zw
+	ivec4				clusterCount;
+	DirectionalLight	directionalLight;
 };
 
+uniform		samplerBuffer		lightData;
+uniform		usamplerBuffer		lightClusters;		// first light index, point light count | spot light count << 16
+uniform		usamplerBuffer		lightIndices;
+
 in vec2		TexCoord;
 in vec3		FragNormal;
 in vec3		FragPosition;
@@ -52,10 +64,6 @@ out vec4	FragColor;
 uniform		vec3				viewPosition;
 uniform		Material			material;
 
-uniform		DirectionalLight	directionalLight;
-uniform		PointLight			pointLights[10];	// TODO: pas besoin de spcifier de taille ?
-uniform		SpotLight			spotLights[10];		// TODO: pas besoin de spcifier de taille ?
-
 vec3 computeDirectionalLight(DirectionalLight light, vec3 fragNormal, vec3 viewDirection) {
 	vec3 lightDirection = normalize(-light.direction);
 	
@@ -147,6 +155,33 @@ vec3 computeSpotLight(SpotLight light, vec3 fragNormal, vec3 fragPosition, vec3
 }
 
 
+PointLight fetchPointLight(int index) {
+	int texel = index * 4;
+	vec4 data0 = texelFetch(lightData, texel);
+	vec4 data1 = texelFetch(lightData, texel + 1);
+	vec4 data2 = texelFetch(lightData, texel + 2);
+	vec4 data3 = texelFetch(lightData, texel + 3);
+	return PointLight(data0.xyz, data0.w, data1.xyz, data1.w, data2.xyz, data2.w, data3.xyz);
+}
+
+SpotLight fetchSpotLight(int index) {
+	int texel = pointLightCount * 4 + index * 5;
+	vec4 data0 = texelFetch(lightData, texel);
+	vec4 data1 = texelFetch(lightData, texel + 1);
+	vec4 data2 = texelFetch(lightData, texel + 2);
+	vec4 data3 = texelFetch(lightData, texel + 3);
+	vec4 data4 = texelFetch(lightData, texel + 4);
+	return SpotLight(data0.xyz, data0.w, data1.xyz, data1.w, data2.xyz, data2.w, data3.xyz, data3.w, data4.xyz, data4.w);
+}
+
+// Screen tile of the fragment times exponential slice of its view depth
+int getCluster() {
+	float depth = max(dot(viewDepthPlane, vec4(FragPosition, 1.0)), 1e-4);
+	int slice = clamp(int(floor(log(depth) * clusterScale.z + clusterScale.w)), 0, clusterCount.z - 1);
+	ivec2 tile = clamp(ivec2(gl_FragCoord.xy * clusterScale.xy), ivec2(0), clusterCount.xy - 1);
+	return (slice * clusterCount.y + tile.y) * clusterCount.x + tile.x;
+}
+
 // TODO: Lots of optimization (ambient + ?)
 void main()
 {
@@ -155,16 +190,26 @@ void main()
 	vec3 result = vec3(0.0, 0.0, 0.0);
 
 	// DirectionalLight
-	result += computeDirectionalLight(directionalLight, fragNormal, viewDirection);
+	if (directionalLightCount > 0) {
+		result += computeDirectionalLight(directionalLight, fragNormal, viewDirection);
+	}
+
+	// Only the lights reaching the cluster of the fragment
+	uvec2 cluster = texelFetch(lightClusters, getCluster()).xy;
+	int lightIndex = int(cluster.x);
+	int pointCount = int(cluster.y & 0xFFFFu);
+	int spotCount = int(cluster.y >> 16);
 
 	// PointLights
-	for	(int i = 0; i < 10; ++i) {
-		result += computePointLight(pointLights[i], fragNormal, FragPosition, viewDirection);
+	for	(int i = 0; i < pointCount; ++i) {
+		int index = int(texelFetch(lightIndices, lightIndex++).r);
+		result += computePointLight(fetchPointLight(index), fragNormal, FragPosition, viewDirection);
 	}
 
 	// SpotLights
-	for	(int i = 0; i < 10; ++i) {
-		result += computeSpotLight(spotLights[i], fragNormal, FragPosition, viewDirection);
+	for	(int i = 0; i < spotCount; ++i) {
+		int index = int(texelFetch(lightIndices, lightIndex++).r);
+		result += computeSpotLight(fetchSpotLight(index), fragNormal, FragPosition, viewDirection);
 	}
 
 	FragColor = vec4(result, 1.0f);
@@ -1,7 +1,12 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
+#ifdef INSTANCED
+layout (location = 6) in mat4 aModel;		// per instance, locations 6 to 9
+#define model aModel
+#else
 uniform mat4 model;
+#endif
 uniform mat4 view;
 uniform mat4 projection;
 
@@ -1,4 +1,7 @@
 #version 330 core
+// Variants, see ShaderVariants, each feature is a #define inserted after #version:
+// - SPECULAR_MAP, EMISSION_MAP, NORMAL_MAP, HEIGHT_MAP: the material has the map, the missing ones aren't sampled
+// - DIRECTIONAL_LIGHT, POINT_LIGHTS, SPOT_LIGHTS: the light set has such lights, the code of the others is left out
 struct Material {
 	sampler2D diffuse;
 	sampler2D specular;
@@ -8,108 +11,148 @@ struct Material {
 	float shininess;
 };
 
+// std140, mirrored in light_block.h: the scalars fill the 4th component of the vec3 before them
 struct DirectionalLight {
 	vec3 direction;
-	
 	vec3 ambient;
 	vec3 diffuse;
 	vec3 specular;
 };
 
+// Read from lightData, 4 texels
 struct PointLight {
 	vec3 position;
-
 	float constant;
-	float linear;
-	float quadratic;
-
 	vec3 ambient;
+	float linear;
 	vec3 diffuse;
+	float quadratic;
 	vec3 specular;
 };
 
+// Read from lightData after the point lights, 5 texels
 struct SpotLight {
 	vec3 position;
-	vec3 direction;
-
 	float innerCutOff;
+	vec3 direction;
 	float outerCutOff;
-
+	vec3 ambient;
 	float constant;
+	vec3 diffuse;
 	float linear;
+	vec3 specular;
 	float quadratic;
+};
 
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
+// Shared by every lit program, see LightBlock and LightGrid
+layout (std140) uniform LightBlock {
+	int					directionalLightCount;
+	int					pointLightCount;
+	int					spotLightCount;
+	vec4				viewDepthPlane;
+	vec4				clusterScale;		// tiles per pixel in xy, slice scale and bias in zw
+	ivec4				clusterCount;
+	DirectionalLight	directionalLight;
 };
 
+uniform		samplerBuffer		lightData;
+uniform		usamplerBuffer		lightClusters;		// first light index, point light count | spot light count << 16
+uniform		usamplerBuffer		lightIndices;
+
 in vec2		TexCoord;
 in vec3		FragNormal;
 in vec3		FragPosition;
+#if defined(NORMAL_MAP) || defined(HEIGHT_MAP)
+in vec3		FragTangent;
+in vec3		FragBitangent;
+#endif
 
 out vec4	FragColor; 
 
 uniform		vec3				viewPosition;
 uniform		Material			material;
 
-uniform		DirectionalLight	directionalLight;
-uniform		PointLight			pointLights[10];	// TODO: pas besoin de spcifier de taille ?
-uniform		SpotLight			spotLights[10];		// TODO: pas besoin de spcifier de taille ?
+// Height map texels to normal tilt, for bump mapping
+const float HEIGHT_SCALE = 2.0;
 
-vec3 computeDirectionalLight(DirectionalLight light, vec3 fragNormal, vec3 viewDirection) {
-	vec3 lightDirection = normalize(-light.direction);
-	
-	// Ambient
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoord));
+// The material, sampled once per fragment
+struct Surface {
+	vec3 diffuse;
+	vec3 specular;
+	vec3 emission;
+	vec3 normal;
+};
 
-	// Diffuse
-	float diff = max(dot(fragNormal, lightDirection), 0.0);
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoord));
+vec3 getNormal() {
+	vec3 normal = normalize(FragNormal);
+#if defined(NORMAL_MAP)
+	// Tangent space normal map, takes precedence over a height map. BC5 keeps x and y only, z is rebuilt from them
+	vec3 mapped;
+	mapped.xy = texture(material.normal, TexCoord).rg * 2.0 - 1.0;
+	mapped.z = sqrt(max(0.0, 1.0 - dot(mapped.xy, mapped.xy)));
+	normal = normalize(normalize(FragTangent) * mapped.x + normalize(FragBitangent) * mapped.y + normal * mapped.z);
+#elif defined(HEIGHT_MAP)
+	// Bump mapping: the normal leans against the slope of the height map
+	vec2 texel = 1.0 / vec2(textureSize(material.height, 0));
+	float height = texture(material.height, TexCoord).r;
+	float slopeU = texture(material.height, TexCoord + vec2(texel.x, 0.0)).r - height;
+	float slopeV = texture(material.height, TexCoord + vec2(0.0, texel.y)).r - height;
+	normal = normalize(normal - HEIGHT_SCALE * (slopeU * normalize(FragTangent) + slopeV * normalize(FragBitangent)));
+#endif
+	return normal;
+}
+
+Surface getSurface() {
+	Surface surface;
+	surface.diffuse = vec3(texture(material.diffuse, TexCoord));
+#ifdef SPECULAR_MAP
+	surface.specular = vec3(texture(material.specular, TexCoord));
+#else
+	surface.specular = vec3(0.0);
+#endif
+#ifdef EMISSION_MAP
+	surface.emission = vec3(texture(material.emission, TexCoord));
+#else
+	surface.emission = vec3(0.0);
+#endif
+	surface.normal = getNormal();
+	return surface;
+}
 
-	// Specular
-	vec3 reflectDirection = reflect(-lightDirection, fragNormal);
+// Ambient + diffuse + specular + emission of a light coming from lightDirection, before attenuation
+vec3 shade(vec3 ambient, vec3 diffuse, vec3 specular, vec3 lightDirection, Surface surface, vec3 viewDirection) {
+	vec3 result = ambient * surface.diffuse;
+
+	float diff = max(dot(surface.normal, lightDirection), 0.0);
+	result += diffuse * diff * surface.diffuse;
+
+#ifdef SPECULAR_MAP
+	vec3 reflectDirection = reflect(-lightDirection, surface.normal);
 	float spec = pow(max(dot(viewDirection, reflectDirection), 0.0), material.shininess);
-	vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoord));
+	result += specular * spec * surface.specular;
+#endif
 
-	// Emission
-	vec3 emission = vec3(texture(material.emission, TexCoord));
+#ifdef EMISSION_MAP
+	result += surface.emission;
+#endif
+	return result;
+}
 
-	// 
-	return ambient + diffuse + specular + emission;
+vec3 computeDirectionalLight(DirectionalLight light, Surface surface, vec3 viewDirection) {
+	vec3 lightDirection = normalize(-light.direction);
+	return shade(light.ambient, light.diffuse, light.specular, lightDirection, surface, viewDirection);
 }
 
-vec3 computePointLight(PointLight light, vec3 fragNormal, vec3 fragPosition, vec3 viewDirection) {
+vec3 computePointLight(PointLight light, Surface surface, vec3 fragPosition, vec3 viewDirection) {
 	vec3 lightDirection = normalize(light.position - fragPosition);
 
 	float distance = length(light.position - fragPosition);
 	float attenuation = 1 / (1 + light.constant + (light.linear * distance) + (light.quadratic * distance * distance));
 
-	// Ambient
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoord));
-
-	// Diffuse
-	float diff = max(dot(fragNormal, lightDirection), 0.0);
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoord));
-
-	// Specular
-	vec3 reflectDirection = reflect(-lightDirection, fragNormal);
-	float spec = pow(max(dot(viewDirection, reflectDirection), 0.0), material.shininess);
-	vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoord));
-	
-	// Emission
-	vec3 emission = vec3(texture(material.emission, TexCoord));
-	
-	// Attenuate
-	ambient  *= attenuation;
-    diffuse  *= attenuation;
-    specular *= attenuation;
-    emission *= attenuation;
-
-	return ambient + diffuse + specular + emission;
+	return shade(light.ambient, light.diffuse, light.specular, lightDirection, surface, viewDirection) * attenuation;
 }
 
-vec3 computeSpotLight(SpotLight light, vec3 fragNormal, vec3 fragPosition, vec3 viewDirection) {
+vec3 computeSpotLight(SpotLight light, Surface surface, vec3 fragPosition, vec3 viewDirection) {
 	vec3 lightDirection = normalize(light.position - fragPosition);
 
 	float distance = length(light.position - fragPosition);
@@ -123,53 +166,86 @@ vec3 computeSpotLight(SpotLight light, vec3 fragNormal, vec3 fragPosition, vec3
 	// https://uploads.disquscdn.com/images/7e0feb070eb4b76a32179e2fa4ef26e40a340d9bb9c76d2449a8685d30fd7919.jpg
 	// https://uploads.disquscdn.com/images/c917ceac2c0ab5583a33b6767d4e7c859268214b689bacf5ce6e960e4c54dca4.jpg
 
-	// Ambient
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoord));
+	// comment the intensity out if there is no directional light to always have some light
+	return shade(light.ambient, light.diffuse, light.specular, lightDirection, surface, viewDirection) * attenuation * intensity;
+}
 
-	// Diffuse
-	float diff = max(dot(fragNormal, lightDirection), 0.0);
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoord));
 
-	// Specular
-	vec3 reflectDirection = reflect(-lightDirection, fragNormal);
-	float spec = pow(max(dot(viewDirection, reflectDirection), 0.0), material.shininess);
-	vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoord));
-	
-	// Emission
-	vec3 emission = vec3(texture(material.emission, TexCoord));
-	
-	// Attenuate
-	ambient  *= attenuation * intensity; // comment if there is no directional light to always have some light
-    diffuse  *= attenuation * intensity;
-    specular *= attenuation * intensity;
-    emission *= attenuation * intensity;
-
-	return ambient + diffuse + specular + emission;
+PointLight fetchPointLight(int index) {
+	int texel = index * 4;
+	vec4 data0 = texelFetch(lightData, texel);
+	vec4 data1 = texelFetch(lightData, texel + 1);
+	vec4 data2 = texelFetch(lightData, texel + 2);
+	vec4 data3 = texelFetch(lightData, texel + 3);
+	return PointLight(data0.xyz, data0.w, data1.xyz, data1.w, data2.xyz, data2.w, data3.xyz);
 }
 
+SpotLight fetchSpotLight(int index) {
+	int texel = pointLightCount * 4 + index * 5;
+	vec4 data0 = texelFetch(lightData, texel);
+	vec4 data1 = texelFetch(lightData, texel + 1);
+	vec4 data2 = texelFetch(lightData, texel + 2);
+	vec4 data3 = texelFetch(lightData, texel + 3);
+	vec4 data4 = texelFetch(lightData, texel + 4);
+	return SpotLight(data0.xyz, data0.w, data1.xyz, data1.w, data2.xyz, data2.w, data3.xyz, data3.w, data4.xyz, data4.w);
+}
 
-// TODO: Lots of optimization (ambient + ?)
-void main()
+// Screen tile of the fragment times exponential slice of its view depth
+int getCluster() {
+	float depth = max(dot(viewDepthPlane, vec4(FragPosition, 1.0)), 1e-4);
+	int slice = clamp(int(floor(log(depth) * clusterScale.z + clusterScale.w)), 0, clusterCount.z - 1);
+	ivec2 tile = clamp(ivec2(gl_FragCoord.xy * clusterScale.xy), ivec2(0), clusterCount.xy - 1);
+	return (slice * clusterCount.y + tile.y) * clusterCount.x + tile.x;
+}
+
+// Color maps are sampled through sRGB formats, the lighting adds up linear values: encoded back for the framebuffer
+vec3 linearToSrgb(vec3 color)
 {
-//	FragColor = texture(material.diffuse, TexCoord) + texture(material.specular, TexCoord);
+	color = max(color, vec3(0.0));
+	vec3 low = color * 12.92;
+	vec3 high = 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055;
+	return mix(high, low, vec3(lessThanEqual(color, vec3(0.0031308))));
+}
 
-	vec3 fragNormal = normalize(FragNormal);
+void main()
+{
+	Surface surface = getSurface();
 	vec3 viewDirection = normalize(viewPosition - FragPosition);
 	vec3 result = vec3(0.0, 0.0, 0.0);
 
-	// DirectionalLight
-	result += computeDirectionalLight(directionalLight, fragNormal, viewDirection);
+	// DirectionalLight, the count is still read: the variant may be a stand-in with more lights than the light set
+#ifdef DIRECTIONAL_LIGHT
+	if (directionalLightCount > 0) {
+		result += computeDirectionalLight(directionalLight, surface, viewDirection);
+	}
+#endif
+
+#if defined(POINT_LIGHTS) || defined(SPOT_LIGHTS)
+	// Only the lights reaching the cluster of the fragment
+	uvec2 cluster = texelFetch(lightClusters, getCluster()).xy;
+	int lightIndex = int(cluster.x);
+	int pointCount = int(cluster.y & 0xFFFFu);
+	int spotCount = int(cluster.y >> 16);
 
+#ifdef POINT_LIGHTS
 	// PointLights
-	for	(int i = 0; i < 10; ++i) {
-		result += computePointLight(pointLights[i], fragNormal, FragPosition, viewDirection);
+	for	(int i = 0; i < pointCount; ++i) {
+		int index = int(texelFetch(lightIndices, lightIndex++).r);
+		result += computePointLight(fetchPointLight(index), surface, FragPosition, viewDirection);
 	}
+#else
+	lightIndex += pointCount;
+#endif
 
+#ifdef SPOT_LIGHTS
 	// SpotLights
-	for	(int i = 0; i < 10; ++i) {
-		result += computeSpotLight(spotLights[i], fragNormal, FragPosition, viewDirection);
+	for	(int i = 0; i < spotCount; ++i) {
+		int index = int(texelFetch(lightIndices, lightIndex++).r);
+		result += computeSpotLight(fetchSpotLight(index), surface, FragPosition, viewDirection);
 	}
+#endif
+#endif
 
-	FragColor = vec4(result, 1.0f);
-//	FragColor = vec4((fragNormal + 1)/2, 1.0f);
+	FragColor = vec4(linearToSrgb(result), 1.0f);
+//	FragColor = vec4((surface.normal + 1)/2, 1.0f);
 }
\ No newline at end of file
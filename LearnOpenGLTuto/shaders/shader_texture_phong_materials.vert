@@ -3,12 +3,25 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aColor;
 layout (location = 2) in vec2 aTexCoord;
 layout (location = 3) in vec3 aNormal;
+#if defined(NORMAL_MAP) || defined(HEIGHT_MAP)
+layout (location = 4) in vec3 aTangent;
+layout (location = 5) in vec3 aBitangent;
+#endif
 
 out vec2 TexCoord;
 out vec3 FragNormal;
 out vec3 FragPosition;
+#if defined(NORMAL_MAP) || defined(HEIGHT_MAP)
+out vec3 FragTangent;
+out vec3 FragBitangent;
+#endif
 
+#ifdef INSTANCED
+layout (location = 6) in mat4 aModel;		// per instance, locations 6 to 9
+#define model aModel
+#else
 uniform mat4 model;
+#endif
 uniform mat4 view;
 uniform mat4 projection;
 
@@ -20,4 +33,9 @@ void main()
     //   OurColor = aColor;
    TexCoord = aTexCoord;
    FragNormal = mat3(transpose(inverse(model))) * aNormal;
+#if defined(NORMAL_MAP) || defined(HEIGHT_MAP)
+   // Tangents follow the surface, the model matrix is enough
+   FragTangent = mat3(model) * aTangent;
+   FragBitangent = mat3(model) * aBitangent;
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,54 @@
+#version 330 core
+// Same outputs as shader_texture_phong_materials.vert, for meshes uploaded in a compact VertexFormat
+layout (location = 0) in vec4 aPos;			// xyz in [-1, 1] of the mesh bounds, w = bitangent sign
+layout (location = 2) in vec2 aTexCoord;
+layout (location = 3) in vec2 aNormal;		// octahedral
+layout (location = 4) in vec2 aTangent;		// octahedral
+
+out vec2 TexCoord;
+out vec3 FragNormal;
+out vec3 FragPosition;
+#if defined(NORMAL_MAP) || defined(HEIGHT_MAP)
+out vec3 FragTangent;
+out vec3 FragBitangent;
+#endif
+
+#ifdef INSTANCED
+layout (location = 6) in mat4 aModel;		// per instance, locations 6 to 9
+#define model aModel
+#else
+uniform mat4 model;
+#endif
+uniform mat4 view;
+uniform mat4 projection;
+
+uniform vec3 positionCenter;
+uniform vec3 positionExtent;
+
+vec3 decodeOctahedral(vec2 encoded)
+{
+   vec3 direction = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+   if (direction.z < 0.0) {
+      direction.xy = (1.0 - abs(direction.yx)) * vec2(direction.x >= 0.0 ? 1.0 : -1.0, direction.y >= 0.0 ? 1.0 : -1.0);
+   }
+   return normalize(direction);
+}
+
+void main()
+{
+   vec3 position = positionCenter + positionExtent * aPos.xyz;
+
+   // So that FragPosition is in World Space
+   FragPosition = vec3(model * vec4(position, 1.0));
+   gl_Position = projection * view * vec4(FragPosition, 1.0);
+   TexCoord = aTexCoord;
+   vec3 normal = decodeOctahedral(aNormal);
+   FragNormal = mat3(transpose(inverse(model))) * normal;
+
+#if defined(NORMAL_MAP) || defined(HEIGHT_MAP)
+   // The bitangent is rebuilt in object space, then both follow the surface like in the float vertex shader
+   vec3 tangent = decodeOctahedral(aTangent);
+   FragTangent = mat3(model) * tangent;
+   FragBitangent = mat3(model) * (cross(normal, tangent) * aPos.w);
+#endif
+}
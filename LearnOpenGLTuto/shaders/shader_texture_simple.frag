@@ -5,7 +5,16 @@ in vec2 TexCoord;
 
 uniform sampler2D texture0;
 
+// The texture is an sRGB format, sampling decodes it: encoded again for the framebuffer
+vec3 linearToSrgb(vec3 color)
+{
+	vec3 low = color * 12.92;
+	vec3 high = 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055;
+	return mix(high, low, vec3(lessThanEqual(color, vec3(0.0031308))));
+}
+
 void main()
 {
-	FragColor = texture(texture0, TexCoord);
+	vec4 color = texture(texture0, TexCoord);
+	FragColor = vec4(linearToSrgb(color.rgb), color.a);
 }
\ No newline at end of file
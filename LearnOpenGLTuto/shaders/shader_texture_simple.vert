@@ -4,7 +4,12 @@ layout (location = 2) in vec2 aTexCoord;
 
 out vec2 TexCoord;
 
+#ifdef INSTANCED
+layout (location = 6) in mat4 aModel;		// per instance, locations 6 to 9
+#define model aModel
+#else
 uniform mat4 model;
+#endif
 uniform mat4 view;
 uniform mat4 projection;
 
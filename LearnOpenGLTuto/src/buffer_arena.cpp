@@ -0,0 +1,431 @@
+#include <buffer_arena.h>
+#include <gl_state.h>
+#include <mesh.h>
+
+#include <glad/glad.h>
+
+#include <algorithm>
+
+RangeAllocator::RangeAllocator(size_t capacity)
+	: capacity(capacity) {
+	if (capacity > 0) {
+		freeRanges[0] = capacity;
+	}
+}
+
+bool RangeAllocator::allocate(size_t size, size_t& offset) {
+	for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+		if (it->second < size) {
+			continue;
+		}
+		offset = it->first;
+		size_t remaining = it->second - size;
+		freeRanges.erase(it);
+		if (remaining > 0) {
+			freeRanges[offset + size] = remaining;
+		}
+		used += size;
+		return true;
+	}
+	return false;
+}
+
+void RangeAllocator::free(size_t offset, size_t size) {
+	used -= size;
+	auto next = freeRanges.lower_bound(offset);
+	if (next != freeRanges.end() && offset + size == next->first) {
+		size += next->second;
+		next = freeRanges.erase(next);
+	}
+	if (next != freeRanges.begin()) {
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == offset) {
+			previous->second += size;
+			return;
+		}
+	}
+	freeRanges[offset] = size;
+}
+
+size_t RangeAllocator::getLargestFreeRange() const {
+	size_t largest = 0;
+	for (const auto& range : freeRanges) {
+		largest = std::max(largest, range.second);
+	}
+	return largest;
+}
+
+ArenaAllocation::~ArenaAllocation() {
+	if (arena) {
+		arena->free(block);
+	}
+}
+
+ArenaAllocation::ArenaAllocation(ArenaAllocation&& other) noexcept
+	: arena(other.arena), block(other.block) {
+	other.arena = nullptr;
+}
+
+ArenaAllocation& ArenaAllocation::operator=(ArenaAllocation&& other) noexcept {
+	if (this != &other) {
+		if (arena) {
+			arena->free(block);
+		}
+		arena = other.arena;
+		block = other.block;
+		other.arena = nullptr;
+	}
+	return *this;
+}
+
+const ArenaBlock& ArenaAllocation::getBlock() const {
+	return arena->getBlock(block);
+}
+
+void BufferArena::Stats::merge(const Stats& other) {
+	pageCount += other.pageCount;
+	blockCount += other.blockCount;
+	vertexBytesUsed += other.vertexBytesUsed;
+	vertexBytesCapacity += other.vertexBytesCapacity;
+	indexBytesUsed += other.indexBytesUsed;
+	indexBytesCapacity += other.indexBytesCapacity;
+	compactionCount += other.compactionCount;
+}
+
+
+BufferArena::BufferArena(VertexFormat format)
+	: format(format), stride(getVertexSize(format)) {
+}
+
+BufferArena& BufferArena::getInstance(VertexFormat format) {
+	static BufferArena floatArena(VertexFormat::Float);
+	static BufferArena halfArena(VertexFormat::Half);
+	static BufferArena snorm16Arena(VertexFormat::Snorm16);
+	switch (format) {
+	case VertexFormat::Half:
+		return halfArena;
+	case VertexFormat::Snorm16:
+		return snorm16Arena;
+	default:
+		return floatArena;
+	}
+}
+
+void BufferArena::clearAll() {
+	for (VertexFormat format : { VertexFormat::Float, VertexFormat::Half, VertexFormat::Snorm16 }) {
+		getInstance(format).clear();
+	}
+}
+
+void BufferArena::defragmentAll(float holeFraction) {
+	for (VertexFormat format : { VertexFormat::Float, VertexFormat::Half, VertexFormat::Snorm16 }) {
+		BufferArena& arena = getInstance(format);
+		if (arena.needsDefragment(holeFraction)) {
+			arena.defragment();
+		}
+	}
+}
+
+BufferArena::Stats BufferArena::getTotalStats() {
+	Stats stats;
+	for (VertexFormat format : { VertexFormat::Float, VertexFormat::Half, VertexFormat::Snorm16 }) {
+		stats.merge(getInstance(format).getStats());
+	}
+	return stats;
+}
+
+ArenaAllocation BufferArena::allocate(const void* vertices, unsigned int vertexCount, const void* indices, size_t indexBytes) {
+	// Sizes are never 0 so that every block has its own offsets, index ranges stay 4 bytes aligned for either index type
+	size_t vertexRange = std::max(vertexCount, 1u);
+	size_t indexRange = std::max<size_t>((indexBytes + 3) & ~(size_t)3, 4);
+
+	size_t vertexOffset = 0;
+	size_t indexOffset = 0;
+	unsigned int page = (unsigned int)pages.size();
+	for (unsigned int i = 0; i < pages.size() && page == pages.size(); i++) {
+		Page& candidate = pages[i];
+		if (candidate.VAO == 0
+			|| candidate.vertices.getCapacity() - candidate.vertices.getUsed() < vertexRange
+			|| candidate.indices.getCapacity() - candidate.indices.getUsed() < indexRange) {
+			continue;
+		}
+		// Enough room overall: the page is compacted if that is what it takes
+		for (int attempt = 0; attempt < 2; attempt++) {
+			if (candidate.vertices.allocate(vertexRange, vertexOffset)) {
+				if (candidate.indices.allocate(indexRange, indexOffset)) {
+					page = i;
+					break;
+				}
+				candidate.vertices.free(vertexOffset, vertexRange);
+			}
+			if (attempt == 0) {
+				compact(i);
+			}
+		}
+	}
+	if (page == pages.size()) {
+		page = createPage(std::max(VERTEX_PAGE_SIZE / stride, vertexRange), std::max(INDEX_PAGE_SIZE, indexRange));
+		pages[page].vertices.allocate(vertexRange, vertexOffset);
+		pages[page].indices.allocate(indexRange, indexOffset);
+	}
+
+	// Through the copy targets so that whatever VAO is bound keeps its element buffer
+	Page& target = pages[page];
+	glBindBuffer(GL_COPY_WRITE_BUFFER, target.VBO);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, vertexOffset * stride, (size_t)vertexCount * stride, vertices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, target.EBO);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset, indexBytes, indices);
+	target.blockCount++;
+
+	ArenaBlock block;
+	block.page = page;
+	block.baseVertex = (unsigned int)vertexOffset;
+	block.vertexCount = (unsigned int)vertexRange;
+	block.indexOffset = indexOffset;
+	block.indexBytes = indexRange;
+
+	unsigned int blockIndex;
+	if (!freeBlocks.empty()) {
+		blockIndex = freeBlocks.back();
+		freeBlocks.pop_back();
+		blocks[blockIndex] = block;
+		liveBlocks[blockIndex] = true;
+	}
+	else {
+		blockIndex = (unsigned int)blocks.size();
+		blocks.push_back(block);
+		liveBlocks.push_back(true);
+	}
+	return ArenaAllocation(this, blockIndex);
+}
+
+void BufferArena::bind(unsigned int page) const {
+	GLState::getInstance().bindVertexArray(pages[page].VAO);
+}
+
+void BufferArena::unbind() {
+	GLState::getInstance().bindVertexArray(0);
+}
+
+void BufferArena::defragment() {
+	bool keptEmptyPage = false;
+	for (unsigned int i = 0; i < pages.size(); i++) {
+		if (pages[i].VAO == 0) {
+			continue;
+		}
+		if (pages[i].blockCount == 0) {
+			if (keptEmptyPage) {
+				deletePage(i);
+			}
+			keptEmptyPage = true;
+		}
+		else if (pages[i].fragmented) {
+			compact(i);
+		}
+	}
+}
+
+// Only the free space of fragmented pages counts, compacting is what gives it back as one range
+bool BufferArena::needsDefragment(float holeFraction) const {
+	size_t vertexHoles = 0;
+	size_t vertexCapacity = 0;
+	size_t indexHoles = 0;
+	size_t indexCapacity = 0;
+	unsigned int emptyPageCount = 0;
+	for (const auto& page : pages) {
+		if (page.VAO == 0) {
+			continue;
+		}
+		vertexCapacity += page.vertices.getCapacity();
+		indexCapacity += page.indices.getCapacity();
+		if (page.blockCount == 0) {
+			emptyPageCount++;
+		}
+		else if (page.fragmented) {
+			vertexHoles += page.vertices.getCapacity() - page.vertices.getUsed();
+			indexHoles += page.indices.getCapacity() - page.indices.getUsed();
+		}
+	}
+	return emptyPageCount > 1
+		|| vertexHoles > holeFraction * vertexCapacity
+		|| indexHoles > holeFraction * indexCapacity;
+}
+
+BufferArena::Stats BufferArena::getStats() const {
+	Stats stats;
+	for (const auto& page : pages) {
+		if (page.VAO == 0) {
+			continue;
+		}
+		stats.pageCount++;
+		stats.blockCount += page.blockCount;
+		stats.vertexBytesUsed += page.vertices.getUsed() * stride;
+		stats.vertexBytesCapacity += page.vertices.getCapacity() * stride;
+		stats.indexBytesUsed += page.indices.getUsed();
+		stats.indexBytesCapacity += page.indices.getCapacity();
+	}
+	stats.compactionCount = compactionCount;
+	return stats;
+}
+
+unsigned int BufferArena::createPage(size_t vertexCapacity, size_t indexCapacity) {
+	unsigned int index = (unsigned int)pages.size();
+	for (unsigned int i = 0; i < pages.size(); i++) {
+		if (pages[i].VAO == 0) {
+			index = i;
+			break;
+		}
+	}
+	if (index == pages.size()) {
+		pages.emplace_back();
+	}
+
+	Page& page = pages[index];
+	page.vertices = RangeAllocator(vertexCapacity);
+	page.indices = RangeAllocator(indexCapacity);
+	page.blockCount = 0;
+	page.fragmented = false;
+
+	glGenVertexArrays(1, &page.VAO);
+	glGenBuffers(1, &page.VBO);
+	glGenBuffers(1, &page.EBO);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, page.VBO);
+	glBufferData(GL_COPY_WRITE_BUFFER, vertexCapacity * stride, nullptr, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, page.EBO);
+	glBufferData(GL_COPY_WRITE_BUFFER, indexCapacity, nullptr, GL_STATIC_DRAW);
+	setupVertexArray(page);
+	return index;
+}
+
+void BufferArena::deletePage(unsigned int index) {
+	Page& page = pages[index];
+	GLState::getInstance().onDeleteVertexArray(page.VAO);
+	glDeleteVertexArrays(1, &page.VAO);
+	glDeleteBuffers(1, &page.VBO);
+	glDeleteBuffers(1, &page.EBO);
+	page = Page();
+}
+
+void BufferArena::setupVertexArray(const Page& page) const {
+	GLState::getInstance().bindVertexArray(page.VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, page.VBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, page.EBO);
+
+	if (format == VertexFormat::Float) {
+		// Position
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+
+		// Normal
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+
+		// TexCoords
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+
+		// Tangent and bitangent, for the normal and height map variants
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+		glEnableVertexAttribArray(5);
+		glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+	}
+	else {
+		// Position (xyz relative to the bounds) + bitangent sign (w)
+		glEnableVertexAttribArray(0);
+		if (format == VertexFormat::Half) {
+			glVertexAttribPointer(0, 4, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Position));
+		}
+		else {
+			glVertexAttribPointer(0, 4, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Position));
+		}
+
+		// Normal (octahedral)
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Normal));
+
+		// TexCoords
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, TexCoords));
+
+		// Tangent (octahedral), the bitangent is rebuilt in the shader
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Tangent));
+	}
+
+	GLState::getInstance().bindVertexArray(0);
+}
+
+// Copies the live blocks, in order, to the front of new buffers: GL forbids overlapping copies within a buffer
+void BufferArena::compact(unsigned int index) {
+	Page& page = pages[index];
+	std::vector<unsigned int> pageBlocks;
+	for (unsigned int i = 0; i < blocks.size(); i++) {
+		if (liveBlocks[i] && blocks[i].page == index) {
+			pageBlocks.push_back(i);
+		}
+	}
+
+	unsigned int buffers[2];
+	glGenBuffers(2, buffers);
+	RangeAllocator vertices(page.vertices.getCapacity());
+	RangeAllocator indices(page.indices.getCapacity());
+
+	std::sort(pageBlocks.begin(), pageBlocks.end(), [this](unsigned int a, unsigned int b) { return blocks[a].baseVertex < blocks[b].baseVertex; });
+	glBindBuffer(GL_COPY_READ_BUFFER, page.VBO);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[0]);
+	glBufferData(GL_COPY_WRITE_BUFFER, vertices.getCapacity() * stride, nullptr, GL_STATIC_DRAW);
+	for (unsigned int i : pageBlocks) {
+		ArenaBlock& block = blocks[i];
+		size_t offset;
+		vertices.allocate(block.vertexCount, offset);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (size_t)block.baseVertex * stride, offset * stride, (size_t)block.vertexCount * stride);
+		block.baseVertex = (unsigned int)offset;
+	}
+
+	std::sort(pageBlocks.begin(), pageBlocks.end(), [this](unsigned int a, unsigned int b) { return blocks[a].indexOffset < blocks[b].indexOffset; });
+	glBindBuffer(GL_COPY_READ_BUFFER, page.EBO);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[1]);
+	glBufferData(GL_COPY_WRITE_BUFFER, indices.getCapacity(), nullptr, GL_STATIC_DRAW);
+	for (unsigned int i : pageBlocks) {
+		ArenaBlock& block = blocks[i];
+		size_t offset;
+		indices.allocate(block.indexBytes, offset);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, block.indexOffset, offset, block.indexBytes);
+		block.indexOffset = offset;
+	}
+
+	glDeleteBuffers(1, &page.VBO);
+	glDeleteBuffers(1, &page.EBO);
+	page.VBO = buffers[0];
+	page.EBO = buffers[1];
+	page.vertices = std::move(vertices);
+	page.indices = std::move(indices);
+	page.fragmented = false;
+	setupVertexArray(page);
+	compactionCount++;
+}
+
+void BufferArena::free(unsigned int index) {
+	const ArenaBlock& block = blocks[index];
+	Page& page = pages[block.page];
+	page.vertices.free(block.baseVertex, block.vertexCount);
+	page.indices.free(block.indexOffset, block.indexBytes);
+	page.blockCount--;
+	page.fragmented = page.vertices.getFreeRangeCount() > 1 || page.indices.getFreeRangeCount() > 1;
+
+	liveBlocks[index] = false;
+	freeBlocks.push_back(index);
+}
+
+void BufferArena::clear() {
+	for (unsigned int i = 0; i < pages.size(); i++) {
+		if (pages[i].VAO != 0) {
+			deletePage(i);
+		}
+	}
+	pages.clear();
+	blocks.clear();
+	liveBlocks.clear();
+	freeBlocks.clear();
+}
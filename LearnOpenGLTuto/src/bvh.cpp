@@ -0,0 +1,244 @@
+#include <bvh.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <numeric>
+
+namespace {
+	BoundingBox getEmptyBox() {
+		float infinity = std::numeric_limits<float>::infinity();
+		return { glm::vec3(infinity), glm::vec3(-infinity) };
+	}
+
+	void grow(BoundingBox& box, const BoundingBox& other) {
+		box.min = glm::min(box.min, other.min);
+		box.max = glm::max(box.max, other.max);
+	}
+
+	float getSurfaceArea(const BoundingBox& box) {
+		glm::vec3 size = box.max - box.min;
+		return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+
+	double getElapsedMs(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+void Bvh::build(const std::vector<BoundingBox>& boxes) {
+	auto start = std::chrono::steady_clock::now();
+	objectBoxes = boxes;
+	uint32_t count = static_cast<uint32_t>(boxes.size());
+	objectOrder.resize(count);
+	std::iota(objectOrder.begin(), objectOrder.end(), 0u);
+	objectLeaves.assign(count, 0);
+	nodes.clear();
+	dirtyNodes.clear();
+	stats = Stats();
+	stats.objectCount = count;
+	if (count == 0) {
+		nodeDirty.clear();
+		stats.buildMs = getElapsedMs(start);
+		return;
+	}
+
+	std::vector<glm::vec3> centroids(count);
+	for (uint32_t i = 0; i < count; i++) {
+		centroids[i] = boxes[i].getCenter();
+	}
+
+	nodes.reserve(2 * (count / MAX_LEAF_OBJECTS + 1));
+	Node root;
+	root.objectCount = count;
+	nodes.push_back(root);
+	// Node and its depth
+	std::vector<std::pair<uint32_t, unsigned int>> pending = { { 0, 1 } };
+	while (!pending.empty()) {
+		auto [index, depth] = pending.back();
+		pending.pop_back();
+		stats.depth = std::max(stats.depth, depth);
+		nodes[index].box = getLeafBox(nodes[index]);
+		if (nodes[index].objectCount <= MAX_LEAF_OBJECTS) {
+			for (uint32_t i = 0; i < nodes[index].objectCount; i++) {
+				objectLeaves[objectOrder[nodes[index].firstObject + i]] = index;
+			}
+			continue;
+		}
+
+		uint32_t leftCount = split(nodes[index], centroids);
+		Node left;
+		left.firstObject = nodes[index].firstObject;
+		left.objectCount = leftCount;
+		left.parent = index;
+		Node right;
+		right.firstObject = left.firstObject + leftCount;
+		right.objectCount = nodes[index].objectCount - leftCount;
+		right.parent = index;
+		uint32_t leftIndex = static_cast<uint32_t>(nodes.size());
+		nodes[index].left = leftIndex;
+		nodes.push_back(left);
+		nodes.push_back(right);
+		pending.push_back({ leftIndex, depth + 1 });
+		pending.push_back({ leftIndex + 1, depth + 1 });
+	}
+	nodeDirty.assign(nodes.size(), 0);
+	stats.nodeCount = static_cast<unsigned int>(nodes.size());
+	stats.buildMs = getElapsedMs(start);
+}
+
+// Binned SAH over the centroids on each axis: the split minimizing area * objects of both sides, the cost of
+// traversing a node being proportional to the chance a random query hits its box. Partitions the range of the node
+// in objectOrder and returns how many objects went left
+uint32_t Bvh::split(const Node& node, const std::vector<glm::vec3>& centroids) {
+	auto first = objectOrder.begin() + node.firstObject;
+	auto last = first + node.objectCount;
+
+	glm::vec3 centroidMin(std::numeric_limits<float>::infinity());
+	glm::vec3 centroidMax(-std::numeric_limits<float>::infinity());
+	for (auto it = first; it != last; ++it) {
+		centroidMin = glm::min(centroidMin, centroids[*it]);
+		centroidMax = glm::max(centroidMax, centroids[*it]);
+	}
+	glm::vec3 centroidSize = centroidMax - centroidMin;
+	glm::vec3 binScale = float(BIN_COUNT) / glm::max(centroidSize, glm::vec3(std::numeric_limits<float>::min()));
+
+	auto getBin = [&](const glm::vec3& centroid, int axis) {
+		unsigned int bin = static_cast<unsigned int>((centroid[axis] - centroidMin[axis]) * binScale[axis]);
+		return std::min(bin, BIN_COUNT - 1);
+	};
+
+	float bestCost = std::numeric_limits<float>::infinity();
+	int bestAxis = -1;
+	unsigned int bestBin = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		if (centroidSize[axis] <= 0.0f) {
+			continue;
+		}
+		BoundingBox binBoxes[BIN_COUNT];
+		uint32_t binCounts[BIN_COUNT] = {};
+		for (auto& box : binBoxes) {
+			box = getEmptyBox();
+		}
+		for (auto it = first; it != last; ++it) {
+			unsigned int bin = getBin(centroids[*it], axis);
+			grow(binBoxes[bin], objectBoxes[*it]);
+			binCounts[bin]++;
+		}
+
+		// Right side costs swept from the end, the left ones on the way back
+		float rightCosts[BIN_COUNT] = {};
+		BoundingBox rightBox = getEmptyBox();
+		uint32_t rightCount = 0;
+		for (unsigned int bin = BIN_COUNT - 1; bin > 0; bin--) {
+			grow(rightBox, binBoxes[bin]);
+			rightCount += binCounts[bin];
+			rightCosts[bin - 1] = rightCount ? rightCount * getSurfaceArea(rightBox) : -1.0f;
+		}
+		BoundingBox leftBox = getEmptyBox();
+		uint32_t leftCount = 0;
+		for (unsigned int bin = 0; bin < BIN_COUNT - 1; bin++) {
+			grow(leftBox, binBoxes[bin]);
+			leftCount += binCounts[bin];
+			if (leftCount == 0 || rightCosts[bin] < 0.0f) {
+				continue;
+			}
+			float cost = leftCount * getSurfaceArea(leftBox) + rightCosts[bin];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = bin;
+			}
+		}
+	}
+
+	if (bestAxis >= 0) {
+		auto middle = std::partition(first, last, [&](uint32_t object) { return getBin(centroids[object], bestAxis) <= bestBin; });
+		return static_cast<uint32_t>(middle - first);
+	}
+	// Every centroid at the same place, halves still keep the leaves small
+	return node.objectCount / 2;
+}
+
+BoundingBox Bvh::getLeafBox(const Node& node) const {
+	BoundingBox box = getEmptyBox();
+	for (uint32_t i = 0; i < node.objectCount; i++) {
+		grow(box, objectBoxes[objectOrder[node.firstObject + i]]);
+	}
+	return box;
+}
+
+void Bvh::update(uint32_t object, const BoundingBox& box) {
+	objectBoxes[object] = box;
+	uint32_t leaf = objectLeaves[object];
+	if (!nodes.empty() && !nodeDirty[leaf]) {
+		nodeDirty[leaf] = 1;
+		dirtyNodes.push_back(leaf);
+	}
+}
+
+// The dirty leaves and every ancestor, children before parents: nodes come before their children so decreasing
+// indices work
+void Bvh::refit() {
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < dirtyNodes.size(); i++) {
+		uint32_t index = dirtyNodes[i];
+		if (index != 0 && !nodeDirty[nodes[index].parent]) {
+			nodeDirty[nodes[index].parent] = 1;
+			dirtyNodes.push_back(nodes[index].parent);
+		}
+	}
+	std::sort(dirtyNodes.begin(), dirtyNodes.end(), std::greater<uint32_t>());
+	for (uint32_t index : dirtyNodes) {
+		Node& node = nodes[index];
+		if (node.left == 0) {
+			node.box = getLeafBox(node);
+		}
+		else {
+			node.box = nodes[node.left].box;
+			grow(node.box, nodes[node.left + 1].box);
+		}
+		nodeDirty[index] = 0;
+	}
+	stats.refitNodeCount = static_cast<unsigned int>(dirtyNodes.size());
+	stats.refitMs = getElapsedMs(start);
+	dirtyNodes.clear();
+}
+
+void Bvh::query(const Frustum& frustum, std::vector<uint32_t>& visible) {
+	auto start = std::chrono::steady_clock::now();
+	visible.clear();
+	stats.visitedNodeCount = 0;
+	stats.acceptedNodeCount = 0;
+	stats.rejectedNodeCount = 0;
+	if (!nodes.empty()) {
+		traversal.assign(1, 0);
+	}
+	while (!traversal.empty()) {
+		const Node& node = nodes[traversal.back()];
+		traversal.pop_back();
+		stats.visitedNodeCount++;
+		Frustum::Containment containment = frustum.classify(node.box);
+		if (containment == Frustum::OUTSIDE) {
+			stats.rejectedNodeCount++;
+		}
+		else if (containment == Frustum::INSIDE) {
+			stats.acceptedNodeCount++;
+			visible.insert(visible.end(), objectOrder.begin() + node.firstObject, objectOrder.begin() + node.firstObject + node.objectCount);
+		}
+		else if (node.left == 0) {
+			for (uint32_t i = 0; i < node.objectCount; i++) {
+				uint32_t object = objectOrder[node.firstObject + i];
+				if (frustum.intersects(objectBoxes[object])) {
+					visible.push_back(object);
+				}
+			}
+		}
+		else {
+			traversal.push_back(node.left);
+			traversal.push_back(node.left + 1);
+		}
+	}
+	stats.visibleObjectCount = static_cast<unsigned int>(visible.size());
+	stats.queryMs = getElapsedMs(start);
+}
@@ -0,0 +1,82 @@
+#include <frustum.h>
+
+BoundingBox BoundingBox::transform(const glm::mat4& matrix) const {
+	glm::vec3 center = glm::vec3(matrix * glm::vec4(getCenter(), 1.0f));
+	glm::vec3 extent = getExtent();
+	glm::vec3 transformedExtent(0.0f);
+	for (int column = 0; column < 3; column++) {
+		transformedExtent += glm::abs(glm::vec3(matrix[column])) * extent[column];
+	}
+	return { center - transformedExtent, center + transformedExtent };
+}
+
+Frustum::Frustum(const glm::mat4& clip) {
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++) {
+		rows[i] = glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+	}
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	planes[4] = rows[3] + rows[2];
+	planes[5] = rows[3] - rows[2];
+	for (auto& plane : planes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+}
+
+bool Frustum::intersects(const BoundingSphere& sphere) const {
+	for (const auto& plane : planes) {
+		if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Center and extent against each plane: the extent projected on the normal is how far the box reaches towards it
+bool Frustum::intersects(const BoundingBox& box) const {
+	glm::vec3 center = box.getCenter();
+	glm::vec3 extent = box.getExtent();
+	for (const auto& plane : planes) {
+		glm::vec3 normal(plane);
+		if (glm::dot(normal, center) + plane.w < -glm::dot(glm::abs(normal), extent)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+Frustum::Containment Frustum::classify(const BoundingBox& box) const {
+	glm::vec3 center = box.getCenter();
+	glm::vec3 extent = box.getExtent();
+	Containment containment = INSIDE;
+	for (const auto& plane : planes) {
+		glm::vec3 normal(plane);
+		float distance = glm::dot(normal, center) + plane.w;
+		float reach = glm::dot(glm::abs(normal), extent);
+		if (distance < -reach) {
+			return OUTSIDE;
+		}
+		if (distance < reach) {
+			containment = INTERSECTS;
+		}
+	}
+	return containment;
+}
+
+bool FrustumCulling::isVisible(const BoundingBox& objectBox, const glm::mat4& model) {
+	return isVisible(objectBox.transform(model));
+}
+
+bool FrustumCulling::isVisible(const BoundingBox& worldBox) {
+	bool visible = !enabled || frustum.intersects(worldBox);
+	if (visible) {
+		visibleCount++;
+	}
+	else {
+		culledCount++;
+	}
+	return visible;
+}
@@ -0,0 +1,155 @@
+#include <gl_state.h>
+
+#include <glad/glad.h>
+
+unsigned int GLState::Stats::getIssued() const {
+	unsigned int total = 0;
+	for (unsigned int count : issued) {
+		total += count;
+	}
+	return total;
+}
+
+unsigned int GLState::Stats::getFiltered() const {
+	unsigned int total = 0;
+	for (unsigned int count : filtered) {
+		total += count;
+	}
+	return total;
+}
+
+GLState& GLState::getInstance() {
+	static GLState instance;
+	return instance;
+}
+
+const char* GLState::getCallName(Call call) {
+	static const char* names[CALL_COUNT] = { "program", "vertex array", "active texture", "texture", "viewport", "depth func", "line width" };
+	return names[call];
+}
+
+GLState::GLState() {
+	invalidate();
+}
+
+bool GLState::count(Call call, bool issued) {
+	if (issued) {
+		stats.issued[call]++;
+	}
+	else {
+		stats.filtered[call]++;
+	}
+	return issued;
+}
+
+bool GLState::useProgram(unsigned int program) {
+	if (program == this->program) {
+		return count(PROGRAM, false);
+	}
+	glUseProgram(program);
+	this->program = program;
+	return count(PROGRAM, true);
+}
+
+bool GLState::bindVertexArray(unsigned int vertexArray) {
+	if (vertexArray == this->vertexArray) {
+		return count(VERTEX_ARRAY, false);
+	}
+	glBindVertexArray(vertexArray);
+	this->vertexArray = vertexArray;
+	return count(VERTEX_ARRAY, true);
+}
+
+bool GLState::activeTexture(unsigned int unit) {
+	if (unit == activeUnit) {
+		return count(ACTIVE_TEXTURE, false);
+	}
+	glActiveTexture(GL_TEXTURE0 + unit);
+	activeUnit = unit;
+	return count(ACTIVE_TEXTURE, true);
+}
+
+bool GLState::bindTexture(unsigned int target, unsigned int texture) {
+	int shadowTarget = target == GL_TEXTURE_2D ? TARGET_2D : target == GL_TEXTURE_BUFFER ? TARGET_BUFFER : -1;
+	unsigned int* shadow = activeUnit < TEXTURE_UNITS && shadowTarget >= 0 ? &textures[activeUnit][shadowTarget] : nullptr;
+	if (shadow && *shadow == texture) {
+		return count(TEXTURE, false);
+	}
+	glBindTexture(target, texture);
+	if (shadow) {
+		*shadow = texture;
+	}
+	return count(TEXTURE, true);
+}
+
+bool GLState::bindTexture(unsigned int unit, unsigned int target, unsigned int texture) {
+	activeTexture(unit);
+	return bindTexture(target, texture);
+}
+
+bool GLState::viewport(int x, int y, int width, int height) {
+	if (viewportKnown && viewportBox[0] == x && viewportBox[1] == y && viewportBox[2] == width && viewportBox[3] == height) {
+		return count(VIEWPORT, false);
+	}
+	glViewport(x, y, width, height);
+	viewportBox[0] = x;
+	viewportBox[1] = y;
+	viewportBox[2] = width;
+	viewportBox[3] = height;
+	viewportKnown = true;
+	return count(VIEWPORT, true);
+}
+
+bool GLState::depthFunc(unsigned int func) {
+	if (func == depthFuncValue) {
+		return count(DEPTH_FUNC, false);
+	}
+	glDepthFunc(func);
+	depthFuncValue = func;
+	return count(DEPTH_FUNC, true);
+}
+
+bool GLState::lineWidth(float width) {
+	if (width == lineWidthValue) {
+		return count(LINE_WIDTH, false);
+	}
+	glLineWidth(width);
+	lineWidthValue = width;
+	return count(LINE_WIDTH, true);
+}
+
+void GLState::onDeleteTexture(unsigned int texture) {
+	for (auto& unit : textures) {
+		for (auto& bound : unit) {
+			if (bound == texture) {
+				bound = 0;
+			}
+		}
+	}
+}
+
+void GLState::onDeleteVertexArray(unsigned int vertexArray) {
+	if (this->vertexArray == vertexArray) {
+		this->vertexArray = 0;
+	}
+}
+
+void GLState::invalidate() {
+	program = UNKNOWN;
+	vertexArray = UNKNOWN;
+	activeUnit = UNKNOWN;
+	for (auto& unit : textures) {
+		for (auto& bound : unit) {
+			bound = UNKNOWN;
+		}
+	}
+	viewportKnown = false;
+	depthFuncValue = UNKNOWN;
+	lineWidthValue = -1.0f;
+}
+
+GLState::Stats GLState::takeStats() {
+	Stats taken = stats;
+	stats = Stats();
+	return taken;
+}
@@ -0,0 +1,189 @@
+#include <light_block.h>
+#include <gl_state.h>
+#include <thread_pool.h>
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+static_assert(sizeof(std140::DirectionalLight) == 64, "std140 DirectionalLight layout");
+static_assert(sizeof(std140::PointLight) == 4 * sizeof(glm::vec4), "std140 PointLight layout");
+static_assert(sizeof(std140::SpotLight) == 5 * sizeof(glm::vec4), "std140 SpotLight layout");
+static_assert(offsetof(LightBlock::Data, viewDepthPlane) == 16, "std140 LightBlock layout");
+static_assert(offsetof(LightBlock::Data, directionalLight) == 64, "std140 LightBlock layout");
+static_assert(sizeof(LightGrid::Cluster) == 8, "RG32UI texels");
+
+namespace {
+	float getIntensity(const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular) {
+		glm::vec3 sum = ambient + diffuse + specular;
+		return std::max(std::max(sum.r, sum.g), sum.b);
+	}
+
+	// Smallest sphere around the part of the cone within range, the apex and rim for narrow cones
+	LightSphere getSpotLightSphere(const SpotLight& spotLight, float range) {
+		float length = glm::length(spotLight.Direction);
+		if (range == FLT_MAX || length == 0.0f) {
+			return { spotLight.Position, range };
+		}
+		glm::vec3 direction = spotLight.Direction / length;
+		float cosAngle = glm::clamp(std::min(spotLight.InnerCutOff, spotLight.OuterCutOff), 0.0f, 1.0f);
+		if (cosAngle < 0.70710678f) {
+			float sinAngle = std::sqrt(1.0f - cosAngle * cosAngle);
+			return { spotLight.Position + direction * range * cosAngle, range * sinAngle };
+		}
+		float radius = range / (2.0f * cosAngle);
+		return { spotLight.Position + direction * radius, radius };
+	}
+
+	void createBufferTexture(unsigned int& buffer, unsigned int& texture, GLenum format, unsigned int unit) {
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+
+		glGenTextures(1, &texture);
+		GLState::getInstance().bindTexture(unit, GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+	}
+
+	// Orphans the previous storage, the buffer textures keep pointing at the buffer
+	void uploadBuffer(unsigned int buffer, const void* data, size_t size) {
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, std::max(size, (size_t)16), nullptr, GL_STREAM_DRAW);
+		if (size > 0) {
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+		}
+	}
+}
+
+LightBlock& LightBlock::getInstance() {
+	static LightBlock instance;
+	return instance;
+}
+
+bool LightBlock::bindProgram(Shader& shader) {
+	if (!shader.bindUniformBlock("LightBlock", BINDING)) {
+		return false;
+	}
+	shader.use();
+	shader.set(shader.getUniform<int>("lightData"), (int)LIGHT_DATA_UNIT);
+	shader.set(shader.getUniform<int>("lightClusters"), (int)CLUSTERS_UNIT);
+	shader.set(shader.getUniform<int>("lightIndices"), (int)LIGHT_INDICES_UNIT);
+	return true;
+}
+
+void LightBlock::createBuffers() {
+	glGenBuffers(1, &UBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(Data), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	// The binding point and the texture units are only ever used by these, binding them once is enough
+	glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, UBO);
+
+	createBufferTexture(lightDataBuffer, lightDataTexture, GL_RGBA32F, LIGHT_DATA_UNIT);
+	createBufferTexture(clustersBuffer, clustersTexture, GL_RG32UI, CLUSTERS_UNIT);
+	createBufferTexture(lightIndicesBuffer, lightIndicesTexture, GL_R16UI, LIGHT_INDICES_UNIT);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	GLState::getInstance().activeTexture(0);
+
+	int maxTextureBufferSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTextureBufferSize);
+	maxTexels = (size_t)maxTextureBufferSize;
+}
+
+void LightBlock::update(const DirectionalLight& directionalLight, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights,
+	const glm::mat4& view, const glm::mat4& projection, float nearDepth, float farDepth, int framebufferWidth, int framebufferHeight) {
+	if (UBO == 0) {
+		createBuffers();
+	}
+
+	data.directionalLightCount = directionalLight.Enabled ? 1 : 0;
+	data.directionalLight.direction = directionalLight.Direction;
+	data.directionalLight.ambient = directionalLight.Ambient;
+	data.directionalLight.diffuse = directionalLight.Diffuse;
+	data.directionalLight.specular = directionalLight.Specular;
+
+	// Enabled lights only, packed for the light data and bounded in view space for the grid
+	pointSpheres.clear();
+	spotSpheres.clear();
+	lightData.clear();
+	for (const auto& pointLight : pointLights) {
+		if (!pointLight.Enabled || pointSpheres.size() == LightGrid::MAX_LIGHTS) {
+			continue;
+		}
+		std140::PointLight light;
+		light.position = pointLight.Position;
+		light.constant = pointLight.Constant;
+		light.linear = pointLight.Linear;
+		light.quadratic = pointLight.Quadratic;
+		light.ambient = pointLight.Ambient;
+		light.diffuse = pointLight.Diffuse;
+		light.specular = pointLight.Specular;
+		light.padding = 0.0f;
+		lightData.resize(lightData.size() + 4);
+		std::memcpy(&lightData[lightData.size() - 4], &light, sizeof(light));
+
+		float range = getAttenuationRange(pointLight.Constant, pointLight.Linear, pointLight.Quadratic, getIntensity(pointLight.Ambient, pointLight.Diffuse, pointLight.Specular));
+		pointSpheres.push_back({ glm::vec3(view * glm::vec4(pointLight.Position, 1.0f)), range });
+	}
+	for (const auto& spotLight : spotLights) {
+		if (!spotLight.Enabled || spotSpheres.size() == LightGrid::MAX_LIGHTS) {
+			continue;
+		}
+		std140::SpotLight light;
+		light.position = spotLight.Position;
+		light.direction = spotLight.Direction;
+		light.innerCutOff = spotLight.InnerCutOff;
+		light.outerCutOff = spotLight.OuterCutOff;
+		light.constant = spotLight.Constant;
+		light.linear = spotLight.Linear;
+		light.quadratic = spotLight.Quadratic;
+		light.ambient = spotLight.Ambient;
+		light.diffuse = spotLight.Diffuse;
+		light.specular = spotLight.Specular;
+		lightData.resize(lightData.size() + 5);
+		std::memcpy(&lightData[lightData.size() - 5], &light, sizeof(light));
+
+		float range = getAttenuationRange(spotLight.Constant, spotLight.Linear, spotLight.Quadratic, getIntensity(spotLight.Ambient, spotLight.Diffuse, spotLight.Specular));
+		LightSphere sphere = getSpotLightSphere(spotLight, range);
+		sphere.center = glm::vec3(view * glm::vec4(sphere.center, 1.0f));
+		spotSpheres.push_back(sphere);
+	}
+	data.pointLightCount = (int)pointSpheres.size();
+	data.spotLightCount = (int)spotSpheres.size();
+
+	grid.setup(projection, nearDepth, farDepth);
+	grid.build(pointSpheres, spotSpheres, &ThreadPool::getInstance(), maxTexels);
+
+	data.viewDepthPlane = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+	data.clusterScale = glm::vec4((float)LightGrid::TILE_COUNT_X / std::max(framebufferWidth, 1), (float)LightGrid::TILE_COUNT_Y / std::max(framebufferHeight, 1),
+		grid.getSliceScale(), grid.getSliceBias());
+	data.clusterCount = glm::ivec4(LightGrid::TILE_COUNT_X, LightGrid::TILE_COUNT_Y, LightGrid::SLICE_COUNT, 0);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Data), &data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	uploadBuffer(lightDataBuffer, lightData.data(), lightData.size() * sizeof(glm::vec4));
+	uploadBuffer(clustersBuffer, grid.getClusters().data(), grid.getClusters().size() * sizeof(LightGrid::Cluster));
+	uploadBuffer(lightIndicesBuffer, grid.getLightIndices().data(), grid.getLightIndices().size() * sizeof(uint16_t));
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightBlock::clear() {
+	if (UBO == 0) {
+		return;
+	}
+	glDeleteBuffers(1, &UBO);
+	glDeleteBuffers(1, &lightDataBuffer);
+	glDeleteBuffers(1, &clustersBuffer);
+	glDeleteBuffers(1, &lightIndicesBuffer);
+	for (unsigned int texture : { lightDataTexture, clustersTexture, lightIndicesTexture }) {
+		GLState::getInstance().onDeleteTexture(texture);
+		glDeleteTextures(1, &texture);
+	}
+	UBO = 0;
+}
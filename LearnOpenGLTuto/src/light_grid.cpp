@@ -0,0 +1,265 @@
+#include <light_grid.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIGHT_GRID_SSE2
+#include <emmintrin.h>
+#endif
+
+float getAttenuationRange(float constant, float linear, float quadratic, float intensity) {
+	// Solves quadratic * d^2 + linear * d + 1 + constant = 256 * intensity
+	float c = 1.0f + constant - 256.0f * intensity;
+	if (c >= 0.0f) {
+		return 0.0f;
+	}
+	if (quadratic > 0.0f) {
+		return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * c)) / (2.0f * quadratic);
+	}
+	if (linear > 0.0f) {
+		return -c / linear;
+	}
+	return FLT_MAX;
+}
+
+void LightGrid::setup(const glm::mat4& projection, float nearDepth, float farDepth) {
+	this->nearDepth = nearDepth;
+	this->farDepth = farDepth;
+	float logRatio = std::log(farDepth / nearDepth);
+	sliceScale = SLICE_COUNT / logRatio;
+	sliceBias = -(float)SLICE_COUNT * std::log(nearDepth) / logRatio;
+	for (unsigned int slice = 0; slice <= SLICE_COUNT; slice++) {
+		sliceDepths[slice] = nearDepth * std::pow(farDepth / nearDepth, (float)slice / SLICE_COUNT);
+	}
+
+	// Where the ray through an NDC point crosses the plane at a depth, holds for any mix of perspective and ortho
+	glm::mat4 inverseProjection = glm::inverse(projection);
+	auto viewAt = [&inverseProjection](float ndcX, float ndcY, float depth) {
+		glm::vec4 nearPoint = inverseProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+		glm::vec4 farPoint = inverseProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+		nearPoint /= nearPoint.w;
+		farPoint /= farPoint.w;
+		float t = (-depth - nearPoint.z) / (farPoint.z - nearPoint.z);
+		return glm::vec2(glm::mix(nearPoint.x, farPoint.x, t), glm::mix(nearPoint.y, farPoint.y, t));
+	};
+
+	for (unsigned int slice = 0; slice < SLICE_COUNT; slice++) {
+		float depths[2] = { sliceDepths[slice], sliceDepths[slice + 1] };
+		for (unsigned int x = 0; x < TILE_ROW_SIZE; x++) {
+			tileMinX[slice][x] = FLT_MAX;
+			tileMaxX[slice][x] = -FLT_MAX;
+			if (x >= TILE_COUNT_X) {
+				continue;
+			}
+			for (unsigned int side = 0; side < 2; side++) {
+				float ndcX = -1.0f + 2.0f * (x + side) / TILE_COUNT_X;
+				for (float depth : depths) {
+					float viewX = viewAt(ndcX, 0.0f, depth).x;
+					tileMinX[slice][x] = std::min(tileMinX[slice][x], viewX);
+					tileMaxX[slice][x] = std::max(tileMaxX[slice][x], viewX);
+				}
+			}
+		}
+		for (unsigned int y = 0; y < TILE_COUNT_Y; y++) {
+			tileMinY[slice][y] = FLT_MAX;
+			tileMaxY[slice][y] = -FLT_MAX;
+			for (unsigned int side = 0; side < 2; side++) {
+				float ndcY = -1.0f + 2.0f * (y + side) / TILE_COUNT_Y;
+				for (float depth : depths) {
+					float viewY = viewAt(0.0f, ndcY, depth).y;
+					tileMinY[slice][y] = std::min(tileMinY[slice][y], viewY);
+					tileMaxY[slice][y] = std::max(tileMaxY[slice][y], viewY);
+				}
+			}
+		}
+	}
+}
+
+unsigned int LightGrid::getSlice(float depth) const {
+	float slice = std::floor(std::log(std::max(depth, nearDepth)) * sliceScale + sliceBias);
+	return (unsigned int)std::min(std::max(slice, 0.0f), (float)(SLICE_COUNT - 1));
+}
+
+void LightGrid::computeRanges(const std::vector<LightSphere>& lights, std::vector<LightRange>& ranges) const {
+	ranges.resize(std::min(lights.size(), (size_t)MAX_LIGHTS));
+	for (size_t i = 0; i < ranges.size(); i++) {
+		const LightSphere& light = lights[i];
+		float depth = -light.center.z;
+		if (!(light.radius > 0.0f) || depth + light.radius < nearDepth || depth - light.radius > farDepth) {
+			ranges[i] = { 1, 0 };
+			continue;
+		}
+		ranges[i] = { getSlice(depth - light.radius), getSlice(std::min(depth + light.radius, farDepth)) };
+	}
+}
+
+void LightGrid::cullLights(unsigned int slice, const std::vector<LightSphere>& lights, const std::vector<LightRange>& ranges, std::vector<std::vector<uint16_t>>& lists) const {
+	const float* minX = tileMinX[slice];
+	const float* maxX = tileMaxX[slice];
+	const float* minY = tileMinY[slice];
+	const float* maxY = tileMaxY[slice];
+
+	for (size_t i = 0; i < ranges.size(); i++) {
+		if (slice < ranges[i].firstSlice || slice > ranges[i].lastSlice) {
+			continue;
+		}
+
+		// Squared distance from the center to the cluster boxes, summed axis by axis
+		const LightSphere& light = lights[i];
+		float depth = -light.center.z;
+		float dz = std::max(std::max(sliceDepths[slice] - depth, depth - sliceDepths[slice + 1]), 0.0f);
+		float remaining = light.radius * light.radius - dz * dz;
+		if (remaining < 0.0f) {
+			continue;
+		}
+
+		// The tile bounds grow with the column and the row, the overlapped ones are contiguous
+		unsigned int xBegin = 0;
+		while (xBegin < TILE_COUNT_X && maxX[xBegin] < light.center.x - light.radius) {
+			xBegin++;
+		}
+		unsigned int xEnd = xBegin;
+		while (xEnd < TILE_COUNT_X && minX[xEnd] <= light.center.x + light.radius) {
+			xEnd++;
+		}
+		unsigned int yBegin = 0;
+		while (yBegin < TILE_COUNT_Y && maxY[yBegin] < light.center.y - light.radius) {
+			yBegin++;
+		}
+		unsigned int yEnd = yBegin;
+		while (yEnd < TILE_COUNT_Y && minY[yEnd] <= light.center.y + light.radius) {
+			yEnd++;
+		}
+
+		for (unsigned int y = yBegin; y < yEnd; y++) {
+			float dy = std::max(std::max(minY[y] - light.center.y, light.center.y - maxY[y]), 0.0f);
+			float rowRemaining = remaining - dy * dy;
+			if (rowRemaining < 0.0f) {
+				continue;
+			}
+			std::vector<uint16_t>* row = &lists[y * TILE_COUNT_X];
+
+#ifdef LIGHT_GRID_SSE2
+			// 4 tiles of the row at once
+			__m128 center = _mm_set1_ps(light.center.x);
+			__m128 limit = _mm_set1_ps(rowRemaining);
+			__m128 zero = _mm_setzero_ps();
+			for (unsigned int x = xBegin; x < xEnd; x += 4) {
+				__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(minX + x), center), _mm_sub_ps(center, _mm_loadu_ps(maxX + x))), zero);
+				int mask = _mm_movemask_ps(_mm_cmple_ps(_mm_mul_ps(dx, dx), limit));
+				mask &= (1 << std::min(4u, xEnd - x)) - 1;
+				for (unsigned int lane = 0; mask != 0; lane++, mask >>= 1) {
+					if (mask & 1) {
+						row[x + lane].push_back((uint16_t)i);
+					}
+				}
+			}
+#else
+			for (unsigned int x = xBegin; x < xEnd; x++) {
+				float dx = std::max(std::max(minX[x] - light.center.x, light.center.x - maxX[x]), 0.0f);
+				if (dx * dx <= rowRemaining) {
+					row[x].push_back((uint16_t)i);
+				}
+			}
+#endif
+		}
+	}
+}
+
+void LightGrid::buildSlice(unsigned int slice) {
+	SliceLists& lists = slices[slice];
+	for (auto& list : lists.pointLights) {
+		list.clear();
+	}
+	for (auto& list : lists.spotLights) {
+		list.clear();
+	}
+	cullLights(slice, *pointLights, pointRanges, lists.pointLights);
+	cullLights(slice, *spotLights, spotRanges, lists.spotLights);
+}
+
+void LightGrid::build(const std::vector<LightSphere>& pointLights, const std::vector<LightSphere>& spotLights, ThreadPool* pool, size_t maxLightIndices) {
+	auto start = std::chrono::steady_clock::now();
+
+	this->pointLights = &pointLights;
+	this->spotLights = &spotLights;
+	computeRanges(pointLights, pointRanges);
+	computeRanges(spotLights, spotRanges);
+
+	if (slices.size() != SLICE_COUNT) {
+		slices.resize(SLICE_COUNT);
+		for (auto& lists : slices) {
+			lists.pointLights.resize(TILE_COUNT_X * TILE_COUNT_Y);
+			lists.spotLights.resize(TILE_COUNT_X * TILE_COUNT_Y);
+		}
+	}
+
+	// Slices are handed out through a counter shared with the pool, the calling thread takes its share so
+	// a pool busy loading models doesn't stall the frame. Helpers that start late find no slice left
+	struct Job {
+		std::atomic<unsigned int> next{ 0 };
+		std::atomic<unsigned int> done{ 0 };
+	};
+	auto job = std::make_shared<Job>();
+	auto work = [this, job]() {
+		unsigned int slice;
+		while ((slice = job->next++) < SLICE_COUNT) {
+			buildSlice(slice);
+			job->done++;
+		}
+	};
+	if (pool != nullptr) {
+		unsigned int helperCount = std::min(pool->getThreadCount(), SLICE_COUNT - 1);
+		for (unsigned int i = 0; i < helperCount; i++) {
+			pool->submit(work);
+		}
+	}
+	work();
+	while (job->done < SLICE_COUNT) {
+		std::this_thread::yield();
+	}
+
+	stats = Stats();
+	stats.pointLightCount = (unsigned int)pointRanges.size();
+	stats.spotLightCount = (unsigned int)spotRanges.size();
+	gatherLists(maxLightIndices);
+	stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void LightGrid::gatherLists(size_t maxLightIndices) {
+	clusters.resize(CLUSTER_COUNT);
+	lightIndices.clear();
+
+	unsigned int cluster = 0;
+	for (const auto& lists : slices) {
+		for (unsigned int tile = 0; tile < TILE_COUNT_X * TILE_COUNT_Y; tile++, cluster++) {
+			const auto& pointList = lists.pointLights[tile];
+			const auto& spotList = lists.spotLights[tile];
+			size_t pointCount = pointList.size();
+			size_t spotCount = spotList.size();
+			if (lightIndices.size() + pointCount + spotCount > maxLightIndices) {
+				stats.truncated = true;
+				pointCount = std::min(pointCount, maxLightIndices - lightIndices.size());
+				spotCount = std::min(spotCount, maxLightIndices - lightIndices.size() - pointCount);
+			}
+
+			clusters[cluster].offset = (uint32_t)lightIndices.size();
+			clusters[cluster].counts = (uint32_t)pointCount | ((uint32_t)spotCount << 16);
+			lightIndices.insert(lightIndices.end(), pointList.begin(), pointList.begin() + pointCount);
+			lightIndices.insert(lightIndices.end(), spotList.begin(), spotList.begin() + spotCount);
+
+			if (pointCount + spotCount > 0) {
+				stats.usedClusterCount++;
+				stats.maxClusterLightCount = std::max(stats.maxClusterLightCount, (unsigned int)(pointCount + spotCount));
+			}
+		}
+	}
+	stats.lightIndexCount = lightIndices.size();
+}
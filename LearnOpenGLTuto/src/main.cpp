@@ -20,17 +20,32 @@
 
 #include <iostream>
 #include <vector>
+#include <cfloat>
+#include <iterator>
+#include <algorithm>
 #include <map>
+#include <unordered_map>
 #include <thread>
+#include <random>
 
 #include <utils.h>
 #include <vertices.h>
 #include <shader.h>
+#include <shader_variants.h>
+#include <render_queue.h>
+#include <frustum.h>
+#include <bvh.h>
+#include <scene_graph.h>
+#include <gl_state.h>
 #include <camera.h>
 #include <model.h>
+#include <model_handle.h>
+#include <texture_cache.h>
 #include <directional_light.h>
 #include <point_light.h>
 #include <spot_light.h>
+#include <light_block.h>
+#include <program_cache.h>
 
 // LOGIC
 float numberOfUpdatesPerSecond = 60;
@@ -64,6 +79,11 @@ unsigned int VAO_Plane, VAO_Cube, VAO_Line, VAO_Grid;
 unsigned int VBO_Plane, VBO_Cube, VBO_Line, VBO_Grid;
 unsigned int EBO_Plane;
 std::map<std::string, Shader> shaders;
+// Lit programs specialized on the material maps and the light set, see ShaderVariants
+std::map<std::string, ShaderVariants> shaderVariants;
+unsigned int compilingShaderCount = 0;
+// ShaderFeature bits of the lights of the frame
+uint32_t lightFeatures = 0;
 
 unsigned int texture_container;
 unsigned int texture_awesomeface;
@@ -72,13 +92,29 @@ unsigned int texture_container2;
 unsigned int texture_container2Specular;
 unsigned int texture_matrix;
 
-std::vector<unsigned int> textures;
+std::vector<TextureHandle> textures;
 
 // Data
 glm::vec3 backgroundColor(0.089f, 0.089f, 0.108f);
 
 glm::vec3 planePosition(0.0f, 0.0f, -5.0f);
 glm::vec3 nanosuitPosition(0.0f, 1.0f, -5.0f);
+int nanosuitInstanceCount = 1;		// on a grid behind nanosuitPosition, instanced past 1
+int extraCubeCount = 0;				// textured cubes scattered over the grid, drawn with the others
+const glm::vec3 cubePositions[] = {
+	glm::vec3(0.0f,  5.0f,  0.0f),
+	glm::vec3(2.0f,  10.0f, -15.0f),
+	glm::vec3(-1.5f, 3.2f, -2.5f),
+	glm::vec3(-3.8f, 3.0f, -12.3f),
+	glm::vec3(2.4f, 5.4f, -3.5f),
+	glm::vec3(-1.7f,  5.0f, -7.5f),
+	glm::vec3(1.3f, 3.0f, -2.5f),
+	glm::vec3(1.5f,  7.0f, -2.5f),
+	glm::vec3(1.5f,  5.2f, -1.5f),
+	glm::vec3(-1.3f,  6.0f, -1.5f),
+	glm::vec3(2.0f, 2.0f, -5.0f)
+};
+std::vector<glm::vec3> extraCubePositions;
 
 float	gizmoAmbientStrength = 0.1f;
 float	gizmoSpecularStrength = 0.5f;
@@ -109,18 +145,67 @@ Camera camera(glm::vec3(0.0f, 2.5f, 10.0f));
 DirectionalLight directionalLight;
 std::vector<PointLight> pointLights{ PointLight(glm::vec3(-2.5f, 5.0f, -5.0f)), PointLight(glm::vec3(2.5f, 5.0f, -5.0f)) };
 std::vector<SpotLight> spotLights{ SpotLight(glm::vec3(0.0f, 2.0f, -5.0f), glm::vec3(0.0f, -1.0f, 0.0f)) };
+// The lights past these were added by scatterLights
+const size_t scenePointLightCount = pointLights.size();
+const size_t sceneSpotLightCount = spotLights.size();
 
 std::unique_ptr<GLFWwindow, glfwDeleter> window;
 
-Model* nanosuit;
-Model* cat;
-Model* transportShuttle;
-Model* container;
-Model* container1;
-Model* container2;
-Model* container_triangulate;
-Model* container_uv_a_donf;
-Model* container_forward_up_chelou;
+// Loaded in the background, a placeholder is drawn until each one is ready
+ModelHandle* nanosuit;
+ModelHandle* cat;
+ModelHandle* transportShuttle;
+ModelHandle* container;
+ModelHandle* container1;
+ModelHandle* container2;
+ModelHandle* container_triangulate;
+ModelHandle* container_uv_a_donf;
+ModelHandle* container_forward_up_chelou;
+std::vector<ModelHandle*> modelHandles;
+
+double modelUploadBudget = 2.0;	// ms per frame
+VertexFormat modelVertexFormat = VertexFormat::Snorm16;	// GPU layout of the imported models
+float lodErrorThreshold = 1.0f;	// pixels
+unsigned int modelTrianglesDrawn = 0;
+bool clusterCullingEnabled = true;
+ClusterCulling clusterCulling;
+bool frustumCullingEnabled = true;
+FrustumCulling frustumCulling;
+// Object space boxes of the built-in shapes, see vertices.h
+const BoundingBox cubeBounds{ glm::vec3(-0.5f), glm::vec3(0.5f) };
+const BoundingBox planeBounds{ glm::vec3(-0.5f, -0.5f, 0.0f), glm::vec3(0.5f, 0.5f, 0.0f) };
+
+// Every object the frame culls sits in one BVH, the objects of a kind have consecutive ids from sceneObjectFirst[kind]
+enum SceneObjectKind : unsigned int {
+	OBJECT_PLANE,
+	OBJECT_MATERIAL_CUBE,
+	OBJECT_MODEL,			// cat, container_forward_up_chelou
+	OBJECT_NANOSUIT,
+	OBJECT_CUBE,			// cubePositions then extraCubePositions
+	OBJECT_POINT_LIGHT,
+	OBJECT_SPOT_LIGHT,
+	OBJECT_KIND_COUNT
+};
+Bvh sceneBvh;
+bool sceneBvhEnabled = true;	// each object tested on its own when disabled
+bool sceneBvhRebuild = true;	// refit only otherwise, the tree loosens as objects move
+unsigned int sceneObjectFirst[OBJECT_KIND_COUNT + 1] = {};
+std::vector<uint32_t> sceneVisibleObjects;	// sorted
+// Transforms of the scene: the nanosuit group first, then a node per object in the order of the ids
+SceneGraph sceneGraph;
+const uint32_t NANOSUIT_GROUP_NODE = 0;		// at nanosuitPosition, parent of the nanosuits and container_forward_up_chelou
+BoundingBox placedNanosuitBounds;			// object space box the nanosuits' boxes were last computed from
+MipmapBenchmark mipmapBenchmark;
+
+// Grid lines are thinner, the gizmo is drawn over the scene in a corner
+enum RenderPass : unsigned int {
+	PASS_SCENE,
+	PASS_LINES,
+	PASS_GIZMO
+};
+RenderQueue renderQueue;
+// GL calls of the previous frame, ImGui included
+GLState::Stats glStateStats;
 
 int main() {
 	glfwInit();
@@ -149,11 +234,16 @@ int main() {
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	initTextureCompression();
+	initMipmaps();
+	ProgramCache::getInstance().init();
+	Shader::initParallelCompile();
+	RenderQueue::initMultiDrawIndirect();
 
 	// Viewport inside the window, can spill out ouf window, if smaller than window, takes only a fraction of the window
-	glViewport(0, 0, width, height);
+	GLState::getInstance().viewport(0, 0, width, height);
 	glEnable(GL_DEPTH_TEST);
-	glLineWidth(2.0f);
+	GLState::getInstance().lineWidth(2.0f);
 
 	// Culling
 	//glEnable(GL_CULL_FACE);
@@ -179,6 +269,16 @@ int main() {
 
 	createShaders();
 
+	renderQueue.setPass(PASS_LINES, [] { GLState::getInstance().lineWidth(1.0f); }, [] { GLState::getInstance().lineWidth(2.0f); });
+	renderQueue.setPass(PASS_GIZMO, [] {
+		GLState::getInstance().viewport(10, 10, 100, 100);
+		glClear(GL_DEPTH_BUFFER_BIT);
+	}, [] {
+		const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+		GLState::getInstance().viewport(0, 0, mode->width, mode->height);
+		GLState::getInstance().depthFunc(GL_LESS);
+	});
+
 
 
 	// setup Dear ImGui context
@@ -197,15 +297,21 @@ int main() {
 	ImGui_ImplGlfw_InitForOpenGL(window.get(), true);
 	ImGui_ImplOpenGL3_Init(glsl_version.c_str());
 
-	nanosuit = new Model("assets/nanosuit/nanosuit.obj");
-	//container1 = new Model("assets/container/container_-z_forward.obj");
-	//container2 = new Model("assets/container/container_z_forward.obj");
-	//container_triangulate = new Model("assets/container/container_triangulate.obj");
-	//container_uv_a_donf = new Model("assets/container/container_uv_a_donf_triangulate.obj");
-	container_forward_up_chelou = new Model("assets/container/container_forward_up_chelou.obj");
-	cat = new Model("assets/cat/cat.obj");
-	//transportShuttle = new Model("assets/Transport Shuttle/Transport Shuttle_obj.obj");
-	//container = new Model("assets/container_advanced/Container.obj");
+	nanosuit = new ModelHandle("assets/nanosuit/nanosuit.obj", modelVertexFormat);
+	//container1 = new ModelHandle("assets/container/container_-z_forward.obj");
+	//container2 = new ModelHandle("assets/container/container_z_forward.obj");
+	//container_triangulate = new ModelHandle("assets/container/container_triangulate.obj");
+	//container_uv_a_donf = new ModelHandle("assets/container/container_uv_a_donf_triangulate.obj");
+	container_forward_up_chelou = new ModelHandle("assets/container/container_forward_up_chelou.obj", modelVertexFormat);
+	cat = new ModelHandle("assets/cat/cat.obj", modelVertexFormat);
+	//transportShuttle = new ModelHandle("assets/Transport Shuttle/Transport Shuttle_obj.obj");
+	//container = new ModelHandle("assets/container_advanced/Container.obj");
+
+	for (ModelHandle* handle : { nanosuit, cat, transportShuttle, container, container1, container2, container_triangulate, container_uv_a_donf, container_forward_up_chelou }) {
+		if (handle) {
+			modelHandles.push_back(handle);
+		}
+	}
 
 	// https://gafferongames.com/post/fix_your_timestep/
 	int logicStepsPerSecond = 60;
@@ -231,6 +337,13 @@ int main() {
 			accumulator -= dt;
 		}
 
+		// Finish uploading models loaded in the background, a bit every frame
+		for (ModelHandle* handle : modelHandles) {
+			handle->update(modelUploadBudget);
+		}
+		// Holes left by the models unloaded so far
+		BufferArena::defragmentAll();
+
 		// TODO
 		GLenum error = glGetError();
 		if (error != 0) {
@@ -278,7 +391,7 @@ void updateGrid() {
 		verticesGrid.push_back(j);		// z
 	}
 
-	glBindVertexArray(VAO_Grid);
+	GLState::getInstance().bindVertexArray(VAO_Grid);
 
 	glBindBuffer(GL_ARRAY_BUFFER, VBO_Grid);
 	glBufferData(GL_ARRAY_BUFFER, verticesGrid.size() * sizeof(float), verticesGrid.data(), GL_STATIC_DRAW);
@@ -301,7 +414,7 @@ void createOpenGLObjects() {
 	glGenBuffers(1, &EBO_Plane);
 
 	// PLANE
-	glBindVertexArray(VAO_Plane);
+	GLState::getInstance().bindVertexArray(VAO_Plane);
 
 	glBindBuffer(GL_ARRAY_BUFFER, VBO_Plane);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(verticesTexturedRectangle), verticesTexturedRectangle, GL_STATIC_DRAW);
@@ -321,12 +434,12 @@ void createOpenGLObjects() {
 	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(8 * sizeof(float)));
 	glEnableVertexAttribArray(3);
 
-	glBindVertexArray(0);
+	GLState::getInstance().bindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	// CUBE
-	glBindVertexArray(VAO_Cube);
+	GLState::getInstance().bindVertexArray(VAO_Cube);
 
 	glBindBuffer(GL_ARRAY_BUFFER, VBO_Cube);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(verticesCube), verticesCube, GL_STATIC_DRAW);
@@ -344,7 +457,7 @@ void createOpenGLObjects() {
 	glEnableVertexAttribArray(2);
 
 	// GIZMO
-	glBindVertexArray(VAO_Line);
+	GLState::getInstance().bindVertexArray(VAO_Line);
 
 	glBindBuffer(GL_ARRAY_BUFFER, VBO_Line);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(verticesLine), verticesLine, GL_STATIC_DRAW);
@@ -356,91 +469,561 @@ void createOpenGLObjects() {
 	updateGrid();
 
 	// Unbind
-	glBindVertexArray(0);
+	GLState::getInstance().bindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 void createTextures() {
-	texture_container = createTexture("assets", "container.jpg");
-	textures.push_back(texture_container);
+	// Shared with the models through the TextureCache (assets/container/ holds copies of container2*.png)
+	TextureCache& textureCache = TextureCache::getInstance();
 
-	texture_awesomeface = createTexture("assets", "awesomeface.png");
-	textures.push_back(texture_awesomeface);
+	textures.push_back(textureCache.load("assets", "container.jpg", true));
+	texture_container = textures.back().getID();
 
-	texture_redstoneLamp = createTexture("assets", "redstone_lamp.png");
-	textures.push_back(texture_redstoneLamp);
+	textures.push_back(textureCache.load("assets", "awesomeface.png", true));
+	texture_awesomeface = textures.back().getID();
 
-	texture_container2 = createTexture("assets", "container2.png");
-	textures.push_back(texture_container2);
+	textures.push_back(textureCache.load("assets", "redstone_lamp.png", true));
+	texture_redstoneLamp = textures.back().getID();
 
-	texture_container2Specular = createTexture("assets", "container2_specular.png");
-	textures.push_back(texture_container2Specular);
+	textures.push_back(textureCache.load("assets", "container2.png", true));
+	texture_container2 = textures.back().getID();
 
-	texture_matrix = createTexture("assets", "matrix.jpg");
-	textures.push_back(texture_matrix);
+	textures.push_back(textureCache.load("assets", "container2_specular.png"));
+	texture_container2Specular = textures.back().getID();
+
+	textures.push_back(textureCache.load("assets", "matrix.jpg", true));
+	texture_matrix = textures.back().getID();
 }
 
 
+// Camera handles of a program, resolved once it is ready
+struct CameraUniforms {
+	UniformHandle<glm::mat4> view;
+	UniformHandle<glm::mat4> projection;
+	UniformHandle<glm::vec3> viewPosition;
+};
+
+// Handles of the uniforms set with each draw, invalid in the programs without them
+struct DrawUniforms {
+	UniformHandle<glm::vec4> color;			// ourColor of the flat color programs
+	UniformHandle<glm::vec3> materialAmbient;
+	UniformHandle<glm::vec3> materialDiffuse;
+	UniformHandle<glm::vec3> materialSpecular;
+	UniformHandle<float> materialShininess;
+	// Lighting of shader_color_uniform, for the gizmo
+	UniformHandle<glm::vec3> lightColor;
+	UniformHandle<glm::vec3> lightPosition;
+	UniformHandle<float> ambientStrength;
+	UniformHandle<float> diffuseStrength;
+	UniformHandle<float> specularStrength;
+	UniformHandle<float> shininess;
+};
+
+std::unordered_map<unsigned int, CameraUniforms> cameraUniforms;	// program -> handles
+std::unordered_map<unsigned int, DrawUniforms> drawUniforms;		// program -> handles
+
+// From the onReady of every program, the fallbacks once built
+void resolveUniforms(const Shader& shader) {
+	CameraUniforms camera;
+	camera.view = shader.getUniform<glm::mat4>("view");
+	camera.projection = shader.getUniform<glm::mat4>("projection");
+	camera.viewPosition = shader.getUniform<glm::vec3>("viewPosition");
+	cameraUniforms[shader.ID] = camera;
+
+	DrawUniforms draw;
+	draw.color = shader.getUniform<glm::vec4>("ourColor");
+	draw.materialAmbient = shader.getUniform<glm::vec3>("material.ambient");
+	draw.materialDiffuse = shader.getUniform<glm::vec3>("material.diffuse");
+	draw.materialSpecular = shader.getUniform<glm::vec3>("material.specular");
+	draw.materialShininess = shader.getUniform<float>("material.shininess");
+	draw.lightColor = shader.getUniform<glm::vec3>("lightColor");
+	draw.lightPosition = shader.getUniform<glm::vec3>("lightPosition");
+	draw.ambientStrength = shader.getUniform<float>("ambientStrength");
+	draw.diffuseStrength = shader.getUniform<float>("diffuseStrength");
+	draw.specularStrength = shader.getUniform<float>("specularStrength");
+	draw.shininess = shader.getUniform<float>("shininess");
+	drawUniforms[shader.ID] = draw;
+}
+
+const CameraUniforms& getCameraUniforms(const Shader& shader) {
+	auto it = cameraUniforms.find(shader.ID);
+	if (it == cameraUniforms.end()) {
+		resolveUniforms(shader);
+		it = cameraUniforms.find(shader.ID);
+	}
+	return it->second;
+}
+
+// Looked up when the draw is queued, the setUniforms of the draw then captures the handles
+const DrawUniforms& getDrawUniforms(const Shader& shader) {
+	auto it = drawUniforms.find(shader.ID);
+	if (it == drawUniforms.end()) {
+		resolveUniforms(shader);
+		it = drawUniforms.find(shader.ID);
+	}
+	return it->second;
+}
+
+// The lights come from the LightBlock, only the camera is per program
+void setCameraUniforms(Shader& shader, const glm::mat4& view, const glm::mat4& projection) {
+	const CameraUniforms& uniforms = getCameraUniforms(shader);
+	shader.use();
+	shader.set(uniforms.view, view);
+	shader.set(uniforms.projection, projection);
+	shader.set(uniforms.viewPosition, camera.Position);
+}
+
+// Submitted without waiting for the driver, pollShaders() finishes each one once compiled
+Shader& addShader(const std::string& name, const char* vertexPath, const char* fragmentPath, std::function<void(Shader&)> onReady = nullptr,
+	const std::vector<std::string>& defines = {}) {
+	Shader& shader = shaders.emplace(std::piecewise_construct, std::forward_as_tuple(name), std::forward_as_tuple(vertexPath, fragmentPath, defines, true)).first->second;
+	shader.setOnReady([onReady](Shader& shader) {
+		LightBlock::bindProgram(shader);
+		resolveUniforms(shader);
+		if (onReady) {
+			onReady(shader);
+		}
+	});
+	return shader;
+}
+
 void createShaders() {
-	Shader shader_color_uniform("shaders/shader_color_uniform.vert", "shaders/shader_color_uniform.frag");
-	Shader shader_color_attribute("shaders/shader_color_attribute.vert", "shaders/shader_color_attribute.frag");
-	//Shader shader_color_material("shaders/shader_color_material.vert", "shaders/shader_color_material.frag");
-
-	Shader shader_texture_simple("shaders/shader_texture_simple.vert", "shaders/shader_texture_simple.frag");
-	shader_texture_simple.use();
-	shader_texture_simple.setInt("texture0", 0);
-
-	//Shader shader_texture_phong("shaders/shader_texture_phong.vert", "shaders/shader_texture_phong.frag");
-	//shader_texture_phong.use();
-	//shader_texture_phong.setInt("texture0", 0);
-	//shader_texture_phong.setInt("texture1", 1);
-
-	Shader shader_texture_phong_materials("shaders/shader_texture_phong_materials.vert", "shaders/shader_texture_phong_materials.frag");
-	shader_texture_phong_materials.use();
-	shader_texture_phong_materials.setInt("material.diffuse", 0);
-	shader_texture_phong_materials.setInt("material.specular", 1);
-	shader_texture_phong_materials.setInt("material.emission", 2);
-
-	Shader shader_color_phong_materials("shaders/shader_color_phong_materials.vert", "shaders/shader_color_phong_materials.frag");
-	shader_color_phong_materials.use();
-	shader_color_phong_materials.setInt("material.emission", 2);
-
-	Shader shader_color_uniform_simple("shaders/shader_color_uniform_simple.vert", "shaders/shader_color_uniform_simple.frag");
-
-	shaders.insert(std::make_pair("shader_color_uniform", shader_color_uniform));
-	shaders.insert(std::make_pair("shader_color_attribute", shader_color_attribute));
-	//shaders.insert(std::make_pair("shader_color_material", shader_color_material));
-	//shaders.insert(std::make_pair("shader_texture_phong", shader_texture_phong));
-	shaders.insert(std::make_pair("shader_texture_simple", shader_texture_simple));
-	shaders.insert(std::make_pair("shader_texture_phong_materials", shader_texture_phong_materials));
-	shaders.insert(std::make_pair("shader_color_phong_materials", shader_color_phong_materials));
-	shaders.insert(std::make_pair("shader_color_uniform_simple", shader_color_uniform_simple));
+	// Built first and waited for, they stand in for the programs still compiling
+	Shader& shader_fallback = shaders.emplace(std::piecewise_construct, std::forward_as_tuple("shader_fallback"),
+		std::forward_as_tuple("shaders/shader_color_uniform_simple.vert", "shaders/shader_color_uniform_simple.frag")).first->second;
+	resolveUniforms(shader_fallback);
+	shader_fallback.use();
+	shader_fallback.setFloat4("ourColor", 0.5f, 0.5f, 0.5f, 1.0f);
+	Shader& shader_fallback_compact = shaders.emplace(std::piecewise_construct, std::forward_as_tuple("shader_fallback_compact"),
+		std::forward_as_tuple("shaders/shader_texture_phong_materials_compact.vert", "shaders/shader_color_uniform_simple.frag")).first->second;
+	resolveUniforms(shader_fallback_compact);
+	shader_fallback_compact.use();
+	shader_fallback_compact.setFloat4("ourColor", 0.5f, 0.5f, 0.5f, 1.0f);
+	// Same for the instanced draws, the model matrix comes from the instance attributes
+	const std::vector<std::string> instanced = { "INSTANCED" };
+	Shader& shader_fallback_instanced = shaders.emplace(std::piecewise_construct, std::forward_as_tuple("shader_fallback_instanced"),
+		std::forward_as_tuple("shaders/shader_color_uniform_simple.vert", "shaders/shader_color_uniform_simple.frag", instanced)).first->second;
+	resolveUniforms(shader_fallback_instanced);
+	shader_fallback_instanced.use();
+	shader_fallback_instanced.setFloat4("ourColor", 0.5f, 0.5f, 0.5f, 1.0f);
+	Shader& shader_fallback_compact_instanced = shaders.emplace(std::piecewise_construct, std::forward_as_tuple("shader_fallback_compact_instanced"),
+		std::forward_as_tuple("shaders/shader_texture_phong_materials_compact.vert", "shaders/shader_color_uniform_simple.frag", instanced)).first->second;
+	resolveUniforms(shader_fallback_compact_instanced);
+	shader_fallback_compact_instanced.use();
+	shader_fallback_compact_instanced.setFloat4("ourColor", 0.5f, 0.5f, 0.5f, 1.0f);
+
+	addShader("shader_color_uniform", "shaders/shader_color_uniform.vert", "shaders/shader_color_uniform.frag");
+	addShader("shader_color_attribute", "shaders/shader_color_attribute.vert", "shaders/shader_color_attribute.frag");
+	//addShader("shader_color_material", "shaders/shader_color_material.vert", "shaders/shader_color_material.frag");
+
+	addShader("shader_texture_simple", "shaders/shader_texture_simple.vert", "shaders/shader_texture_simple.frag", [](Shader& shader) {
+		shader.use();
+		shader.setInt("texture0", 0);
+	});
+	addShader("shader_texture_simple_instanced", "shaders/shader_texture_simple.vert", "shaders/shader_texture_simple.frag", [](Shader& shader) {
+		shader.use();
+		shader.setInt("texture0", 0);
+	}, instanced);
+
+	//addShader("shader_texture_phong", "shaders/shader_texture_phong.vert", "shaders/shader_texture_phong.frag", [](Shader& shader) {
+	//	shader.use();
+	//	shader.setInt("texture0", 0);
+	//	shader.setInt("texture1", 1);
+	//});
+
+	// Diffuse, specular and emission on units 0 to 2 for the cubes, meshes set their own units through their Material
+	auto setupPhongMaterials = [](Shader& shader) {
+		LightBlock::bindProgram(shader);
+		resolveUniforms(shader);
+		shader.use();
+		shader.setInt("material.diffuse", 0);
+		shader.setInt("material.specular", 1);
+		shader.setInt("material.emission", 2);
+	};
+	shaderVariants.emplace(std::piecewise_construct, std::forward_as_tuple("shader_texture_phong_materials"),
+		std::forward_as_tuple("shaders/shader_texture_phong_materials.vert", "shaders/shader_texture_phong_materials.frag", shader_fallback, shader_fallback_instanced, setupPhongMaterials));
+	// Same fragment shader, vertices decoded from the compact vertex formats
+	shaderVariants.emplace(std::piecewise_construct, std::forward_as_tuple("shader_texture_phong_materials_compact"),
+		std::forward_as_tuple("shaders/shader_texture_phong_materials_compact.vert", "shaders/shader_texture_phong_materials.frag", shader_fallback_compact,
+			shader_fallback_compact_instanced, setupPhongMaterials));
+
+	addShader("shader_color_phong_materials", "shaders/shader_color_phong_materials.vert", "shaders/shader_color_phong_materials.frag", [](Shader& shader) {
+		shader.use();
+		shader.setInt("material.emission", 2);
+	});
+
+	addShader("shader_color_uniform_simple", "shaders/shader_color_uniform_simple.vert", "shaders/shader_color_uniform_simple.frag");
+
+	// Recounted by the first pollShaders()
+	compilingShaderCount = (unsigned int)shaders.size();
+}
+
+// Once per frame, finishes the programs the driver is done with
+void pollShaders() {
+	unsigned int compilingCount = 0;
+	for (auto& shader : shaders) {
+		if (!shader.second.poll()) {
+			compilingCount++;
+		}
+	}
+	for (auto& variants : shaderVariants) {
+		compilingCount += variants.second.poll();
+	}
+	if (compilingShaderCount > 0 && compilingCount == 0) {
+		ProgramCache::getInstance().printStats();
+	}
+	compilingShaderCount = compilingCount;
+}
+
+// The named program, or a fallback drawing flat gray while it compiles or if it failed
+Shader& getShader(const std::string& name) {
+	Shader& shader = shaders.find(name)->second;
+	if (shader.isReady()) {
+		return shader;
+	}
+	// Compact vertex formats need the vertex shader decoding them, instanced draws the instance attributes
+	bool compact = name.find("_compact") != std::string::npos;
+	bool instanced = name.find("_instanced") != std::string::npos;
+	return shaders.find(std::string("shader_fallback") + (compact ? "_compact" : "") + (instanced ? "_instanced" : ""))->second;
 }
 
 void update(double deltaTime) {
 
 }
 
-void resetOpenGLObjectsState() {
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	Shader::release();
-	glBindVertexArray(0);
+// Distance along the view direction, what the RenderQueue sorts on
+float getViewDepth(const glm::mat4& view, const glm::vec3& position) {
+	return -(view * glm::vec4(position, 1.0f)).z;
+}
+
+glm::vec3 getCubePosition(unsigned int index) {
+	return index < std::size(cubePositions) ? cubePositions[index] : extraCubePositions[index - std::size(cubePositions)];
+}
+
+glm::mat4 getPointLightModel(const PointLight& pointLight) {
+	glm::mat4 model(1.0f);
+	model = glm::translate(model, pointLight.Position);
+	return glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
+}
+
+glm::mat4 getSpotLightModel(const SpotLight& spotLight) {
+	glm::mat4 model(1.0f);
+	model = glm::translate(model, spotLight.Position);
+	model = glm::scale(model, glm::vec3(0.3f, 0.3f, 0.3f));
+	// TODO
+	//model = glm::rotate(model, (float)glm::radians(glfwGetTime()), spotLight.Direction);
+	//glm::lookAt(spotLight.Position, spotLight.Direction, glm::vec3(0.0f, 1.0f, 0.0f));
+	return model;
+}
+
+// Object space box of the model, or of the placeholder drawModel draws until it is ready
+BoundingBox getModelBounds(ModelHandle* handle) {
+	if (handle->isReady()) {
+		return handle->get()->getBounds();
+	}
+	if (handle->hasBounds()) {
+		return { handle->getBoundsMin(), handle->getBoundsMax() };
+	}
+	return cubeBounds;
+}
+
+uint32_t getSceneNode(SceneObjectKind kind, unsigned int index) {
+	return 1 + sceneObjectFirst[kind] + index;
+}
+
+// As of the last sceneGraph.update, the objects of a kind have consecutive matrices
+const glm::mat4& getSceneWorld(SceneObjectKind kind, unsigned int index) {
+	return sceneGraph.getWorld(getSceneNode(kind, index));
+}
+
+SceneObjectKind getSceneObjectKind(unsigned int object) {
+	unsigned int kind = 0;
+	while (object >= sceneObjectFirst[kind + 1]) {
+		kind++;
+	}
+	return (SceneObjectKind)kind;
+}
+
+// Object space box of an object
+BoundingBox getSceneObjectBounds(SceneObjectKind kind, unsigned int index) {
+	switch (kind) {
+	case OBJECT_PLANE:
+		return planeBounds;
+	case OBJECT_MODEL:
+		return getModelBounds(index == 0 ? cat : container_forward_up_chelou);
+	case OBJECT_NANOSUIT:
+		return getModelBounds(nanosuit);
+	default:
+		return cubeBounds;
+	}
+}
+
+glm::mat4 getPlaneLocal() {
+	glm::mat4 model(1.0f);
+	model = glm::translate(model, planePosition);
+	model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+	return glm::scale(model, glm::vec3(5.0f, 5.0f, 1.0f));
+}
+
+// Builds the scene graph and the BVH again when objects come or go. Otherwise only what ImGui moves gets a new local
+// matrix, and only when it changed: the graph recomputes the nodes below it and the BVH refits their objects.
+// Nothing is recomputed while the scene stands still
+void updateSceneObjects() {
+	unsigned int counts[OBJECT_KIND_COUNT] = { 1, 1, 2, (unsigned int)nanosuitInstanceCount,
+		(unsigned int)(std::size(cubePositions) + extraCubeCount), (unsigned int)pointLights.size(), (unsigned int)spotLights.size() };
+	unsigned int first[OBJECT_KIND_COUNT + 1] = {};
+	for (unsigned int kind = 0; kind < OBJECT_KIND_COUNT; kind++) {
+		first[kind + 1] = first[kind] + counts[kind];
+	}
+	bool rebuild = sceneBvhRebuild || !std::equal(std::begin(first), std::end(first), std::begin(sceneObjectFirst));
+	sceneBvhRebuild = false;
+	std::copy(std::begin(first), std::end(first), std::begin(sceneObjectFirst));
+
+	if (rebuild) {
+		if (extraCubePositions.size() != (size_t)extraCubeCount) {
+			std::mt19937 generator(7);
+			std::uniform_real_distribution<float> horizontal(-gridSize / 2, gridSize / 2);
+			std::uniform_real_distribution<float> vertical(0.5f, 10.0f);
+			extraCubePositions.resize(extraCubeCount);
+			for (auto& position : extraCubePositions) {
+				position = glm::vec3(horizontal(generator), vertical(generator), horizontal(generator));
+			}
+		}
+
+		sceneGraph.clear();
+		sceneGraph.reserve(1 + first[OBJECT_KIND_COUNT]);
+		sceneGraph.addNode(glm::translate(glm::mat4(1.0f), nanosuitPosition));
+		sceneGraph.addNode(getPlaneLocal());
+
+		//model = glm::rotate(model, (float)glfwGetTime() * glm::radians(30.0f) + 30 * i, glm::vec3(1.0f, 0.0f, 0.0f));
+		//model = glm::rotate(model, (float)glfwGetTime() * glm::radians(20.0f) + 20 * i, glm::vec3(0.0f, 1.0f, 0.0f));
+		//model = glm::rotate(model, (float)glfwGetTime() * glm::radians(10.0f) + 10 * i, glm::vec3(0.0f, 0.0f, 1.0f));
+		sceneGraph.addNode(glm::translate(glm::mat4(1.0f), glm::vec3(-2.0f, 2.0f, -5.0f)));
+
+		glm::mat4 model(1.0f);
+		model = glm::translate(model, glm::vec3(0.0f, 0.5f, -2.0f));
+		model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));
+		model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+		sceneGraph.addNode(model);
+		sceneGraph.addNode(glm::scale(glm::mat4(1.0f), glm::vec3(0.5f, 0.5f, 0.5f)), NANOSUIT_GROUP_NODE);
+
+		// Rows of nanosuits going back from nanosuitPosition
+		int nanosuitColumns = (int)glm::ceil(glm::sqrt((float)nanosuitInstanceCount));
+		for (int i = 0; i < nanosuitInstanceCount; i++) {
+			glm::vec3 offset(2.0f * (i % nanosuitColumns - (nanosuitColumns - 1) / 2), 0.0f, -2.0f * (i / nanosuitColumns));
+			model = glm::translate(glm::mat4(1.0f), offset);
+			model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));
+			sceneGraph.addNode(model, NANOSUIT_GROUP_NODE);
+		}
+
+		for (unsigned int i = 0; i < counts[OBJECT_CUBE]; i++) {
+			sceneGraph.addNode(glm::translate(glm::mat4(1.0f), getCubePosition(i)));
+		}
+		for (const auto& pointLight : pointLights) {
+			sceneGraph.addNode(getPointLightModel(pointLight));
+		}
+		for (const auto& spotLight : spotLights) {
+			sceneGraph.addNode(getSpotLightModel(spotLight));
+		}
+	}
+	else {
+		auto setLocal = [](uint32_t node, const glm::mat4& local) {
+			if (local != sceneGraph.getLocal(node)) {
+				sceneGraph.setLocal(node, local);
+			}
+		};
+		setLocal(NANOSUIT_GROUP_NODE, glm::translate(glm::mat4(1.0f), nanosuitPosition));
+		setLocal(getSceneNode(OBJECT_PLANE, 0), getPlaneLocal());
+		for (unsigned int i = 0; i < counts[OBJECT_POINT_LIGHT]; i++) {
+			setLocal(getSceneNode(OBJECT_POINT_LIGHT, i), getPointLightModel(pointLights[i]));
+		}
+		for (unsigned int i = 0; i < counts[OBJECT_SPOT_LIGHT]; i++) {
+			setLocal(getSceneNode(OBJECT_SPOT_LIGHT, i), getSpotLightModel(spotLights[i]));
+		}
+	}
+	sceneGraph.update();
+
+	if (rebuild) {
+		placedNanosuitBounds = getModelBounds(nanosuit);
+		std::vector<BoundingBox> boxes(first[OBJECT_KIND_COUNT]);
+		for (unsigned int kind = 0; kind < OBJECT_KIND_COUNT; kind++) {
+			for (unsigned int i = 0; i < counts[kind]; i++) {
+				boxes[first[kind] + i] = getSceneObjectBounds((SceneObjectKind)kind, i).transform(getSceneWorld((SceneObjectKind)kind, i));
+			}
+		}
+		sceneBvh.build(boxes);
+		return;
+	}
+
+	// The objects the graph moved, and the models whose bounds came in since their boxes were computed
+	bool moved = false;
+	auto place = [&moved](unsigned int object) {
+		SceneObjectKind kind = getSceneObjectKind(object);
+		unsigned int index = object - sceneObjectFirst[kind];
+		BoundingBox box = getSceneObjectBounds(kind, index).transform(getSceneWorld(kind, index));
+		if (box != sceneBvh.getObjectBox(object)) {
+			sceneBvh.update(object, box);
+			moved = true;
+		}
+	};
+	for (uint32_t node : sceneGraph.getUpdatedNodes()) {
+		if (node != NANOSUIT_GROUP_NODE) {
+			place(node - 1);
+		}
+	}
+	for (unsigned int i = 0; i < counts[OBJECT_MODEL]; i++) {
+		place(first[OBJECT_MODEL] + i);
+	}
+	BoundingBox nanosuitBounds = getModelBounds(nanosuit);
+	if (nanosuitBounds != placedNanosuitBounds) {
+		placedNanosuitBounds = nanosuitBounds;
+		for (unsigned int i = 0; i < counts[OBJECT_NANOSUIT]; i++) {
+			place(first[OBJECT_NANOSUIT] + i);
+		}
+	}
+	if (moved) {
+		sceneBvh.refit();
+	}
+}
+
+// Calls f with the index within its kind of each object of the kind in the frustum, in increasing order. Through
+// the BVH query of the frame, or a test per object when it is disabled
+template <typename F>
+void forEachVisibleObject(SceneObjectKind kind, F&& f) {
+	unsigned int first = sceneObjectFirst[kind];
+	unsigned int last = sceneObjectFirst[kind + 1];
+	if (!sceneBvhEnabled || !frustumCulling.enabled) {
+		for (unsigned int object = first; object < last; object++) {
+			if (frustumCulling.isVisible(sceneBvh.getObjectBox(object))) {
+				f(object - first);
+			}
+		}
+		return;
+	}
+	for (auto it = std::lower_bound(sceneVisibleObjects.begin(), sceneVisibleObjects.end(), first); it != sceneVisibleObjects.end() && *it < last; ++it) {
+		f(*it - first);
+	}
+}
+
+bool isSceneObjectVisible(SceneObjectKind kind, unsigned int index) {
+	unsigned int object = sceneObjectFirst[kind] + index;
+	if (!sceneBvhEnabled || !frustumCulling.enabled) {
+		return frustumCulling.isVisible(sceneBvh.getObjectBox(object));
+	}
+	return std::binary_search(sceneVisibleObjects.begin(), sceneVisibleObjects.end(), object);
+}
+
+// Queues the model, or a placeholder until it is ready: its bounding box once imported, a small cube before that
+void drawModel(ModelHandle* handle, const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection) {
+	if (handle->isReady()) {
+		// Compact vertex formats need their own vertex shader to decode positions and normals
+		Model* loadedModel = handle->get();
+		bool compact = loadedModel->getVertexFormat() != VertexFormat::Float;
+		ShaderVariants& variants = shaderVariants.find(compact ? "shader_texture_phong_materials_compact" : "shader_texture_phong_materials")->second;
+		float depth = getViewDepth(view, glm::vec3(model * glm::vec4((loadedModel->getBoundsMin() + loadedModel->getBoundsMax()) * 0.5f, 1.0f)));
+		modelTrianglesDrawn += loadedModel->enqueue(renderQueue, variants, lightFeatures, model, depth,
+			LodSelection(projection, view, (float)height, lodErrorThreshold), clusterCullingEnabled ? &clusterCulling : nullptr, &frustumCulling);
+		return;
+	}
+	if (handle->hasFailed()) {
+		return;
+	}
+
+	glm::mat4 placeholderModel(model);
+	if (handle->hasBounds()) {
+		glm::vec3 boundsMin = handle->getBoundsMin();
+		glm::vec3 boundsMax = handle->getBoundsMax();
+		placeholderModel = glm::translate(placeholderModel, (boundsMin + boundsMax) * 0.5f);
+		placeholderModel = glm::scale(placeholderModel, glm::max(boundsMax - boundsMin, glm::vec3(0.01f)));
+	}
+
+	Shader& shader_color_uniform_simple = getShader("shader_color_uniform_simple");
+	setCameraUniforms(shader_color_uniform_simple, view, projection);
+
+	DrawItem item;
+	item.shader = &shader_color_uniform_simple;
+	item.vertexArray = VAO_Cube;
+	item.model = placeholderModel;
+	item.depth = getViewDepth(view, glm::vec3(placeholderModel[3]));
+	UniformHandle<glm::vec4> color = getDrawUniforms(shader_color_uniform_simple).color;
+	item.setUniforms = [color](Shader& shader) {
+		shader.set(color, glm::vec4(0.4f, 0.4f, 0.45f, 1.0f));
+	};
+	item.call = { GL_TRIANGLES, 36, 0, 0, 0, 0, 0 };
+	renderQueue.add(std::move(item));
+}
+
+// One instanced draw per mesh once the model is ready, until then a placeholder for the first instance only.
+// An instance per object of kind
+void drawModelInstances(ModelHandle* handle, SceneObjectKind kind, const glm::mat4& view, const glm::mat4& projection) {
+	unsigned int instanceCount = sceneObjectFirst[kind + 1] - sceneObjectFirst[kind];
+	if (instanceCount == 0) {
+		return;
+	}
+	const glm::mat4* models = &getSceneWorld(kind, 0);
+	if (instanceCount == 1 || !handle->isReady()) {
+		if (isSceneObjectVisible(kind, 0)) {
+			drawModel(handle, models[0], view, projection);
+		}
+		return;
+	}
+
+	Model* loadedModel = handle->get();
+	bool compact = loadedModel->getVertexFormat() != VertexFormat::Float;
+	ShaderVariants& variants = shaderVariants.find(compact ? "shader_texture_phong_materials_compact" : "shader_texture_phong_materials")->second;
+
+	// Only the instances in the frustum, the nearest of them picks the LOD and sorts the draws
+	BoundingBox bounds = loadedModel->getBounds();
+	glm::vec4 center(bounds.getCenter(), 1.0f);
+	std::vector<glm::mat4> visibleModels;
+	unsigned int nearestInstance = 0;
+	float nearestDistance = FLT_MAX;
+	forEachVisibleObject(kind, [&](unsigned int index) {
+		const glm::mat4& model = models[index];
+		float distance = glm::distance(camera.Position, glm::vec3(model * center));
+		if (distance < nearestDistance) {
+			nearestDistance = distance;
+			nearestInstance = (unsigned int)visibleModels.size();
+		}
+		visibleModels.push_back(model);
+	});
+	if (visibleModels.empty()) {
+		return;
+	}
+	float depth = getViewDepth(view, glm::vec3(visibleModels[nearestInstance] * center));
+	modelTrianglesDrawn += loadedModel->enqueueInstances(renderQueue, variants, lightFeatures, visibleModels.data(), (unsigned int)visibleModels.size(),
+		nearestInstance, depth, LodSelection(projection, view, (float)height, lodErrorThreshold));
+}
+
+// Short ranged lights spread over the grid, for the clustered lighting to have something to sort
+void scatterLights(unsigned int pointLightCount, unsigned int spotLightCount) {
+	static std::mt19937 generator(42);
+	std::uniform_real_distribution<float> horizontal(-gridSize / 2, gridSize / 2);
+	std::uniform_real_distribution<float> vertical(0.5f, 4.0f);
+	std::uniform_real_distribution<float> channel(0.2f, 1.0f);
+
+	for (unsigned int i = 0; i < pointLightCount; ++i) {
+		glm::vec3 position(horizontal(generator), vertical(generator), horizontal(generator));
+		glm::vec3 color(channel(generator), channel(generator), channel(generator));
+		pointLights.push_back(PointLight(position, 1.0f, 0.7f, 1.8f, color * 0.05f, color, color, true, false));
+	}
+	for (unsigned int i = 0; i < spotLightCount; ++i) {
+		glm::vec3 position(horizontal(generator), vertical(generator) + 2.0f, horizontal(generator));
+		glm::vec3 color(channel(generator), channel(generator), channel(generator));
+		spotLights.push_back(SpotLight(position, glm::vec3(0.0f, -1.0f, 0.0f), glm::cos(glm::radians(20.0f)), glm::cos(glm::radians(25.0f)),
+			1.0f, 0.35f, 0.44f, glm::vec3(0.0f), color, color, true, false));
+	}
 }
 
 void render(double deltaTime) {
+	glStateStats = GLState::getInstance().takeStats();
+	pollShaders();
+
 	glClearColor(backgroundColor.x, backgroundColor.y, backgroundColor.z, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
 	glm::mat4 view = camera.getViewMatrix();
 
 	//////////////////////// 
@@ -470,450 +1053,286 @@ void render(double deltaTime) {
 		}
 	}
 	glm::mat4 projection = lerpProjectionMatrices(projectionPerspective, projectionOrtho, mixValue);
+	modelTrianglesDrawn = 0;
+	clusterCulling = ClusterCulling();
+	clusterCulling.cameraPosition = camera.Position;
+	clusterCulling.backfaceCulling = mixValue == 0.0f;
+	// The blended projection is still a projection, its planes bound what ends up on screen
+	frustumCulling = FrustumCulling();
+	frustumCulling.frustum = Frustum(projection * view);
+	frustumCulling.enabled = frustumCullingEnabled;
+	updateSceneObjects();
+	if (sceneBvhEnabled && frustumCullingEnabled) {
+		sceneBvh.query(frustumCulling.frustum, sceneVisibleObjects);
+		std::sort(sceneVisibleObjects.begin(), sceneVisibleObjects.end());
+	}
 
 	//////////////////////////////////////////////////////////////
 	// Lights setup in shader
-	glm::vec3 emptyVec3(0.0f, 0.0f, 0.0f);
-
-	Shader& shader_texture_phong_materials = shaders.find("shader_texture_phong_materials")->second;
-	shader_texture_phong_materials.use();
-	shader_texture_phong_materials.setMatrixFloat4v("view", 1, view);
-	shader_texture_phong_materials.setMatrixFloat4v("projection", 1, projection);
-	shader_texture_phong_materials.setFloat3("viewPosition", camera.Position);
-
-	if (directionalLight.Enabled) {
-		shader_texture_phong_materials.setFloat3("directionalLight.direction", directionalLight.Direction);
-		shader_texture_phong_materials.setFloat3("directionalLight.ambient", directionalLight.Ambient);
-		shader_texture_phong_materials.setFloat3("directionalLight.diffuse", directionalLight.Diffuse);
-		shader_texture_phong_materials.setFloat3("directionalLight.specular", directionalLight.Specular);
-	}
-	else {
-		shader_texture_phong_materials.setFloat3("directionalLight.direction", emptyVec3);
-		shader_texture_phong_materials.setFloat3("directionalLight.ambient", emptyVec3);
-		shader_texture_phong_materials.setFloat3("directionalLight.diffuse", emptyVec3);
-		shader_texture_phong_materials.setFloat3("directionalLight.specular", emptyVec3);
-	}
-
-	for (int i = 0; i < pointLights.size(); ++i) {
-		std::string index = std::to_string(i);
-		const auto& pointLight = pointLights[i];
-		if (pointLight.Enabled) {
-			shader_texture_phong_materials.setFloat3("pointLights[" + index + "].position", pointLight.Position);
-			shader_texture_phong_materials.setFloat("pointLights[" + index + "].constant", pointLight.Constant);
-			shader_texture_phong_materials.setFloat("pointLights[" + index + "].linear", pointLight.Linear);
-			shader_texture_phong_materials.setFloat("pointLights[" + index + "].quadratic", pointLight.Quadratic);
-			shader_texture_phong_materials.setFloat3("pointLights[" + index + "].ambient", pointLight.Ambient);
-			shader_texture_phong_materials.setFloat3("pointLights[" + index + "].diffuse", pointLight.Diffuse);
-			shader_texture_phong_materials.setFloat3("pointLights[" + index + "].specular", pointLight.Specular);
-		}
-		else {
-			shader_texture_phong_materials.setFloat3("pointLights[" + index + "].position", emptyVec3);
-			shader_texture_phong_materials.setFloat("pointLights[" + index + "].constant", 0.0f);
-			shader_texture_phong_materials.setFloat("pointLights[" + index + "].linear", 0.0f);
-			shader_texture_phong_materials.setFloat("pointLights[" + index + "].quadratic", 0.0f);
-			shader_texture_phong_materials.setFloat3("pointLights[" + index + "].ambient", emptyVec3);
-			shader_texture_phong_materials.setFloat3("pointLights[" + index + "].diffuse", emptyVec3);
-			shader_texture_phong_materials.setFloat3("pointLights[" + index + "].specular", emptyVec3);
-		}
-	}
-
-	for (int i = 0; i < spotLights.size(); ++i) {
-		std::string index = std::to_string(i);
-		const auto& spotLight = spotLights[i];
-		if (spotLight.Enabled) {
-			shader_texture_phong_materials.setFloat3("spotLights[" + index + "].position", spotLight.Position);
-			shader_texture_phong_materials.setFloat3("spotLights[" + index + "].direction", spotLight.Direction);
-			shader_texture_phong_materials.setFloat("spotLights[" + index + "].innerCutOff", spotLight.InnerCutOff);
-			shader_texture_phong_materials.setFloat("spotLights[" + index + "].outerCutOff", spotLight.OuterCutOff);
-			shader_texture_phong_materials.setFloat("spotLights[" + index + "].constant", spotLight.Constant);
-			shader_texture_phong_materials.setFloat("spotLights[" + index + "].linear", spotLight.Linear);
-			shader_texture_phong_materials.setFloat("spotLights[" + index + "].quadratic", spotLight.Quadratic);
-			shader_texture_phong_materials.setFloat3("spotLights[" + index + "].ambient", spotLight.Ambient);
-			shader_texture_phong_materials.setFloat3("spotLights[" + index + "].diffuse", spotLight.Diffuse);
-			shader_texture_phong_materials.setFloat3("spotLights[" + index + "].specular", spotLight.Specular);
-		}
-		else {
-			shader_texture_phong_materials.setFloat3("spotLights[" + index + "].position", emptyVec3);
-			shader_texture_phong_materials.setFloat3("spotLights[" + index + "].direction", emptyVec3);
-			shader_texture_phong_materials.setFloat("spotLights[" + index + "].innerCutOff", 0.0f);
-			shader_texture_phong_materials.setFloat("spotLights[" + index + "].outerCutOff", 0.0f);
-			shader_texture_phong_materials.setFloat("spotLights[" + index + "].constant", 0.0f);
-			shader_texture_phong_materials.setFloat("spotLights[" + index + "].linear", 0.0f);
-			shader_texture_phong_materials.setFloat("spotLights[" + index + "].quadratic", 0.0f);
-			shader_texture_phong_materials.setFloat3("spotLights[" + index + "].ambient", emptyVec3);
-			shader_texture_phong_materials.setFloat3("spotLights[" + index + "].diffuse", emptyVec3);
-			shader_texture_phong_materials.setFloat3("spotLights[" + index + "].specular", emptyVec3);
-		}
-	}
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(window.get(), &framebufferWidth, &framebufferHeight);
+	LightBlock::getInstance().update(directionalLight, pointLights, spotLights, view, projection, camera.Near, camera.Far, framebufferWidth, framebufferHeight);
 
-	Shader& shader_color_phong_materials = shaders.find("shader_color_phong_materials")->second;
-	shader_color_phong_materials.use();
-	shader_color_phong_materials.setMatrixFloat4v("view", 1, view);
-	shader_color_phong_materials.setMatrixFloat4v("projection", 1, projection);
-	shader_color_phong_materials.setFloat3("viewPosition", camera.Position);
+	const LightBlock::Data& lightBlockData = LightBlock::getInstance().getData();
+	lightFeatures = (lightBlockData.directionalLightCount > 0 ? ShaderFeature::DIRECTIONAL_LIGHT : 0)
+		| (lightBlockData.pointLightCount > 0 ? ShaderFeature::POINT_LIGHTS : 0)
+		| (lightBlockData.spotLightCount > 0 ? ShaderFeature::SPOT_LIGHTS : 0);
 
-	if (directionalLight.Enabled) {
-		shader_color_phong_materials.setFloat3("directionalLight.direction", directionalLight.Direction);
-		shader_color_phong_materials.setFloat3("directionalLight.ambient", directionalLight.Ambient);
-		shader_color_phong_materials.setFloat3("directionalLight.diffuse", directionalLight.Diffuse);
-		shader_color_phong_materials.setFloat3("directionalLight.specular", directionalLight.Specular);
-	}
-	else {
-		shader_color_phong_materials.setFloat3("directionalLight.direction", emptyVec3);
-		shader_color_phong_materials.setFloat3("directionalLight.ambient", emptyVec3);
-		shader_color_phong_materials.setFloat3("directionalLight.diffuse", emptyVec3);
-		shader_color_phong_materials.setFloat3("directionalLight.specular", emptyVec3);
-	}
-
-	for (int i = 0; i < pointLights.size(); ++i) {
-		std::string index = std::to_string(i);
-		const auto& pointLight = pointLights[i];
-		if (pointLight.Enabled) {
-			shader_color_phong_materials.setFloat3("pointLights[" + index + "].position", pointLight.Position);
-			shader_color_phong_materials.setFloat("pointLights[" + index + "].constant", pointLight.Constant);
-			shader_color_phong_materials.setFloat("pointLights[" + index + "].linear", pointLight.Linear);
-			shader_color_phong_materials.setFloat("pointLights[" + index + "].quadratic", pointLight.Quadratic);
-			shader_color_phong_materials.setFloat3("pointLights[" + index + "].ambient", pointLight.Ambient);
-			shader_color_phong_materials.setFloat3("pointLights[" + index + "].diffuse", pointLight.Diffuse);
-		}
-		else {
-			shader_color_phong_materials.setFloat3("pointLights[" + index + "].specular", emptyVec3);
-			shader_color_phong_materials.setFloat3("pointLights[" + index + "].position", emptyVec3);
-			shader_color_phong_materials.setFloat("pointLights[" + index + "].constant", 0.0f);
-			shader_color_phong_materials.setFloat("pointLights[" + index + "].linear", 0.0f);
-			shader_color_phong_materials.setFloat("pointLights[" + index + "].quadratic", 0.0f);
-			shader_color_phong_materials.setFloat3("pointLights[" + index + "].ambient", emptyVec3);
-			shader_color_phong_materials.setFloat3("pointLights[" + index + "].diffuse", emptyVec3);
-			shader_color_phong_materials.setFloat3("pointLights[" + index + "].specular", emptyVec3);
-		}
-	}
-
-	for (int i = 0; i < spotLights.size(); ++i) {
-		std::string index = std::to_string(i);
-		const auto& spotLight = spotLights[i];
-		if (spotLight.Enabled) {
-			shader_color_phong_materials.setFloat3("spotLights[" + index + "].position", spotLight.Position);
-			shader_color_phong_materials.setFloat3("spotLights[" + index + "].direction", spotLight.Direction);
-			shader_color_phong_materials.setFloat("spotLights[" + index + "].innerCutOff", spotLight.InnerCutOff);
-			shader_color_phong_materials.setFloat("spotLights[" + index + "].outerCutOff", spotLight.OuterCutOff);
-			shader_color_phong_materials.setFloat("spotLights[" + index + "].constant", spotLight.Constant);
-			shader_color_phong_materials.setFloat("spotLights[" + index + "].linear", spotLight.Linear);
-			shader_color_phong_materials.setFloat("spotLights[" + index + "].quadratic", spotLight.Quadratic);
-			shader_color_phong_materials.setFloat3("spotLights[" + index + "].ambient", spotLight.Ambient);
-			shader_color_phong_materials.setFloat3("spotLights[" + index + "].diffuse", spotLight.Diffuse);
-		}
-		else {
-			shader_color_phong_materials.setFloat3("spotLights[" + index + "].specular", emptyVec3);
-			shader_color_phong_materials.setFloat3("spotLights[" + index + "].position", emptyVec3);
-			shader_color_phong_materials.setFloat3("spotLights[" + index + "].direction", emptyVec3);
-			shader_color_phong_materials.setFloat("spotLights[" + index + "].innerCutOff", 0.0f);
-			shader_color_phong_materials.setFloat("spotLights[" + index + "].outerCutOff", 0.0f);
-			shader_color_phong_materials.setFloat("spotLights[" + index + "].constant", 0.0f);
-			shader_color_phong_materials.setFloat("spotLights[" + index + "].linear", 0.0f);
-			shader_color_phong_materials.setFloat("spotLights[" + index + "].quadratic", 0.0f);
-			shader_color_phong_materials.setFloat3("spotLights[" + index + "].ambient", emptyVec3);
-			shader_color_phong_materials.setFloat3("spotLights[" + index + "].diffuse", emptyVec3);
-			shader_color_phong_materials.setFloat3("spotLights[" + index + "].specular", emptyVec3);
-		}
-	}
+	ShaderVariants& phongVariants = shaderVariants.find("shader_texture_phong_materials")->second;
 
-	// Declared early that way I'm sure it exists
-	// Should still reset it every time though
-	glm::mat4 model = glm::mat4(1.0f);
+	Shader& shader_color_phong_materials = getShader("shader_color_phong_materials");
 
 
 	//
-	shader_texture_phong_materials.use();
+	drawModelInstances(nanosuit, OBJECT_NANOSUIT, view, projection);
 
-	model = glm::mat4(1.0f);
-	model = glm::translate(model, nanosuitPosition);
-	model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));
-	shader_texture_phong_materials.setMatrixFloat4v("model", 1, model);
-	nanosuit->Draw(shader_texture_phong_materials);
-
-	model = glm::mat4(1.0f);
-	model = glm::translate(model, glm::vec3(0.0f, 0.5f, -2.0f));
-	model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));
-	model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	shader_texture_phong_materials.setMatrixFloat4v("model", 1, model);
-	cat->Draw(shader_texture_phong_materials);
+	if (isSceneObjectVisible(OBJECT_MODEL, 0)) {
+		drawModel(cat, getSceneWorld(OBJECT_MODEL, 0), view, projection);
+	}
 
 	//model = glm::mat4(1.0f);
 	//model = glm::translate(model, glm::vec3(0.0f, 0.5f, -2.0f));
 	////model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));
 	////model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	//shader_texture_phong_materials.setMatrixFloat4v("model", 1, model);
-	//transportShuttle->Draw(shader_texture_phong_materials);
+	//drawModel(transportShuttle, model, view, projection);
 
 	//model = glm::mat4(1.0f);
 	//model = glm::translate(model, glm::vec3(0.0f, 0.5f, -2.0f));
 	//model = glm::scale(model, glm::vec3(0.01f, 0.01f, 0.01f));
 	////model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	//shader_texture_phong_materials.setMatrixFloat4v("model", 1, model);
-	//container->Draw(shader_texture_phong_materials);
+	//drawModel(container, model, view, projection);
 
 	//model = glm::mat4(1.0f);
 	//model = glm::translate(model, glm::vec3(-1.0f, 1.0f, -5.0f));
 	//model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-	//shader_texture_phong_materials.setMatrixFloat4v("model", 1, model);
-	//container1->Draw(shader_texture_phong_materials);
+	//drawModel(container1, model, view, projection);
 
 	//model = glm::mat4(1.0f);
 	//model = glm::translate(model, glm::vec3(1.0f, 1.0f, -5.0f));
 	//model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-	//shader_texture_phong_materials.setMatrixFloat4v("model", 1, model);
-	//container2->Draw(shader_texture_phong_materials);
+	//drawModel(container2, model, view, projection);
 
 	//model = glm::mat4(1.0f);
 	//model = glm::translate(model, glm::vec3(3.0f, 1.0f, -5.0f));
 	//model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-	//shader_texture_phong_materials.setMatrixFloat4v("model", 1, model);
-	//container_triangulate->Draw(shader_texture_phong_materials);
-
-	model = glm::mat4(1.0f);
-	model = glm::translate(model, nanosuitPosition);
-	model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-	shader_texture_phong_materials.setMatrixFloat4v("model", 1, model);
-	container_forward_up_chelou->Draw(shader_texture_phong_materials);
+	//drawModel(container_triangulate, model, view, projection);
+
+	if (isSceneObjectVisible(OBJECT_MODEL, 1)) {
+		drawModel(container_forward_up_chelou, getSceneWorld(OBJECT_MODEL, 1), view, projection);
+	}
 	//
 
 	//////////////////////////////////////////////////////////////
 	// Render OpenGL
-	if (drawPlane) {
-		glBindVertexArray(VAO_Plane);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture_container);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-		model = glm::mat4(1.0f);
-		model = glm::translate(model, planePosition);
-		model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-		model = glm::scale(model, glm::vec3(5.0f, 5.0f, 1.0f));
-
-		shader_texture_phong_materials.use();
-		shader_texture_phong_materials.setMatrixFloat4v("model", 1, model);
-
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-
-		resetOpenGLObjectsState();
+	if (drawPlane && isSceneObjectVisible(OBJECT_PLANE, 0)) {
+		// Diffuse map only
+		DrawItem item;
+		item.shader = &phongVariants.get(lightFeatures);
+		item.vertexArray = VAO_Plane;
+		item.textures[0] = texture_container;
+		item.model = getSceneWorld(OBJECT_PLANE, 0);
+		item.depth = getViewDepth(view, planePosition);
+		item.call = { GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, 0, 0, 0 };
+		renderQueue.add(std::move(item));
 	}
 	if (drawTexturedCubes) {
-		shader_texture_phong_materials.use();
-		shader_texture_phong_materials.setFloat("material.shininess", (float)texturedCubeShininess);
-
-		glm::vec3 cubePositions[] = {
-			glm::vec3(0.0f,  5.0f,  0.0f),
-			glm::vec3(2.0f,  10.0f, -15.0f),
-			glm::vec3(-1.5f, 3.2f, -2.5f),
-			glm::vec3(-3.8f, 3.0f, -12.3f),
-			glm::vec3(2.4f, 5.4f, -3.5f),
-			glm::vec3(-1.7f,  5.0f, -7.5f),
-			glm::vec3(1.3f, 3.0f, -2.5f),
-			glm::vec3(1.5f,  7.0f, -2.5f),
-			glm::vec3(1.5f,  5.2f, -1.5f),
-			glm::vec3(-1.3f,  6.0f, -1.5f)
-		};
-
-		glBindVertexArray(VAO_Cube);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture_container2);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, texture_container2Specular);
-
-		for (int i = 0; i < 10; ++i) {
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, cubePositions[i]);
-			//model = glm::rotate(model, (float)glfwGetTime() * glm::radians(30.0f) + 30 * i, glm::vec3(1.0f, 0.0f, 0.0f));
-			//model = glm::rotate(model, (float)glfwGetTime() * glm::radians(20.0f) + 20 * i, glm::vec3(0.0f, 1.0f, 0.0f));
-			//model = glm::rotate(model, (float)glfwGetTime() * glm::radians(10.0f) + 10 * i, glm::vec3(0.0f, 0.0f, 1.0f));
-			shader_texture_phong_materials.setMatrixFloat4v("model", 1, model);
-
-			glDrawArrays(GL_TRIANGLES, 0, 36);
+		std::vector<glm::mat4> cubeModels;
+		float nearestDepth = FLT_MAX;
+		forEachVisibleObject(OBJECT_CUBE, [&](unsigned int index) {
+			const glm::mat4& model = getSceneWorld(OBJECT_CUBE, index);
+			cubeModels.push_back(model);
+			nearestDepth = glm::min(nearestDepth, getViewDepth(view, glm::vec3(model[3])));
+		});
+
+		// Diffuse and specular maps. The shininess goes with each draw, the variant may be shared with meshes whose Material sets theirs
+		// A single instanced draw for every cube
+		if (!cubeModels.empty()) {
+			DrawItem item;
+			item.shader = &phongVariants.get(lightFeatures | ShaderFeature::SPECULAR_MAP | ShaderFeature::INSTANCED);
+			item.vertexArray = VAO_Cube;
+			item.textures[0] = texture_container2;
+			item.textures[1] = texture_container2Specular;
+			float shininess = (float)texturedCubeShininess;
+			UniformHandle<float> shininessUniform = getDrawUniforms(*item.shader).materialShininess;
+			item.setUniforms = [shininessUniform, shininess](Shader& shader) {
+				shader.set(shininessUniform, shininess);
+			};
+			item.depth = nearestDepth;
+			item.call = { GL_TRIANGLES, 36, 0, 0, 0, 0, 0, renderQueue.addInstances(cubeModels.data(), (unsigned int)cubeModels.size()), (unsigned int)cubeModels.size() };
+			renderQueue.add(std::move(item));
 		}
-
-		model = glm::mat4(1.0f);
-		model = glm::translate(model, glm::vec3(2.0f, 2.0f, -5.0f));
-		shader_texture_phong_materials.setMatrixFloat4v("model", 1, model);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-
-		resetOpenGLObjectsState();
 	}
-	if (drawMaterialCubes) {
-		// Diffuse map / Specular map cube
-		glBindVertexArray(VAO_Cube);
-
-		model = glm::mat4(1.0f);
-		model = glm::translate(model, glm::vec3(-2.0f, 2.0f, -5.0f));
-		//model = glm::rotate(model, (float)glfwGetTime() * glm::radians(30.0f) + 30 * i, glm::vec3(1.0f, 0.0f, 0.0f));
-		//model = glm::rotate(model, (float)glfwGetTime() * glm::radians(20.0f) + 20 * i, glm::vec3(0.0f, 1.0f, 0.0f));
-		//model = glm::rotate(model, (float)glfwGetTime() * glm::radians(10.0f) + 10 * i, glm::vec3(0.0f, 0.0f, 1.0f));
-
-		//glActiveTexture(GL_TEXTURE2);
-		//glBindTexture(GL_TEXTURE_2D, texture_matrix);
-
-		shader_color_phong_materials.use();
-		shader_color_phong_materials.setMatrixFloat4v("model", 1, model);
-		shader_color_phong_materials.setFloat3("material.ambient", 1.0f, 0.5f, 0.31f);
-		shader_color_phong_materials.setFloat3("material.specular", 1.0f, 0.5f, 0.31f);
-		shader_color_phong_materials.setFloat3("material.diffuse", 0.5f, 0.5f, 0.5f);
-		shader_color_phong_materials.setFloat("material.shininess", (float)materialCubeShininess);
-
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-
-		resetOpenGLObjectsState();
+	// Diffuse map / Specular map cube
+	if (drawMaterialCubes && isSceneObjectVisible(OBJECT_MATERIAL_CUBE, 0)) {
+		//item.textures[2] = texture_matrix;
+
+		DrawItem item;
+		item.shader = &shader_color_phong_materials;
+		item.vertexArray = VAO_Cube;
+		item.model = getSceneWorld(OBJECT_MATERIAL_CUBE, 0);
+		item.depth = getViewDepth(view, glm::vec3(item.model[3]));
+		float shininess = (float)materialCubeShininess;
+		const DrawUniforms& uniforms = getDrawUniforms(shader_color_phong_materials);
+		item.setUniforms = [uniforms, shininess](Shader& shader) {
+			shader.set(uniforms.materialAmbient, glm::vec3(1.0f, 0.5f, 0.31f));
+			shader.set(uniforms.materialSpecular, glm::vec3(1.0f, 0.5f, 0.31f));
+			shader.set(uniforms.materialDiffuse, glm::vec3(0.5f, 0.5f, 0.5f));
+			shader.set(uniforms.materialShininess, shininess);
+		};
+		item.call = { GL_TRIANGLES, 36, 0, 0, 0, 0, 0 };
+		renderQueue.add(std::move(item));
 	}
 	if (drawLights) {
-		glBindVertexArray(VAO_Cube);
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture_redstoneLamp);
-
-		Shader& shader_texture_simple = shaders.find("shader_texture_simple")->second;
-		shader_texture_simple.use();
-		shader_texture_simple.setMatrixFloat4v("view", 1, view);
-		shader_texture_simple.setMatrixFloat4v("projection", 1, projection);
-
-		for (auto const& pointLight : pointLights) {
+		Shader& shader_texture_simple = getShader("shader_texture_simple_instanced");
+		setCameraUniforms(shader_texture_simple, view, projection);
+
+		std::vector<glm::mat4> lightModels;
+		lightModels.reserve(pointLights.size() + spotLights.size());
+		float nearestDepth = FLT_MAX;
+		forEachVisibleObject(OBJECT_POINT_LIGHT, [&](unsigned int index) {
+			const PointLight& pointLight = pointLights[index];
 			if (pointLight.Enabled && pointLight.Visible) {
-				glm::mat4 model(1.0f);
-				model = glm::translate(model, pointLight.Position);
-				model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-				shader_texture_simple.setMatrixFloat4v("model", 1, model);
-
-				glDrawArrays(GL_TRIANGLES, 0, 36);
+				lightModels.push_back(getSceneWorld(OBJECT_POINT_LIGHT, index));
+				nearestDepth = glm::min(nearestDepth, getViewDepth(view, pointLight.Position));
 			}
-		}
+		});
 
-		for (auto const& spotLight : spotLights) {
+		forEachVisibleObject(OBJECT_SPOT_LIGHT, [&](unsigned int index) {
+			const SpotLight& spotLight = spotLights[index];
 			if (spotLight.Enabled && spotLight.Visible) {
-				glm::mat4 model(1.0f);
-				model = glm::translate(model, spotLight.Position);
-				model = glm::scale(model, glm::vec3(0.3f, 0.3f, 0.3f));
-				// TODO
-				//model = glm::rotate(model, (float)glm::radians(glfwGetTime()), spotLight.Direction);
-				//glm::lookAt(spotLight.Position, spotLight.Direction, glm::vec3(0.0f, 1.0f, 0.0f));
-				shader_texture_simple.setMatrixFloat4v("model", 1, model);
-
-				glDrawArrays(GL_TRIANGLES, 0, 36);
+				lightModels.push_back(getSceneWorld(OBJECT_SPOT_LIGHT, index));
+				nearestDepth = glm::min(nearestDepth, getViewDepth(view, spotLight.Position));
 			}
+		});
+
+		// Every gizmo in one instanced draw
+		if (!lightModels.empty()) {
+			DrawItem item;
+			item.shader = &shader_texture_simple;
+			item.vertexArray = VAO_Cube;
+			item.textures[0] = texture_redstoneLamp;
+			item.depth = nearestDepth;
+			item.call = { GL_TRIANGLES, 36, 0, 0, 0, 0, 0, renderQueue.addInstances(lightModels.data(), (unsigned int)lightModels.size()), (unsigned int)lightModels.size() };
+			renderQueue.add(std::move(item));
 		}
-
-		resetOpenGLObjectsState();
 	}
 
 	if (drawGrid) {
-		glBindVertexArray(VAO_Grid);
-
-		Shader& shader_color_uniform_simple = shaders.find("shader_color_uniform_simple")->second;
-		shader_color_uniform_simple.use();
+		Shader& shader_color_uniform_simple = getShader("shader_color_uniform_simple");
+		setCameraUniforms(shader_color_uniform_simple, view, projection);
 
 		glm::mat4 model(1.0f);
 		model = glm::scale(model, glm::vec3(gridSize / 2, gridSize / 2, gridSize / 2));
-		shader_color_uniform_simple.setMatrixFloat4v("model", 1, model);
-		shader_color_uniform_simple.setMatrixFloat4v("view", 1, view);
-		shader_color_uniform_simple.setMatrixFloat4v("projection", 1, projection);
-		shader_color_uniform_simple.setFloat4("ourColor", 0.7f, 0.7f, 0.7f, 1.0f);
 
-		glLineWidth(1.0f);
 		// TODO: pabo
-		glDrawArrays(GL_LINES, 0, (gridIntervals + 1) * 6);
-		glLineWidth(2.0f);
-
-		resetOpenGLObjectsState();
+		DrawItem item;
+		item.pass = PASS_LINES;
+		item.shader = &shader_color_uniform_simple;
+		item.vertexArray = VAO_Grid;
+		item.model = model;
+		UniformHandle<glm::vec4> color = getDrawUniforms(shader_color_uniform_simple).color;
+		item.setUniforms = [color](Shader& shader) {
+			shader.set(color, glm::vec4(0.7f, 0.7f, 0.7f, 1.0f));
+		};
+		item.call = { GL_LINES, (unsigned int)(gridIntervals + 1) * 6, 0, 0, 0, 0, 0 };
+		renderQueue.add(std::move(item));
 	}
 	// gizmo
 	if (drawGizmo) {
-		glViewport(10.0f, 10.0f, 100.0f, 100.0f);
-		glClear(GL_DEPTH_BUFFER_BIT);
-
-		glBindVertexArray(VAO_Cube);
-
-		Shader& shader_color_uniform = shaders.find("shader_color_uniform")->second;
-		shader_color_uniform.use();
+		Shader& shader_color_uniform = getShader("shader_color_uniform");
 
 		// Fixed postition so that camera position doesn't change render 
 		glm::mat4 viewGizmo(view);
 		viewGizmo[3][0] = 0.0f;
 		viewGizmo[3][1] = 0.0f;
 		viewGizmo[3][2] = -2.5f;
-		shader_color_uniform.setMatrixFloat4v("view", 1, viewGizmo);
 
 		glm::mat4 projectionGizmo(lerpProjectionMatrices(projectionPerspectiveGizmo, projectionOrthoGizmo, mixValue));
 
-		shader_color_uniform.setMatrixFloat4v("projection", 1, projectionGizmo);
-
-		glm::mat4 model(1.0f);
-		model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-		shader_color_uniform.setMatrixFloat4v("model", 1, model);
+		// Set with each draw, the program may be a fallback shared with the scene
+		const CameraUniforms& cameraHandles = getCameraUniforms(shader_color_uniform);
+		const DrawUniforms& drawHandles = getDrawUniforms(shader_color_uniform);
+		auto setGizmoUniforms = [cameraHandles, drawHandles, viewGizmo, projectionGizmo](Shader& shader, const glm::vec4& color, float ambientStrength) {
+			shader.set(cameraHandles.view, viewGizmo);
+			shader.set(cameraHandles.projection, projectionGizmo);
 
-		shader_color_uniform.setFloat3("lightColor", 1.0f, 1.0f, 1.0f);
-		shader_color_uniform.setFloat3("lightPosition", 3.0f, 2.0, 5.0f);
-		shader_color_uniform.setFloat3("viewPosition", 0.0f, 0.0f, -3.0f);
+			shader.set(drawHandles.lightColor, glm::vec3(1.0f, 1.0f, 1.0f));
+			shader.set(drawHandles.lightPosition, glm::vec3(3.0f, 2.0, 5.0f));
+			shader.set(cameraHandles.viewPosition, glm::vec3(0.0f, 0.0f, -3.0f));
 
-		shader_color_uniform.setFloat("ambientStrength", gizmoAmbientStrength);
-		shader_color_uniform.setFloat("specularStrength", gizmoSpecularStrength);
-		shader_color_uniform.setFloat("diffuseStrength", gizmoDiffuseStrength);
-		shader_color_uniform.setFloat("shininess", (float)gizmoShininess);
+			shader.set(drawHandles.ambientStrength, ambientStrength);
+			shader.set(drawHandles.specularStrength, gizmoSpecularStrength);
+			shader.set(drawHandles.diffuseStrength, gizmoDiffuseStrength);
+			shader.set(drawHandles.shininess, (float)gizmoShininess);
 
-		shader_color_uniform.setFloat4("ourColor", 0.7f, 0.7f, 0.7f, 1.0f);
+			shader.set(drawHandles.color, color);
+		};
+		auto addGizmoItem = [&](unsigned int vertexArray, unsigned int mode, const glm::mat4& model, const glm::vec4& color, float ambientStrength) {
+			DrawItem item;
+			item.pass = PASS_GIZMO;
+			item.shader = &shader_color_uniform;
+			item.vertexArray = vertexArray;
+			item.model = model;
+			item.setUniforms = [setGizmoUniforms, color, ambientStrength](Shader& shader) {
+				setGizmoUniforms(shader, color, ambientStrength);
+			};
+			item.call = { mode, mode == GL_LINES ? 6u : 36u, 0, 0, 0, 0, 0 };
+			renderQueue.add(std::move(item));
+		};
 
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+		glm::mat4 model(1.0f);
+		model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
+		addGizmoItem(VAO_Cube, GL_TRIANGLES, model, glm::vec4(0.7f, 0.7f, 0.7f, 1.0f), gizmoAmbientStrength);
 
 		// We want Shadow only for the main cube
-		shader_color_uniform.setFloat("ambientStrength", 1.0f);
-
 		// X Cube
 		model = glm::mat4(1.0f);
 		model = glm::translate(model, glm::vec3(0.9f, 0.0f, 0.0f));
 		model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));
-		shader_color_uniform.setMatrixFloat4v("model", 1, model);
-		shader_color_uniform.setFloat4("ourColor", 1.0f, 0.0f, 0.0f, 1.0f);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+		addGizmoItem(VAO_Cube, GL_TRIANGLES, model, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f), 1.0f);
 
 		// Y Cube
 		model = glm::mat4(1.0f);
 		model = glm::translate(model, glm::vec3(0.0f, 0.9f, 0.0f));
 		model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));
-		shader_color_uniform.setMatrixFloat4v("model", 1, model);
-		shader_color_uniform.setFloat4("ourColor", 0.0f, 1.0f, 0.0f, 1.0f);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+		addGizmoItem(VAO_Cube, GL_TRIANGLES, model, glm::vec4(0.0f, 1.0f, 0.0f, 1.0f), 1.0f);
 
 		// Z Cube
 		model = glm::mat4(1.0f);
 		model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.9f));
 		model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));
-		shader_color_uniform.setMatrixFloat4v("model", 1, model);
-		shader_color_uniform.setFloat4("ourColor", 0.0f, 0.0f, 1.0f, 1.0f);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-
-		glBindVertexArray(VAO_Line);
+		addGizmoItem(VAO_Cube, GL_TRIANGLES, model, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f), 1.0f);
 
 		// x
 		model = glm::mat4(1.0f);
-		shader_color_uniform.setMatrixFloat4v("model", 1, model);
-		shader_color_uniform.setFloat4("ourColor", 1.0f, 0.0f, 0.0f, 1.0f);
-		glDrawArrays(GL_LINES, 0, 6);
+		addGizmoItem(VAO_Line, GL_LINES, model, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f), 1.0f);
 
 		// y
 		model = glm::mat4(1.0f);
 		model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		shader_color_uniform.setMatrixFloat4v("model", 1, model);
-		shader_color_uniform.setFloat4("ourColor", 0.0f, 1.0f, 0.0f, 1.0f);
-		glDrawArrays(GL_LINES, 0, 6);
+		addGizmoItem(VAO_Line, GL_LINES, model, glm::vec4(0.0f, 1.0f, 0.0f, 1.0f), 1.0f);
 
 		// z
 		model = glm::mat4(1.0f);
 		model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		shader_color_uniform.setMatrixFloat4v("model", 1, model);
-		shader_color_uniform.setFloat4("ourColor", 0.0f, 0.0f, 1.0f, 1.0f);
-		glDrawArrays(GL_LINES, 0, 6);
-
-		resetOpenGLObjectsState();
+		addGizmoItem(VAO_Line, GL_LINES, model, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f), 1.0f);
+	}
 
-		glViewport(0, 0, mode->width, mode->height);
-		glDepthFunc(GL_LESS);
+	// Once everything is queued: a variant first requested above is ready right away when its binary was cached,
+	// and the queue only binds programs in submit()
+	for (auto& variants : shaderVariants) {
+		variants.second.forEachReady([&view, &projection](Shader& shader) {
+			setCameraUniforms(shader, view, projection);
+		});
 	}
+	setCameraUniforms(shaders.find("shader_fallback")->second, view, projection);
+	setCameraUniforms(shaders.find("shader_fallback_compact")->second, view, projection);
+	setCameraUniforms(shaders.find("shader_fallback_instanced")->second, view, projection);
+	setCameraUniforms(shaders.find("shader_fallback_compact_instanced")->second, view, projection);
+	setCameraUniforms(shader_color_phong_materials, view, projection);
+
+	renderQueue.setFarDepth(camera.Far);
+	renderQueue.submit();
 
 
 	// Render Dear Imgui
@@ -950,6 +1369,40 @@ void render(double deltaTime) {
 
 		ImGui::DragFloat3("Plane position", &planePosition[0], 0.1f, -10.0f, 10.0f);
 		ImGui::DragFloat3("Nano position", &nanosuitPosition[0], 0.1f, -10.0f, 10.0f);
+		ImGui::DragInt("Nanosuits", &nanosuitInstanceCount, 1.0f, 1, 16384);
+		ImGui::DragInt("Extra textured cubes", &extraCubeCount, 10.0f, 0, 100000);
+
+		ImGui::SliderFloat("LOD error (px)", &lodErrorThreshold, 0.1f, 20.0f, "%.1f");
+		ImGui::Text("Model triangles: %u", modelTrianglesDrawn);
+		ImGui::Checkbox("Frustum culling?", &frustumCullingEnabled);
+		ImGui::SameLine();
+		ImGui::Checkbox("Scene BVH?", &sceneBvhEnabled);
+		ImGui::SameLine();
+		if (ImGui::Button("Rebuild BVH")) {
+			sceneBvhRebuild = true;
+		}
+		ImGui::Text("Box tests: %u visible, %u culled", frustumCulling.visibleCount, frustumCulling.culledCount);
+		const Bvh::Stats& bvhStats = sceneBvh.getStats();
+		ImGui::Text("BVH: %u objects, %u nodes, depth %u, built in %.2f ms", bvhStats.objectCount, bvhStats.nodeCount, bvhStats.depth, bvhStats.buildMs);
+		ImGui::Text("Last refit: %u nodes in %.3f ms", bvhStats.refitNodeCount, bvhStats.refitMs);
+		const SceneGraph::Stats& sceneGraphStats = sceneGraph.getStats();
+		ImGui::Text("Transforms: %u of %u nodes updated, %u swept in %.3f ms",
+			sceneGraphStats.updatedNodeCount, sceneGraphStats.nodeCount, sceneGraphStats.sweptNodeCount, sceneGraphStats.updateMs);
+		ImGui::Text("Query: %u nodes visited, %u accepted, %u rejected, %u objects in %.3f ms",
+			bvhStats.visitedNodeCount, bvhStats.acceptedNodeCount, bvhStats.rejectedNodeCount, bvhStats.visibleObjectCount, bvhStats.queryMs);
+		ImGui::Checkbox("Cluster culling?", &clusterCullingEnabled);
+		ImGui::Text("Clusters: %u / %u, triangles: %u / %u", clusterCulling.visibleClusterCount, clusterCulling.clusterCount, clusterCulling.visibleTriangleCount, clusterCulling.triangleCount);
+
+		BufferArena::Stats arenaStats = BufferArena::getTotalStats();
+		ImGui::Text("Buffer arenas: %u pages, %u meshes", arenaStats.pageCount, arenaStats.blockCount);
+		ImGui::Text("Vertices %.1f / %.1f MB, indices %.1f / %.1f MB", arenaStats.vertexBytesUsed / 1048576.0, arenaStats.vertexBytesCapacity / 1048576.0,
+			arenaStats.indexBytesUsed / 1048576.0, arenaStats.indexBytesCapacity / 1048576.0);
+
+		const LightGrid::Stats& lightGridStats = LightBlock::getInstance().getGridStats();
+		ImGui::Text("Light grid: %u point, %u spot lights in %u / %u clusters", lightGridStats.pointLightCount, lightGridStats.spotLightCount,
+			lightGridStats.usedClusterCount, LightGrid::CLUSTER_COUNT);
+		ImGui::Text("%zu light indices, up to %u per cluster, built in %.2f ms%s", lightGridStats.lightIndexCount, lightGridStats.maxClusterLightCount,
+			lightGridStats.buildMs, lightGridStats.truncated ? " (truncated)" : "");
 	}
 
 	if (ImGui::CollapsingHeader("Colors & Gizmo")) {
@@ -966,6 +1419,14 @@ void render(double deltaTime) {
 	}
 
 	if (ImGui::CollapsingHeader("Lights", ImGuiTreeNodeFlags_DefaultOpen)) {
+		if (ImGui::Button("Scatter 100 lights")) {
+			scatterLights(80, 20);
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Remove scattered lights")) {
+			pointLights.resize(scenePointLightCount);
+			spotLights.resize(sceneSpotLightCount);
+		}
 		if (ImGui::TreeNodeEx("Directional Light", ImGuiTreeNodeFlags_DefaultOpen)) {
 			ImGui::Checkbox("Enabled", &directionalLight.Enabled);
 			ImGui::Checkbox("Visible", &directionalLight.Visible);
@@ -1065,6 +1526,40 @@ void render(double deltaTime) {
 		//https://stackoverflow.com/questions/28530798/how-to-make-a-basic-fps-counter
 		ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 
+		const RenderQueue::Stats& renderQueueStats = renderQueue.getStats();
+		ImGui::Text("Render queue: %u draws (%u instances) in %u batches%s, %u program / %u texture / %u VAO changes, sorted in %.3f ms",
+			renderQueueStats.itemCount, renderQueueStats.instanceCount, renderQueueStats.batchCount,
+			RenderQueue::hasMultiDrawIndirect() ? " (indirect)" : "", renderQueueStats.programChanges, renderQueueStats.textureChanges, renderQueueStats.vertexArrayChanges, renderQueueStats.sortMs);
+		ImGui::Text("GL state: %u calls issued, %u filtered", glStateStats.getIssued(), glStateStats.getFiltered());
+		if (ImGui::IsItemHovered()) {
+			ImGui::BeginTooltip();
+			for (unsigned int call = 0; call < GLState::CALL_COUNT; call++) {
+				ImGui::Text("%s: %u issued, %u filtered", GLState::getCallName((GLState::Call)call), glStateStats.issued[call], glStateStats.filtered[call]);
+			}
+			ImGui::EndTooltip();
+		}
+
+		const ProgramCache::Stats& programCacheStats = ProgramCache::getInstance().getStats();
+		ImGui::Text("Program cache: %u hits, %u misses, %u invalidations, %.1f ms building programs", programCacheStats.hits,
+			programCacheStats.misses, programCacheStats.invalidations, programCacheStats.buildMs);
+		unsigned int variantCount = 0;
+		for (const auto& variants : shaderVariants) {
+			variantCount += variants.second.getVariantCount();
+		}
+		ImGui::Text("%u phong variants", variantCount);
+		if (compilingShaderCount > 0) {
+			ImGui::Text("Compiling %u programs", compilingShaderCount);
+		}
+
+		if (ImGui::Button("Benchmark mipmaps")) {
+			mipmapBenchmark = benchmarkMipmaps("assets/nanosuit");
+			mipmapBenchmark.print("assets/nanosuit");
+		}
+		if (mipmapBenchmark.textureCount > 0) {
+			ImGui::Text("%u textures: driver %.1f ms, scalar %.1f ms, SIMD %.1f ms", mipmapBenchmark.textureCount,
+				mipmapBenchmark.driverMs, mipmapBenchmark.scalarMs, mipmapBenchmark.simdMs);
+		}
+
 		// Render Time
 
 		// Swap Time
@@ -1076,7 +1571,7 @@ void render(double deltaTime) {
 	ImGui::Render();
 	int display_w, display_h;
 	glfwGetFramebufferSize(window.get(), &display_w, &display_h);
-	glViewport(0, 0, display_w, display_h);
+	GLState::getInstance().viewport(0, 0, display_w, display_h);
 	glClearColor(backgroundColor.x, backgroundColor.y, backgroundColor.z, 1.0f);
 	//glClear(GL_COLOR_BUFFER_BIT);
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -1092,6 +1587,8 @@ void render(double deltaTime) {
 		ImGui::RenderPlatformWindowsDefault();
 		glfwMakeContextCurrent(backup_current_context);
 	}
+	// The backend restores what it binds, but through GL directly
+	GLState::getInstance().invalidate();
 	/////////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Before
 	// ImGui::Render();
@@ -1099,17 +1596,26 @@ void render(double deltaTime) {
 }
 
 void cleanUp() {
-	glDeleteVertexArrays(1, &VAO_Plane);
-	glDeleteVertexArrays(1, &VAO_Cube);
-	glDeleteVertexArrays(1, &VAO_Line);
-	glDeleteVertexArrays(1, &VAO_Grid);
+	for (unsigned int VAO : { VAO_Plane, VAO_Cube, VAO_Line, VAO_Grid }) {
+		GLState::getInstance().onDeleteVertexArray(VAO);
+		glDeleteVertexArrays(1, &VAO);
+	}
 	glDeleteBuffers(1, &VBO_Plane);
 	glDeleteBuffers(1, &VBO_Cube);
 	glDeleteBuffers(1, &VBO_Line);
 	glDeleteBuffers(1, &VBO_Grid);
 	glDeleteBuffers(1, &EBO_Plane);
 
-	glDeleteTextures(5, &textures[0]);
+	for (ModelHandle* handle : modelHandles) {
+		delete handle;
+	}
+	modelHandles.clear();
+
+	textures.clear();
+	TextureCache::getInstance().clear();
+	BufferArena::clearAll();
+	LightBlock::getInstance().clear();
+	renderQueue.clear();
 
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
@@ -1119,7 +1625,7 @@ void cleanUp() {
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
-	glViewport(0, 0, width, height);
+	GLState::getInstance().viewport(0, 0, width, height);
 }
 
 void processInput(GLFWwindow* window, double deltaTime) {
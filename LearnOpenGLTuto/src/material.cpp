@@ -0,0 +1,87 @@
+#include <material.h>
+#include <gl_state.h>
+#include <texture_compression.h>
+#include <utils.h>
+
+#include <glad/glad.h>
+
+Material::Material(const std::vector<Texture>& textures, float shininess)
+	: shininess(shininess) {
+	// Texture name, its feature (0 for the diffuse map every variant samples) and how many were met so far
+	struct Map {
+		const char* name;
+		uint32_t feature;
+		unsigned int count;
+	};
+	Map maps[] = {
+		{ "diffuse", 0, 0 },
+		{ "specular", ShaderFeature::SPECULAR_MAP, 0 },
+		{ "emission", ShaderFeature::EMISSION_MAP, 0 },
+		{ "normal", ShaderFeature::NORMAL_MAP, 0 },
+		{ "height", ShaderFeature::HEIGHT_MAP, 0 }
+	};
+
+	for (const auto& texture : textures) {
+		// Same rule as the compression, a normal map stored as BC5 only has its x and y
+		const std::string& name = isNormalMap(texture.name, texture.path) ? "normal" : texture.name;
+		Map* map = nullptr;
+		for (auto& candidate : maps) {
+			if (name == candidate.name) {
+				map = &candidate;
+			}
+		}
+		// The shaders sample one map of each kind, this keeps the units under LightBlock's
+		if (map == nullptr || map->count++ > 0) {
+			continue;
+		}
+		features |= map->feature;
+
+		Binding binding;
+		binding.unit = (unsigned int)bindings.size();
+		binding.textureID = texture.ID;
+		binding.uniform = std::string("material.") + map->name;
+		bindings.push_back(binding);
+	}
+
+	stateKey = hashBytes(&shininess, sizeof(shininess));
+	for (const auto& binding : bindings) {
+		stateKey = hashBytes(&binding.textureID, sizeof(binding.textureID), stateKey);
+		stateKey = hashBytes(binding.uniform.data(), binding.uniform.size(), stateKey);
+	}
+}
+
+const Material::ProgramLocations& Material::getLocations(const Shader& shader) const {
+	for (const auto& locations : programs) {
+		if (locations.program == shader.ID) {
+			return locations;
+		}
+	}
+
+	ProgramLocations locations;
+	locations.program = shader.ID;
+	for (const auto& binding : bindings) {
+		locations.samplers.push_back(shader.getUniform<int>(binding.uniform));
+	}
+	locations.shininess = shader.getUniform<float>("material.shininess");
+	locations.positionCenter = shader.getUniform<glm::vec3>("positionCenter");
+	locations.positionExtent = shader.getUniform<glm::vec3>("positionExtent");
+	programs.push_back(std::move(locations));
+	return programs.back();
+}
+
+void Material::bind(const Shader& shader) const {
+	if (bindings.empty()) {
+		return;
+	}
+
+	const ProgramLocations& locations = getLocations(shader);
+	for (size_t i = 0; i < bindings.size(); i++) {
+		GLState::getInstance().bindTexture(bindings[i].unit, GL_TEXTURE_2D, bindings[i].textureID);
+		if (locations.samplers[i]) {
+			shader.set(locations.samplers[i], (int)bindings[i].unit);
+		}
+	}
+	if (locations.shininess) {
+		shader.set(locations.shininess, shininess);
+	}
+}
@@ -1,92 +1,196 @@
 #include <mesh.h>
+#include <gl_state.h>
+#include <utils.h>
 
 #include <glad/glad.h>
 
-Mesh::Mesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, const std::vector<Texture>& textures) {
-	this->vertices = vertices;
-	this->indices = indices;
+#include <limits>
+
+LodSelection::LodSelection(const glm::mat4& projection, const glm::mat4& view, float viewportHeight, float errorThreshold, float hysteresis)
+	: viewProjection(projection * view), errorThreshold(errorThreshold), hysteresis(hysteresis) {
+	// Works for the perspective, orthographic and interpolated projections alike
+	pixelScale = projection[1][1] * viewportHeight * 0.5f;
+	perspectiveFactor = glm::abs(projection[2][3]);
+}
+
+MeshView MeshData::getView() const {
+	MeshView view;
+	view.vertices = vertices.data();
+	view.vertexCount = (unsigned int)vertices.size();
+	if (shortIndices.empty()) {
+		view.indices = indices.data();
+		view.indexCount = (unsigned int)indices.size();
+		view.indexSize = sizeof(unsigned int);
+	}
+	else {
+		view.indices = shortIndices.data();
+		view.indexCount = (unsigned int)shortIndices.size();
+		view.indexSize = sizeof(uint16_t);
+	}
+	view.lods = lods.data();
+	view.lodCount = (unsigned int)lods.size();
+	view.meshlets = meshlets.data();
+	view.meshletCount = (unsigned int)meshlets.size();
+	return view;
+}
+
+Mesh::Mesh(const MeshView& data, const std::vector<Texture>& textures, VertexFormat format, VertexFormatError* error) {
+	this->vertexCount = data.vertexCount;
+	this->indexCount = data.indexCount;
 	this->textures = textures;
+	this->format = format;
+	this->indexType = data.indexSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	this->indexSize = data.indexSize;
+
+	if (data.meshletCount > 0) {
+		meshlets.assign(data.meshlets, data.meshlets + data.meshletCount);
+	}
 
-	setupMesh();
+	if (data.lodCount > 0) {
+		lods.assign(data.lods, data.lods + data.lodCount);
+	}
+	else {
+		lods.push_back(MeshLod{ 0, data.indexCount, 0.0f });
+	}
+
+	glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+	for (unsigned int i = 0; i < data.vertexCount; i++) {
+		boundsMin = glm::min(boundsMin, data.vertices[i].Position);
+		boundsMax = glm::max(boundsMax, data.vertices[i].Position);
+	}
+	bounds = data.vertexCount ? BoundingBox{ boundsMin, boundsMax } : BoundingBox();
+	boundsCenter = bounds.getCenter();
+	boundsRadius = glm::length(bounds.getExtent());
+
+	if (format == VertexFormat::Float) {
+		allocation = BufferArena::getInstance(format).allocate(data.vertices, data.vertexCount, data.indices, (size_t)data.indexCount * data.indexSize);
+	}
+	else {
+		setupCompactMesh(data, error);
+	}
 }
 
-void Mesh::setupMesh() {
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
+void Mesh::setupCompactMesh(const MeshView& data, VertexFormatError* error) {
+	std::vector<CompactVertex> vertices = compressVertices(data.vertices, data.vertexCount, format, quantization, error);
+	allocation = BufferArena::getInstance(format).allocate(vertices.data(), data.vertexCount, data.indices, (size_t)data.indexCount * data.indexSize);
+}
 
-	glBindVertexArray(VAO);
+unsigned int Mesh::selectLod(unsigned int currentLod, const glm::mat4& model, const LodSelection& selection) const {
+	float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+	glm::vec4 center = selection.viewProjection * model * glm::vec4(boundsCenter, 1.0f);
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+	// Closest point of the bounding sphere, anything behind the camera gets LOD 0
+	float w = glm::max(center.w - boundsRadius * scale * selection.perspectiveFactor, 1e-3f);
+	float pixelsPerUnit = selection.pixelScale * scale / w;
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+	unsigned int lod = glm::min(currentLod, (unsigned int)lods.size() - 1);
+	while (lod > 0 && lods[lod].error * pixelsPerUnit > selection.errorThreshold) {
+		lod--;
+	}
+	while (lod + 1 < lods.size() && lods[lod + 1].error * pixelsPerUnit < selection.errorThreshold * (1.0f - selection.hysteresis)) {
+		lod++;
+	}
+	return lod;
+}
 
-	// Position
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+void Mesh::bindMaterial(const Shader& shader) const {
+	material.bind(shader);
+	setQuantization(shader);
+}
 
-	// Normal
-	glEnableVertexAttribArray(3);
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+void Mesh::setQuantization(const Shader& shader) const {
+	if (format != VertexFormat::Float) {
+		// Resolved with the samplers the first time the material meets the program
+		const Material::ProgramLocations& locations = material.getLocations(shader);
+		shader.set(locations.positionCenter, quantization.Center);
+		shader.set(locations.positionExtent, quantization.Extent);
+	}
+}
 
-	// TexCoords
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+void Mesh::fillDrawItem(DrawItem& item) const {
+	const ArenaBlock& block = allocation.getBlock();
+	item.vertexArray = allocation.getArena().getVertexArray(block.page);
+	item.material = &material;
+	if (format != VertexFormat::Float) {
+		item.setUniforms = [this](Shader& shader) {
+			setQuantization(shader);
+		};
+		item.uniformKey = hashBytes(&quantization, sizeof(quantization));
+	}
+	item.call.mode = GL_TRIANGLES;
+	item.call.indexType = indexType;
+	item.call.baseVertex = (int)block.baseVertex;
+}
 
-	// Tangent
-	//glEnableVertexAttribArray(3);
-	//glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+void Mesh::Draw(const Shader& shader, unsigned int lod) const {
+	bindMaterial(shader);
 
-	// Bitangent
-	//glEnableVertexAttribArray(4);
-	//glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+	const ArenaBlock& block = allocation.getBlock();
+	allocation.getArena().bind(block.page);
+	const MeshLod& range = lods[lod];
+	glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, indexType, (void*)(block.indexOffset + (size_t)range.indexOffset * indexSize), block.baseVertex);
 
-	glBindVertexArray(0);
+	GLState::getInstance().activeTexture(0);
 }
 
-void Mesh::Draw(Shader shader) const {
-	unsigned int diffuseNumber = 0;
-	unsigned int specularNumber = 0;
-	unsigned int normalNumber = 0;
-	unsigned int heightNumber = 0;
+void Mesh::enqueue(RenderQueue& queue, DrawItem item, unsigned int lod) const {
+	fillDrawItem(item);
+	const MeshLod& range = lods[lod];
+	item.call.count = range.indexCount;
+	item.call.first = allocation.getBlock().indexOffset + (size_t)range.indexOffset * indexSize;
+	queue.add(std::move(item));
+}
 
-	for (unsigned int i = 0; i < textures.size(); i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-		const Texture& texture = textures[i];
-		std::string number;
+unsigned int Mesh::enqueueClusters(RenderQueue& queue, DrawItem item, const LodSelection& selection, ClusterCulling& culling) const {
+	if (meshlets.empty()) {
+		enqueue(queue, std::move(item), 0);
+		return lods[0].indexCount / 3;
+	}
 
-		if (texture.name == "diffuse") {
-			number = std::to_string(diffuseNumber);
-			diffuseNumber++;
-		}
-		else if (texture.name == "specular") {
-			number = std::to_string(specularNumber);
-			specularNumber++;
-		}
-		else if (texture.name == "normal") {
- 			number = std::to_string(normalNumber);
-			normalNumber++;
-			continue;
+	// Frustum straight from the model-view-projection, so it is in object space
+	const glm::mat4& model = item.model;
+	Frustum frustum(selection.viewProjection * model);
+	glm::vec3 cameraPosition = glm::vec3(glm::inverse(model) * glm::vec4(culling.cameraPosition, 1.0f));
+
+	// Visible meshlets next to each other in the index buffer are merged into one range
+	const ArenaBlock& block = allocation.getBlock();
+	drawCounts.clear();
+	drawOffsets.clear();
+	unsigned int visibleTriangleCount = 0;
+	for (const auto& meshlet : meshlets) {
+		bool visible = frustum.intersects(BoundingSphere{ meshlet.center, meshlet.radius });
+		if (visible && culling.backfaceCulling) {
+			glm::vec3 toCenter = meshlet.center - cameraPosition;
+			visible = glm::dot(toCenter, meshlet.coneAxis) < meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius;
 		}
-		else if (texture.name == "height") {
-			number = std::to_string(heightNumber);
-			heightNumber++;
+
+		culling.clusterCount++;
+		culling.triangleCount += meshlet.triangleCount;
+		if (!visible) {
 			continue;
 		}
-		// TODO: else
+		culling.visibleClusterCount++;
+		visibleTriangleCount += meshlet.triangleCount;
 
-		std::string maisnon = ("material." + texture.name + (number == "0" ? "" : number));
-		//std::cout << maisnon << std::endl;
-		shader.setInt(maisnon.c_str(), i);
-		shader.setFloat("material.shininess", 16.0f);
-		glBindTexture(GL_TEXTURE_2D, texture.ID);
+		const void* offset = (const void*)(block.indexOffset + (size_t)meshlet.indexOffset * indexSize);
+		if (!drawCounts.empty() && (const char*)drawOffsets.back() + (size_t)drawCounts.back() * indexSize == offset) {
+			drawCounts.back() += meshlet.triangleCount * 3;
+		}
+		else {
+			drawCounts.push_back(meshlet.triangleCount * 3);
+			drawOffsets.push_back(offset);
+		}
 	}
+	culling.visibleTriangleCount += visibleTriangleCount;
 
- 	glBindVertexArray(VAO);
-	glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+	if (drawCounts.empty()) {
+		return 0;
+	}
 
-	glBindVertexArray(0);
-	glActiveTexture(GL_TEXTURE0);
+	fillDrawItem(item);
+	item.call.rangeCount = (unsigned int)drawCounts.size();
+	item.call.rangeOffset = queue.addRanges(drawCounts.data(), drawOffsets.data(), item.call.rangeCount, (int)block.baseVertex);
+	queue.add(std::move(item));
+	return visibleTriangleCount;
 }
\ No newline at end of file
@@ -0,0 +1,410 @@
+#include <mesh_cache.h>
+#include <utils.h>
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace {
+	uint64_t align16(uint64_t offset) {
+		return (offset + 15) & ~uint64_t(15);
+	}
+
+	void writePadding(std::ofstream& stream, uint64_t& offset) {
+		static const char zeros[16] = {};
+		uint64_t aligned = align16(offset);
+		stream.write(zeros, aligned - offset);
+		offset = aligned;
+	}
+
+	// Same size and either same timestamp or same content, currentTime is the timestamp on disk
+	bool isCurrent(const std::string& path, uint64_t size, int64_t time, uint64_t hash, int64_t& currentTime) {
+		SourceStamp stamp;
+		if (!getSourceStamp(path, stamp) || stamp.size != size) {
+			return false;
+		}
+		currentTime = stamp.time;
+		return stamp.time == time || hashFile(path) == hash;
+	}
+
+	template <typename Index>
+	bool indicesInRange(const unsigned char* data, uint32_t indexCount, uint32_t vertexCount) {
+		const Index* indices = reinterpret_cast<const Index*>(data);
+		for (uint32_t i = 0; i < indexCount; ++i) {
+			if (indices[i] >= vertexCount) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Overwrites timestamps of a cache file in place, at the given file offsets
+	bool writeTimes(const std::string& cachePath, const std::vector<std::pair<uint64_t, int64_t>>& times) {
+		std::fstream stream(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+		for (const auto& time : times) {
+			stream.seekp(time.first);
+			stream.write(reinterpret_cast<const char*>(&time.second), sizeof(time.second));
+		}
+		return (bool)stream;
+	}
+}
+
+std::string MeshCache::getCachePath(const std::string& sourcePath) {
+	return sourcePath + ".meshcache";
+}
+
+bool MeshCache::write(const std::string& sourcePath, unsigned int importFlags, const std::vector<MeshData>& meshes, const std::vector<ModelNode>& nodes,
+	const std::vector<std::string>& dependencies) {
+	SourceStamp stamp;
+	if (!getSourceStamp(sourcePath, stamp)) {
+		return false;
+	}
+
+	MeshCacheHeader cacheHeader = {};
+	cacheHeader.magic = MAGIC;
+	cacheHeader.version = VERSION;
+	cacheHeader.importFlags = importFlags;
+	cacheHeader.meshCount = (uint32_t)meshes.size();
+	cacheHeader.vertexSize = sizeof(Vertex);
+	cacheHeader.sourceSize = stamp.size;
+	cacheHeader.sourceTime = stamp.time;
+	cacheHeader.sourceHash = hashFile(sourcePath);
+
+	// Texture table and string table
+	std::vector<MeshCacheTexture> cacheTextures;
+	std::string stringTable;
+	for (const auto& mesh : meshes) {
+		for (const auto& texture : mesh.textures) {
+			MeshCacheTexture cacheTexture;
+			cacheTexture.nameOffset = (uint32_t)stringTable.size();
+			stringTable.append(texture.name).push_back('\0');
+			cacheTexture.pathOffset = (uint32_t)stringTable.size();
+			stringTable.append(texture.path).push_back('\0');
+			cacheTextures.push_back(cacheTexture);
+		}
+	}
+	cacheHeader.textureCount = (uint32_t)cacheTextures.size();
+
+	std::vector<MeshCacheDependency> cacheDependencies;
+	for (const auto& dependency : dependencies) {
+		SourceStamp dependencyStamp;
+		if (!getSourceStamp(dependency, dependencyStamp)) {
+			return false;
+		}
+		MeshCacheDependency cacheDependency = {};
+		cacheDependency.pathOffset = (uint32_t)stringTable.size();
+		stringTable.append(dependency).push_back('\0');
+		cacheDependency.size = dependencyStamp.size;
+		cacheDependency.time = dependencyStamp.time;
+		cacheDependency.hash = hashFile(dependency);
+		cacheDependencies.push_back(cacheDependency);
+	}
+	cacheHeader.dependencyCount = (uint32_t)cacheDependencies.size();
+
+	std::vector<MeshLod> cacheLods;
+	for (const auto& mesh : meshes) {
+		cacheLods.insert(cacheLods.end(), mesh.lods.begin(), mesh.lods.end());
+	}
+	cacheHeader.lodCount = (uint32_t)cacheLods.size();
+
+	std::vector<Meshlet> cacheMeshlets;
+	for (const auto& mesh : meshes) {
+		cacheMeshlets.insert(cacheMeshlets.end(), mesh.meshlets.begin(), mesh.meshlets.end());
+	}
+	cacheHeader.meshletCount = (uint32_t)cacheMeshlets.size();
+	cacheHeader.nodeCount = (uint32_t)nodes.size();
+
+	// Layout
+	uint64_t offset = align16(sizeof(MeshCacheHeader));
+	offset = align16(offset + meshes.size() * sizeof(MeshCacheEntry));
+	offset = align16(offset + cacheTextures.size() * sizeof(MeshCacheTexture));
+	offset = align16(offset + cacheLods.size() * sizeof(MeshLod));
+	offset = align16(offset + cacheMeshlets.size() * sizeof(Meshlet));
+	offset = align16(offset + nodes.size() * sizeof(ModelNode));
+	offset = align16(offset + cacheDependencies.size() * sizeof(MeshCacheDependency));
+	cacheHeader.stringTableOffset = offset;
+	cacheHeader.stringTableSize = stringTable.size();
+	offset = align16(offset + stringTable.size());
+
+	std::vector<MeshCacheEntry> cacheEntries;
+	uint32_t firstTexture = 0;
+	uint32_t firstLod = 0;
+	uint32_t firstMeshlet = 0;
+	for (const auto& mesh : meshes) {
+		MeshView view = mesh.getView();
+		MeshCacheEntry entry = {};
+		entry.vertexCount = view.vertexCount;
+		entry.indexCount = view.indexCount;
+		entry.indexSize = view.indexSize;
+		entry.firstTexture = firstTexture;
+		entry.textureCount = (uint32_t)mesh.textures.size();
+		entry.firstLod = firstLod;
+		entry.lodCount = view.lodCount;
+		entry.firstMeshlet = firstMeshlet;
+		entry.meshletCount = view.meshletCount;
+		entry.vertexOffset = offset;
+		offset = align16(offset + (uint64_t)view.vertexCount * sizeof(Vertex));
+		entry.indexOffset = offset;
+		offset = align16(offset + (uint64_t)view.indexCount * view.indexSize);
+		firstTexture += entry.textureCount;
+		firstLod += entry.lodCount;
+		firstMeshlet += entry.meshletCount;
+		cacheEntries.push_back(entry);
+	}
+
+	// Write to a temporary file first so a crash never leaves a half-written cache behind
+	std::string cachePath = getCachePath(sourcePath);
+	std::string temporaryPath = cachePath + ".tmp";
+	{
+		std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!stream) {
+			return false;
+		}
+
+		uint64_t written = 0;
+		stream.write(reinterpret_cast<const char*>(&cacheHeader), sizeof(cacheHeader));
+		written += sizeof(cacheHeader);
+		writePadding(stream, written);
+
+		stream.write(reinterpret_cast<const char*>(cacheEntries.data()), cacheEntries.size() * sizeof(MeshCacheEntry));
+		written += cacheEntries.size() * sizeof(MeshCacheEntry);
+		writePadding(stream, written);
+
+		stream.write(reinterpret_cast<const char*>(cacheTextures.data()), cacheTextures.size() * sizeof(MeshCacheTexture));
+		written += cacheTextures.size() * sizeof(MeshCacheTexture);
+		writePadding(stream, written);
+
+		stream.write(reinterpret_cast<const char*>(cacheLods.data()), cacheLods.size() * sizeof(MeshLod));
+		written += cacheLods.size() * sizeof(MeshLod);
+		writePadding(stream, written);
+
+		stream.write(reinterpret_cast<const char*>(cacheMeshlets.data()), cacheMeshlets.size() * sizeof(Meshlet));
+		written += cacheMeshlets.size() * sizeof(Meshlet);
+		writePadding(stream, written);
+
+		stream.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(ModelNode));
+		written += nodes.size() * sizeof(ModelNode);
+		writePadding(stream, written);
+
+		stream.write(reinterpret_cast<const char*>(cacheDependencies.data()), cacheDependencies.size() * sizeof(MeshCacheDependency));
+		written += cacheDependencies.size() * sizeof(MeshCacheDependency);
+		writePadding(stream, written);
+
+		stream.write(stringTable.data(), stringTable.size());
+		written += stringTable.size();
+		writePadding(stream, written);
+
+		for (const auto& mesh : meshes) {
+			MeshView view = mesh.getView();
+			stream.write(reinterpret_cast<const char*>(view.vertices), (uint64_t)view.vertexCount * sizeof(Vertex));
+			written += (uint64_t)view.vertexCount * sizeof(Vertex);
+			writePadding(stream, written);
+
+			stream.write(reinterpret_cast<const char*>(view.indices), (uint64_t)view.indexCount * view.indexSize);
+			written += (uint64_t)view.indexCount * view.indexSize;
+			writePadding(stream, written);
+		}
+
+		if (!stream) {
+			return false;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, cachePath, error);
+	if (error) {
+		std::filesystem::remove(temporaryPath, error);
+		return false;
+	}
+	return true;
+}
+
+bool MeshCache::open(const std::string& sourcePath, unsigned int importFlags) {
+	close();
+
+	if (!file.open(getCachePath(sourcePath))) {
+		return false;
+	}
+
+	header = reinterpret_cast<const MeshCacheHeader*>(file.getData());
+	if (!validate() || header->importFlags != importFlags) {
+		close();
+		return false;
+	}
+
+	// Staleness: the source or any file the import read changed. Files only touched get their new timestamp
+	// written back, the next open then doesn't hash them again
+	std::vector<std::pair<uint64_t, int64_t>> touched;	// file offset of the stored time -> time on disk
+	int64_t currentTime = 0;
+	if (!isCurrent(sourcePath, header->sourceSize, header->sourceTime, header->sourceHash, currentTime)) {
+		close();
+		return false;
+	}
+	if (currentTime != header->sourceTime) {
+		touched.push_back({ offsetof(MeshCacheHeader, sourceTime), currentTime });
+	}
+	for (uint32_t i = 0; i < header->dependencyCount; ++i) {
+		const MeshCacheDependency& dependency = dependencies[i];
+		if (!isCurrent(strings + dependency.pathOffset, dependency.size, dependency.time, dependency.hash, currentTime)) {
+			close();
+			return false;
+		}
+		if (currentTime != dependency.time) {
+			uint64_t offset = reinterpret_cast<const unsigned char*>(&dependency) - file.getData();
+			touched.push_back({ offset + offsetof(MeshCacheDependency, time), currentTime });
+		}
+	}
+
+	if (!touched.empty()) {
+		// Not written through the mapping, which is read only: the file is patched unmapped and mapped again
+		close();
+		std::string cachePath = getCachePath(sourcePath);
+		if (!writeTimes(cachePath, touched)) {
+			std::cout << "WARNING::MESH_CACHE::RESTAMP_FAILED: " << cachePath << std::endl;
+		}
+		if (!file.open(cachePath)) {
+			return false;
+		}
+		header = reinterpret_cast<const MeshCacheHeader*>(file.getData());
+		if (!validate()) {
+			close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void MeshCache::close() {
+	file.close();
+	header = nullptr;
+	entries = nullptr;
+	textures = nullptr;
+	lods = nullptr;
+	meshlets = nullptr;
+	nodes = nullptr;
+	dependencies = nullptr;
+	strings = nullptr;
+}
+
+bool MeshCache::validate() {
+	if (file.getSize() < sizeof(MeshCacheHeader)
+		|| header->magic != MAGIC
+		|| header->version != VERSION
+		|| header->vertexSize != sizeof(Vertex)) {
+		return false;
+	}
+
+	const uint64_t size = file.getSize();
+	uint64_t entriesOffset = align16(sizeof(MeshCacheHeader));
+	uint64_t texturesOffset = align16(entriesOffset + header->meshCount * sizeof(MeshCacheEntry));
+	uint64_t lodsOffset = align16(texturesOffset + header->textureCount * sizeof(MeshCacheTexture));
+	uint64_t meshletsOffset = align16(lodsOffset + header->lodCount * sizeof(MeshLod));
+	uint64_t nodesOffset = align16(meshletsOffset + header->meshletCount * sizeof(Meshlet));
+	uint64_t dependenciesOffset = align16(nodesOffset + header->nodeCount * sizeof(ModelNode));
+	if (dependenciesOffset + header->dependencyCount * sizeof(MeshCacheDependency) > size
+		|| header->stringTableOffset + header->stringTableSize > size) {
+		return false;
+	}
+
+	entries = reinterpret_cast<const MeshCacheEntry*>(file.getData() + entriesOffset);
+	textures = reinterpret_cast<const MeshCacheTexture*>(file.getData() + texturesOffset);
+	lods = reinterpret_cast<const MeshLod*>(file.getData() + lodsOffset);
+	meshlets = reinterpret_cast<const Meshlet*>(file.getData() + meshletsOffset);
+	nodes = reinterpret_cast<const ModelNode*>(file.getData() + nodesOffset);
+	dependencies = reinterpret_cast<const MeshCacheDependency*>(file.getData() + dependenciesOffset);
+	strings = reinterpret_cast<const char*>(file.getData() + header->stringTableOffset);
+
+	for (uint32_t i = 0; i < header->meshCount; ++i) {
+		const MeshCacheEntry& entry = entries[i];
+		if ((entry.indexSize != sizeof(uint16_t) && entry.indexSize != sizeof(unsigned int))
+			|| entry.vertexOffset + (uint64_t)entry.vertexCount * sizeof(Vertex) > size
+			|| entry.indexOffset + (uint64_t)entry.indexCount * entry.indexSize > size
+			|| entry.firstTexture + entry.textureCount > header->textureCount
+			|| entry.firstLod + entry.lodCount > header->lodCount
+			|| entry.firstMeshlet + entry.meshletCount > header->meshletCount) {
+			return false;
+		}
+		// The index buffer goes to the GPU as is, an index past the vertices would read out of the buffer
+		const unsigned char* indices = file.getData() + entry.indexOffset;
+		bool inRange = entry.indexSize == sizeof(uint16_t)
+			? indicesInRange<uint16_t>(indices, entry.indexCount, entry.vertexCount)
+			: indicesInRange<unsigned int>(indices, entry.indexCount, entry.vertexCount);
+		if (!inRange) {
+			return false;
+		}
+		for (uint32_t j = 0; j < entry.lodCount; ++j) {
+			const MeshLod& lod = lods[entry.firstLod + j];
+			if ((uint64_t)lod.indexOffset + lod.indexCount > entry.indexCount) {
+				return false;
+			}
+		}
+		for (uint32_t j = 0; j < entry.meshletCount; ++j) {
+			const Meshlet& meshlet = meshlets[entry.firstMeshlet + j];
+			if ((uint64_t)meshlet.indexOffset + (uint64_t)meshlet.triangleCount * 3 > entry.indexCount) {
+				return false;
+			}
+		}
+	}
+	for (uint32_t i = 0; i < header->nodeCount; ++i) {
+		const ModelNode& node = nodes[i];
+		if ((node.parent != ModelNode::NO_PARENT && node.parent >= i) || node.firstMesh + node.meshCount > header->meshCount) {
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < header->textureCount; ++i) {
+		if (textures[i].nameOffset >= header->stringTableSize || textures[i].pathOffset >= header->stringTableSize) {
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < header->dependencyCount; ++i) {
+		if (dependencies[i].pathOffset >= header->stringTableSize) {
+			return false;
+		}
+	}
+	return header->stringTableSize == 0 || strings[header->stringTableSize - 1] == '\0';
+}
+
+unsigned int MeshCache::getMeshCount() const {
+	return header ? header->meshCount : 0;
+}
+
+MeshView MeshCache::getMesh(unsigned int index) const {
+	const MeshCacheEntry& entry = entries[index];
+
+	MeshView view;
+	view.vertices = reinterpret_cast<const Vertex*>(file.getData() + entry.vertexOffset);
+	view.vertexCount = entry.vertexCount;
+	view.indices = file.getData() + entry.indexOffset;
+	view.indexCount = entry.indexCount;
+	view.indexSize = entry.indexSize;
+	view.lods = lods + entry.firstLod;
+	view.lodCount = entry.lodCount;
+	view.meshlets = meshlets + entry.firstMeshlet;
+	view.meshletCount = entry.meshletCount;
+	return view;
+}
+
+std::vector<Texture> MeshCache::getTextures(unsigned int index) const {
+	const MeshCacheEntry& entry = entries[index];
+
+	std::vector<Texture> result;
+	for (uint32_t i = 0; i < entry.textureCount; ++i) {
+		const MeshCacheTexture& cacheTexture = textures[entry.firstTexture + i];
+		Texture texture;
+		texture.ID = 0;
+		texture.name = strings + cacheTexture.nameOffset;
+		texture.path = strings + cacheTexture.pathOffset;
+		result.push_back(texture);
+	}
+	return result;
+}
+
+unsigned int MeshCache::getNodeCount() const {
+	return header ? header->nodeCount : 0;
+}
+
+const ModelNode& MeshCache::getNode(unsigned int index) const {
+	return nodes[index];
+}
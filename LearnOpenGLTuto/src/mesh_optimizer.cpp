@@ -0,0 +1,826 @@
+#include <mesh_optimizer.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+	// Forsyth, "Linear-Speed Vertex Cache Optimisation"
+	// https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+	const unsigned int FORSYTH_CACHE_SIZE = 32;
+	const float CACHE_DECAY_POWER = 1.5f;
+	const float LAST_TRIANGLE_SCORE = 0.75f;
+	const float VALENCE_BOOST_SCALE = 2.0f;
+	const float VALENCE_BOOST_POWER = 0.5f;
+
+	float getVertexScore(int cachePosition, unsigned int liveTriangles) {
+		if (liveTriangles == 0) {
+			return -1.0f;
+		}
+
+		float score = 0.0f;
+		if (cachePosition >= 0) {
+			if (cachePosition < 3) {
+				// Vertices of the last triangle, fixed score so it isn't reused right away (strips are worse with a FIFO)
+				score = LAST_TRIANGLE_SCORE;
+			}
+			else {
+				float scale = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+				score = std::pow(1.0f - (cachePosition - 3) * scale, CACHE_DECAY_POWER);
+			}
+		}
+
+		// Vertices with few triangles left are favored so they don't end up alone, transformed once more later
+		score += VALENCE_BOOST_SCALE * std::pow((float)liveTriangles, -VALENCE_BOOST_POWER);
+		return score;
+	}
+
+	unsigned int getVertexCount(const std::vector<unsigned int>& indices) {
+		unsigned int vertexCount = 0;
+		for (unsigned int index : indices) {
+			vertexCount = std::max(vertexCount, index + 1);
+		}
+		return vertexCount;
+	}
+
+	// FIFO cache simulation, a vertex is in the cache if fewer than cacheSize misses happened since it was loaded
+	unsigned int countCacheMisses(const std::vector<unsigned int>& indices, unsigned int vertexCount, unsigned int cacheSize) {
+		std::vector<unsigned int> timestamps(vertexCount, 0);
+		unsigned int time = cacheSize + 1;
+		unsigned int misses = 0;
+		for (unsigned int index : indices) {
+			if (time - timestamps[index] > cacheSize) {
+				timestamps[index] = time++;
+				misses++;
+			}
+		}
+		return misses;
+	}
+
+	struct VertexBitsHash {
+		size_t operator()(const Vertex& vertex) const {
+			return (size_t)hashBytes(&vertex, sizeof(Vertex));
+		}
+	};
+
+	struct VertexBitsEqual {
+		bool operator()(const Vertex& a, const Vertex& b) const {
+			return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+		}
+	};
+
+	struct PositionBitsHash {
+		size_t operator()(const glm::vec3& position) const {
+			return (size_t)hashBytes(&position, sizeof(glm::vec3));
+		}
+	};
+
+	struct PositionBitsEqual {
+		bool operator()(const glm::vec3& a, const glm::vec3& b) const {
+			return std::memcmp(&a, &b, sizeof(glm::vec3)) == 0;
+		}
+	};
+
+	// Squared distance to the plane of the triangle, weighted by its area (returned in area) so that slivers don't
+	// weigh as much as large triangles. Summed over the triangles merged into a vertex, divided by the summed areas
+	// it is back to a squared distance
+	glm::dmat4 getPlaneQuadric(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, double& area) {
+		glm::dvec3 normal = glm::cross(glm::dvec3(p1) - glm::dvec3(p0), glm::dvec3(p2) - glm::dvec3(p0));
+		double doubleArea = glm::length(normal);
+		area = doubleArea * 0.5;
+		if (doubleArea == 0.0) {
+			return glm::dmat4(0.0);
+		}
+		normal /= doubleArea;
+		glm::dvec4 plane(normal, -glm::dot(normal, glm::dvec3(p0)));
+		return glm::outerProduct(plane, plane) * area;
+	}
+
+	// Squared distance to the plane through the edge p0 p1 perpendicular to its triangle, weighted by the squared
+	// length of the edge (returned in weight). Keeps a seam on its line while its vertices slide along it
+	glm::dmat4 getEdgeQuadric(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, double& weight) {
+		glm::dvec3 edge = glm::dvec3(p1) - glm::dvec3(p0);
+		glm::dvec3 normal = glm::cross(glm::cross(edge, glm::dvec3(p2) - glm::dvec3(p0)), edge);
+		double length = glm::length(normal);
+		weight = glm::dot(edge, edge);
+		if (length == 0.0) {
+			weight = 0.0;
+			return glm::dmat4(0.0);
+		}
+		normal /= length;
+		glm::dvec4 plane(normal, -glm::dot(normal, glm::dvec3(p0)));
+		return glm::outerProduct(plane, plane) * weight;
+	}
+
+	double evaluateQuadric(const glm::dmat4& quadric, const glm::vec3& position) {
+		glm::dvec4 point(glm::dvec3(position), 1.0);
+		return glm::max(glm::dot(point, quadric * point), 0.0);
+	}
+
+	// Manifold vertices are alone at their position, seam vertices are one of the two sides of a seam running
+	// through, locked ones are on a border or where seams meet
+	enum class VertexKind : uint8_t {
+		Manifold,
+		Seam,
+		Locked
+	};
+
+	uint64_t getEdgeKey(uint64_t a, uint64_t b) {
+		return (a << 32) | b;
+	}
+
+	struct Collapse {
+		unsigned int from;
+		unsigned int to;
+		// The other side of a seam collapse, moved along with from. NO_VERTEX otherwise
+		unsigned int seamFrom;
+		unsigned int seamTo;
+		double cost;	// area weighted, orders the collapses
+		double error;	// squared distance
+
+		static constexpr unsigned int NO_VERTEX = ~0u;
+	};
+
+	Collapse getCollapse(unsigned int from, unsigned int to, unsigned int seamFrom, unsigned int seamTo, const glm::dmat4& quadric, double weight,
+		const glm::vec3& position) {
+		double cost = evaluateQuadric(quadric, position);
+		return Collapse{ from, to, seamFrom, seamTo, cost, weight > 0.0 ? cost / weight : 0.0 };
+	}
+}
+
+float computeACMR(const std::vector<unsigned int>& indices, unsigned int cacheSize) {
+	if (indices.size() < 3) {
+		return 0.0f;
+	}
+	return (float)countCacheMisses(indices, getVertexCount(indices), cacheSize) / (indices.size() / 3);
+}
+
+void weldVertices(MeshData& mesh) {
+	std::unordered_map<Vertex, unsigned int, VertexBitsHash, VertexBitsEqual> uniqueVertices;
+	uniqueVertices.reserve(mesh.vertices.size());
+
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> remap(mesh.vertices.size());
+	for (size_t i = 0; i < mesh.vertices.size(); i++) {
+		auto inserted = uniqueVertices.emplace(mesh.vertices[i], (unsigned int)vertices.size());
+		if (inserted.second) {
+			vertices.push_back(mesh.vertices[i]);
+		}
+		remap[i] = inserted.first->second;
+	}
+
+	for (auto& index : mesh.indices) {
+		index = remap[index];
+	}
+	mesh.vertices.swap(vertices);
+}
+
+void optimizeVertexCache(std::vector<unsigned int>& indices, unsigned int vertexCount) {
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) {
+		return;
+	}
+
+	// Triangles using each vertex, the live ones are kept at the front of each range
+	std::vector<unsigned int> liveTriangles(vertexCount, 0);
+	for (unsigned int index : indices) {
+		liveTriangles[index]++;
+	}
+	std::vector<unsigned int> adjacencyOffsets(vertexCount + 1, 0);
+	for (unsigned int i = 0; i < vertexCount; i++) {
+		adjacencyOffsets[i + 1] = adjacencyOffsets[i] + liveTriangles[i];
+	}
+	std::vector<unsigned int> adjacency(indices.size());
+	{
+		std::vector<unsigned int> cursors(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++) {
+			adjacency[cursors[indices[i]]++] = (unsigned int)(i / 3);
+		}
+	}
+
+	std::vector<int> cachePositions(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (unsigned int i = 0; i < vertexCount; i++) {
+		vertexScores[i] = getVertexScore(-1, liveTriangles[i]);
+	}
+
+	std::vector<float> triangleScores(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	for (size_t i = 0; i < triangleCount; i++) {
+		triangleScores[i] = vertexScores[indices[i * 3]] + vertexScores[indices[i * 3 + 1]] + vertexScores[indices[i * 3 + 2]];
+	}
+
+	std::vector<unsigned int> result;
+	result.reserve(indices.size());
+	std::vector<unsigned int> cache;
+	std::vector<unsigned int> newCache;
+	cache.reserve(FORSYTH_CACHE_SIZE + 3);
+	newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+	long long bestTriangle = std::max_element(triangleScores.begin(), triangleScores.end()) - triangleScores.begin();
+	size_t inputCursor = 0;
+
+	for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+		// Nothing left around the cache, carry on with the next triangle in input order
+		if (bestTriangle < 0) {
+			while (emitted[inputCursor]) {
+				inputCursor++;
+			}
+			bestTriangle = (long long)inputCursor;
+		}
+
+		const unsigned int* triangle = &indices[bestTriangle * 3];
+		result.insert(result.end(), triangle, triangle + 3);
+		emitted[bestTriangle] = true;
+
+		// The emitted triangle goes to the front of the cache, everything else moves back
+		newCache.clear();
+		for (int i = 0; i < 3; i++) {
+			unsigned int vertex = triangle[i];
+			newCache.push_back(vertex);
+
+			unsigned int* begin = &adjacency[adjacencyOffsets[vertex]];
+			unsigned int* end = begin + liveTriangles[vertex];
+			unsigned int* position = std::find(begin, end, (unsigned int)bestTriangle);
+			std::swap(*position, *(end - 1));
+			liveTriangles[vertex]--;
+		}
+		for (unsigned int vertex : cache) {
+			if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2]) {
+				newCache.push_back(vertex);
+			}
+		}
+
+		for (size_t i = 0; i < newCache.size(); i++) {
+			unsigned int vertex = newCache[i];
+			cachePositions[vertex] = i < FORSYTH_CACHE_SIZE ? (int)i : -1;
+			vertexScores[vertex] = getVertexScore(cachePositions[vertex], liveTriangles[vertex]);
+		}
+
+		// Only triangles touching the cache changed score, the best one among them goes next
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+		for (unsigned int vertex : newCache) {
+			const unsigned int* begin = &adjacency[adjacencyOffsets[vertex]];
+			for (unsigned int i = 0; i < liveTriangles[vertex]; i++) {
+				unsigned int adjacent = begin[i];
+				const unsigned int* adjacentTriangle = &indices[adjacent * 3];
+				float score = vertexScores[adjacentTriangle[0]] + vertexScores[adjacentTriangle[1]] + vertexScores[adjacentTriangle[2]];
+				triangleScores[adjacent] = score;
+				if (score > bestScore) {
+					bestScore = score;
+					bestTriangle = adjacent;
+				}
+			}
+		}
+
+		if (newCache.size() > FORSYTH_CACHE_SIZE) {
+			newCache.resize(FORSYTH_CACHE_SIZE);
+		}
+		cache.swap(newCache);
+	}
+
+	indices.swap(result);
+}
+
+// Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (the overdraw half of Tipsify)
+void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, float threshold) {
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount < 2) {
+		return;
+	}
+
+	// Clusters start where the cache simulation misses all three vertices: moving them around barely costs anything
+	const unsigned int cacheSize = 16;
+	std::vector<size_t> clusterStarts;
+	{
+		std::vector<unsigned int> timestamps(vertices.size(), 0);
+		unsigned int time = cacheSize + 1;
+		for (size_t i = 0; i < triangleCount; i++) {
+			unsigned int misses = 0;
+			for (int j = 0; j < 3; j++) {
+				unsigned int index = indices[i * 3 + j];
+				if (time - timestamps[index] > cacheSize) {
+					timestamps[index] = time++;
+					misses++;
+				}
+			}
+			if (misses == 3 || i == 0) {
+				clusterStarts.push_back(i);
+			}
+		}
+	}
+	if (clusterStarts.size() < 2) {
+		return;
+	}
+	clusterStarts.push_back(triangleCount);
+
+	// Outward facing clusters far from the center are likely in front of the others, they are drawn first
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	std::vector<glm::vec3> clusterCentroids(clusterStarts.size() - 1, glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormals(clusterStarts.size() - 1, glm::vec3(0.0f));
+	for (size_t cluster = 0; cluster + 1 < clusterStarts.size(); cluster++) {
+		float clusterArea = 0.0f;
+		for (size_t i = clusterStarts[cluster]; i < clusterStarts[cluster + 1]; i++) {
+			const glm::vec3& p0 = vertices[indices[i * 3]].Position;
+			const glm::vec3& p1 = vertices[indices[i * 3 + 1]].Position;
+			const glm::vec3& p2 = vertices[indices[i * 3 + 2]].Position;
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			glm::vec3 centroid = (p0 + p1 + p2) / 3.0f;
+
+			clusterCentroids[cluster] += centroid * area;
+			clusterNormals[cluster] += normal;
+			clusterArea += area;
+			meshCentroid += centroid * area;
+			meshArea += area;
+		}
+		if (clusterArea > 0.0f) {
+			clusterCentroids[cluster] /= clusterArea;
+		}
+	}
+	if (meshArea > 0.0f) {
+		meshCentroid /= meshArea;
+	}
+
+	std::vector<float> sortKeys(clusterCentroids.size());
+	std::vector<unsigned int> clusterOrder(clusterCentroids.size());
+	for (size_t cluster = 0; cluster < clusterCentroids.size(); cluster++) {
+		float normalLength = glm::length(clusterNormals[cluster]);
+		sortKeys[cluster] = normalLength > 0.0f ? glm::dot(clusterCentroids[cluster] - meshCentroid, clusterNormals[cluster] / normalLength) : 0.0f;
+		clusterOrder[cluster] = (unsigned int)cluster;
+	}
+	std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&sortKeys](unsigned int a, unsigned int b) { return sortKeys[a] > sortKeys[b]; });
+
+	std::vector<unsigned int> result;
+	result.reserve(indices.size());
+	for (unsigned int cluster : clusterOrder) {
+		result.insert(result.end(), indices.begin() + clusterStarts[cluster] * 3, indices.begin() + clusterStarts[cluster + 1] * 3);
+	}
+
+	if (computeACMR(result, cacheSize) <= computeACMR(indices, cacheSize) * threshold) {
+		indices.swap(result);
+	}
+}
+
+void optimizeVertexFetch(MeshData& mesh) {
+	const unsigned int unused = std::numeric_limits<unsigned int>::max();
+	std::vector<unsigned int> remap(mesh.vertices.size(), unused);
+	std::vector<Vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+
+	// Vertices no index refers to are dropped along the way
+	for (auto& index : mesh.indices) {
+		if (remap[index] == unused) {
+			remap[index] = (unsigned int)vertices.size();
+			vertices.push_back(mesh.vertices[index]);
+		}
+		index = remap[index];
+	}
+	mesh.vertices.swap(vertices);
+}
+
+std::vector<unsigned int> simplifyMesh(const std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, size_t targetIndexCount, float maxError, float* resultError) {
+	const unsigned int vertexCount = (unsigned int)vertices.size();
+	std::vector<unsigned int> result(indices);
+	double reachedError = 0.0;
+
+	// Vertices sharing a position but not their attributes are seams, their topology is looked at through positions.
+	// wedges links the vertices of a position in a ring
+	std::vector<unsigned int> positionIds(vertexCount);
+	std::vector<unsigned int> positionUses;
+	std::vector<unsigned int> wedges(vertexCount);
+	{
+		std::unordered_map<glm::vec3, unsigned int, PositionBitsHash, PositionBitsEqual> uniquePositions;
+		uniquePositions.reserve(vertexCount);
+		std::vector<unsigned int> firstWedges;
+		for (unsigned int i = 0; i < vertexCount; i++) {
+			auto inserted = uniquePositions.emplace(vertices[i].Position, (unsigned int)positionUses.size());
+			if (inserted.second) {
+				positionUses.push_back(0);
+				firstWedges.push_back(i);
+			}
+			positionIds[i] = inserted.first->second;
+			positionUses[positionIds[i]]++;
+			unsigned int& first = firstWedges[positionIds[i]];
+			wedges[i] = first == i ? i : wedges[first];
+			wedges[first] = i;
+		}
+	}
+
+	// Half edges between vertices: across a seam the triangles don't share their vertices, the edge is open on both sides
+	std::unordered_set<uint64_t> halfEdges;
+	auto buildHalfEdges = [&halfEdges](const std::vector<unsigned int>& triangles) {
+		halfEdges.clear();
+		halfEdges.reserve(triangles.size());
+		for (size_t i = 0; i < triangles.size(); i++) {
+			halfEdges.insert(getEdgeKey(triangles[i], triangles[i - i % 3 + (i + 1) % 3]));
+		}
+	};
+	auto isOpen = [&halfEdges](unsigned int a, unsigned int b) {
+		return halfEdges.count(getEdgeKey(a, b)) != halfEdges.count(getEdgeKey(b, a));
+	};
+	buildHalfEdges(indices);
+
+	// Borders: edges with a single triangle, locked
+	std::vector<VertexKind> kinds(vertexCount, VertexKind::Manifold);
+	{
+		std::unordered_map<uint64_t, unsigned int> edgeUses;
+		edgeUses.reserve(indices.size());
+		for (size_t i = 0; i < indices.size(); i++) {
+			uint64_t a = positionIds[indices[i]];
+			uint64_t b = positionIds[indices[i - i % 3 + (i + 1) % 3]];
+			edgeUses[a < b ? getEdgeKey(a, b) : getEdgeKey(b, a)]++;
+		}
+		std::vector<bool> borderPositions(positionUses.size(), false);
+		for (size_t i = 0; i < indices.size(); i++) {
+			uint64_t a = positionIds[indices[i]];
+			uint64_t b = positionIds[indices[i - i % 3 + (i + 1) % 3]];
+			if (edgeUses[a < b ? getEdgeKey(a, b) : getEdgeKey(b, a)] == 1) {
+				borderPositions[a] = borderPositions[b] = true;
+			}
+		}
+
+		// A seam runs through a position with two vertices when each has one open edge coming in and one going out
+		std::vector<unsigned int> openEdgesIn(vertexCount, 0);
+		std::vector<unsigned int> openEdgesOut(vertexCount, 0);
+		for (size_t i = 0; i < indices.size(); i++) {
+			unsigned int a = indices[i];
+			unsigned int b = indices[i - i % 3 + (i + 1) % 3];
+			if (halfEdges.count(getEdgeKey(b, a)) == 0) {
+				openEdgesOut[a]++;
+				openEdgesIn[b]++;
+			}
+		}
+		for (unsigned int i = 0; i < vertexCount; i++) {
+			unsigned int position = positionIds[i];
+			if (borderPositions[position]) {
+				kinds[i] = VertexKind::Locked;
+			}
+			else if (positionUses[position] > 1) {
+				unsigned int other = wedges[i];
+				bool seam = positionUses[position] == 2
+					&& openEdgesIn[i] == 1 && openEdgesOut[i] == 1 && openEdgesIn[other] == 1 && openEdgesOut[other] == 1;
+				kinds[i] = seam ? VertexKind::Seam : VertexKind::Locked;
+			}
+		}
+	}
+
+	std::vector<glm::dmat4> quadrics(vertexCount, glm::dmat4(0.0));
+	std::vector<double> quadricWeights(vertexCount, 0.0);
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		double area;
+		glm::dmat4 quadric = getPlaneQuadric(vertices[indices[i]].Position, vertices[indices[i + 1]].Position, vertices[indices[i + 2]].Position, area);
+		for (size_t k = i; k < i + 3; k++) {
+			quadrics[indices[k]] += quadric;
+			quadricWeights[indices[k]] += area;
+		}
+		// Open edges (seams, borders) also hold their vertices on the line of the edge
+		for (size_t k = i; k < i + 3; k++) {
+			unsigned int a = indices[k];
+			unsigned int b = indices[i + (k - i + 1) % 3];
+			if (!isOpen(a, b)) {
+				continue;
+			}
+			double weight;
+			glm::dmat4 edgeQuadric = getEdgeQuadric(vertices[a].Position, vertices[b].Position, vertices[indices[i + (k - i + 2) % 3]].Position, weight);
+			quadrics[a] += edgeQuadric;
+			quadrics[b] += edgeQuadric;
+			quadricWeights[a] += weight;
+			quadricWeights[b] += weight;
+		}
+	}
+
+	const double maxSquaredError = (double)maxError * maxError;
+	std::vector<unsigned int> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+	std::vector<Collapse> collapses;
+	std::vector<unsigned int> adjacencyOffsets(vertexCount + 1);
+	std::vector<unsigned int> adjacency;
+
+	// A seam vertex only moves along its seam, onto the next vertex of the seam, and the other side of the seam moves
+	// with it onto the vertex across from that one
+	auto addCollapse = [&](unsigned int from, unsigned int to) {
+		if (kinds[from] == VertexKind::Manifold) {
+			collapses.push_back(getCollapse(from, to, Collapse::NO_VERTEX, Collapse::NO_VERTEX, quadrics[from] + quadrics[to],
+				quadricWeights[from] + quadricWeights[to], vertices[to].Position));
+			return;
+		}
+		if (kinds[from] != VertexKind::Seam || !isOpen(from, to)) {
+			return;
+		}
+		// to itself when the seam ends there, the two sides then meet on it
+		unsigned int seamFrom = wedges[from];
+		unsigned int seamTo = to;
+		while (!isOpen(seamFrom, seamTo)) {
+			seamTo = wedges[seamTo];
+			if (seamTo == to) {
+				return;
+			}
+		}
+		glm::dmat4 quadric = quadrics[from] + quadrics[seamFrom] + quadrics[to] + (seamTo != to ? quadrics[seamTo] : glm::dmat4(0.0));
+		double weight = quadricWeights[from] + quadricWeights[seamFrom] + quadricWeights[to] + (seamTo != to ? quadricWeights[seamTo] : 0.0);
+		collapses.push_back(getCollapse(from, to, seamFrom, seamTo, quadric, weight, vertices[to].Position));
+	};
+
+	// Triangles around from must not flip once it moves onto to, counts the ones removed
+	auto checkFan = [&](unsigned int from, unsigned int to, unsigned int& removed) {
+		const glm::vec3& target = vertices[to].Position;
+		for (unsigned int j = adjacencyOffsets[from]; j < adjacencyOffsets[from + 1]; j++) {
+			const unsigned int* triangle = &result[adjacency[j] * 3];
+			if (triangle[0] == to || triangle[1] == to || triangle[2] == to) {
+				removed++;
+				continue;
+			}
+			glm::vec3 p[3];
+			glm::vec3 q[3];
+			for (int k = 0; k < 3; k++) {
+				p[k] = vertices[triangle[k]].Position;
+				q[k] = triangle[k] == from ? target : p[k];
+			}
+			glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+			glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+			if (glm::dot(before, after) <= 0.0f) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	auto applyCollapse = [&](unsigned int from, unsigned int to) {
+		remap[from] = to;
+		quadrics[to] += quadrics[from];
+		quadricWeights[to] += quadricWeights[from];
+		for (unsigned int j = adjacencyOffsets[from]; j < adjacencyOffsets[from + 1]; j++) {
+			const unsigned int* triangle = &result[adjacency[j] * 3];
+			touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+		}
+	};
+
+	// Each pass collapses the cheapest edges, at most one collapse per neighborhood so the checks stay valid
+	while (result.size() > targetIndexCount) {
+		buildHalfEdges(result);
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i++) {
+			unsigned int a = result[i];
+			unsigned int b = result[i - i % 3 + (i + 1) % 3];
+			addCollapse(a, b);
+			addCollapse(b, a);
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (unsigned int index : result) {
+			adjacencyOffsets[index + 1]++;
+		}
+		for (unsigned int i = 0; i < vertexCount; i++) {
+			adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+		}
+		adjacency.resize(result.size());
+		{
+			std::vector<unsigned int> cursors(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < result.size(); i++) {
+				adjacency[cursors[result[i]]++] = (unsigned int)(i / 3);
+			}
+		}
+
+		for (unsigned int i = 0; i < vertexCount; i++) {
+			remap[i] = i;
+		}
+		std::fill(touched.begin(), touched.end(), false);
+
+		const size_t trianglesToRemove = (result.size() - targetIndexCount + 2) / 3;
+		size_t trianglesRemoved = 0;
+		for (const auto& collapse : collapses) {
+			if (trianglesRemoved >= trianglesToRemove) {
+				break;
+			}
+			bool seam = collapse.seamFrom != Collapse::NO_VERTEX;
+			// Ordered by cost, a larger area can still be closer
+			if (collapse.error > maxSquaredError || touched[collapse.from] || touched[collapse.to]
+				|| (seam && (touched[collapse.seamFrom] || touched[collapse.seamTo]))) {
+				continue;
+			}
+
+			unsigned int removedHere = 0;
+			if (!checkFan(collapse.from, collapse.to, removedHere) || (seam && !checkFan(collapse.seamFrom, collapse.seamTo, removedHere)) || removedHere == 0) {
+				continue;
+			}
+
+			applyCollapse(collapse.from, collapse.to);
+			if (seam) {
+				applyCollapse(collapse.seamFrom, collapse.seamTo);
+			}
+			reachedError = glm::max(reachedError, collapse.error);
+			trianglesRemoved += removedHere;
+		}
+
+		if (trianglesRemoved == 0) {
+			break;
+		}
+
+		size_t writeIndex = 0;
+		for (size_t i = 0; i < result.size(); i += 3) {
+			unsigned int a = remap[result[i]];
+			unsigned int b = remap[result[i + 1]];
+			unsigned int c = remap[result[i + 2]];
+			if (a != b && b != c && c != a) {
+				result[writeIndex++] = a;
+				result[writeIndex++] = b;
+				result[writeIndex++] = c;
+			}
+		}
+		result.resize(writeIndex);
+	}
+
+	if (resultError) {
+		*resultError = (float)std::sqrt(reachedError);
+	}
+	return result;
+}
+
+void generateLods(MeshData& mesh, MeshOptimizationStats* stats, unsigned int maxLodCount) {
+	const size_t minTriangleCount = 32;
+	const float maxRelativeError = 0.05f;
+
+	std::vector<unsigned int> lod0(mesh.indices);
+	mesh.lods.clear();
+	mesh.lods.push_back(MeshLod{ 0, (unsigned int)lod0.size(), 0.0f });
+
+	glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+	for (const auto& vertex : mesh.vertices) {
+		boundsMin = glm::min(boundsMin, vertex.Position);
+		boundsMax = glm::max(boundsMax, vertex.Position);
+	}
+	float radius = mesh.vertices.empty() ? 0.0f : glm::length(boundsMax - boundsMin) * 0.5f;
+
+	// Always simplified from LOD 0 so that errors don't pile up from one LOD to the next
+	size_t previousIndexCount = lod0.size();
+	for (unsigned int level = 1; level < maxLodCount; level++) {
+		size_t targetIndexCount = (previousIndexCount / 3 / 2) * 3;
+		if (targetIndexCount < minTriangleCount * 3) {
+			break;
+		}
+
+		float error = 0.0f;
+		std::vector<unsigned int> lod = simplifyMesh(lod0, mesh.vertices, targetIndexCount, radius * maxRelativeError, &error);
+		if (lod.size() * 10 > previousIndexCount * 9) {
+			break;
+		}
+		optimizeVertexCache(lod, (unsigned int)mesh.vertices.size());
+
+		mesh.lods.push_back(MeshLod{ (unsigned int)mesh.indices.size(), (unsigned int)lod.size(), error });
+		mesh.indices.insert(mesh.indices.end(), lod.begin(), lod.end());
+		previousIndexCount = lod.size();
+
+		if (stats) {
+			stats->lodTriangleCount += (unsigned int)(lod.size() / 3);
+		}
+	}
+
+	if (stats) {
+		stats->lodCount += (unsigned int)mesh.lods.size();
+	}
+}
+
+void buildMeshlets(MeshData& mesh, MeshOptimizationStats* stats, unsigned int maxVertices, unsigned int maxTriangles) {
+	mesh.meshlets.clear();
+
+	// The index order comes out of optimizeVertexCache, cutting it in sequence already gives compact clusters
+	// and lets each meshlet be a plain range of the index buffer
+	const std::vector<unsigned int>& indices = mesh.indices;
+	const unsigned int unused = std::numeric_limits<unsigned int>::max();
+	std::vector<unsigned int> meshletOfVertex(mesh.vertices.size(), unused);
+	std::vector<unsigned int> meshletVertices;
+
+	auto finishMeshlet = [&](unsigned int indexOffset, unsigned int triangleCount) {
+		Meshlet meshlet;
+		meshlet.indexOffset = indexOffset;
+		meshlet.triangleCount = triangleCount;
+		meshlet.vertexCount = (unsigned int)meshletVertices.size();
+
+		glm::vec3 boundsMin(std::numeric_limits<float>::max());
+		glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+		for (unsigned int vertex : meshletVertices) {
+			boundsMin = glm::min(boundsMin, mesh.vertices[vertex].Position);
+			boundsMax = glm::max(boundsMax, mesh.vertices[vertex].Position);
+		}
+		meshlet.center = (boundsMin + boundsMax) * 0.5f;
+		meshlet.radius = 0.0f;
+		for (unsigned int vertex : meshletVertices) {
+			meshlet.radius = glm::max(meshlet.radius, glm::length(mesh.vertices[vertex].Position - meshlet.center));
+		}
+
+		// Normal cone: every triangle faces within the cone half angle of the axis
+		std::vector<glm::vec3> normals;
+		glm::vec3 normalSum(0.0f);
+		for (unsigned int i = indexOffset; i < indexOffset + triangleCount * 3; i += 3) {
+			const glm::vec3& p0 = mesh.vertices[indices[i]].Position;
+			glm::vec3 normal = glm::cross(mesh.vertices[indices[i + 1]].Position - p0, mesh.vertices[indices[i + 2]].Position - p0);
+			float length = glm::length(normal);
+			if (length > 0.0f) {
+				normals.push_back(normal / length);
+				normalSum += normals.back();
+			}
+		}
+		meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+		meshlet.coneCutoff = 1.0f;
+		float axisLength = glm::length(normalSum);
+		if (axisLength > 0.0f) {
+			meshlet.coneAxis = normalSum / axisLength;
+			float minDot = 1.0f;
+			for (const auto& normal : normals) {
+				minDot = glm::min(minDot, glm::dot(normal, meshlet.coneAxis));
+			}
+			if (minDot > 0.0f) {
+				meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+			}
+		}
+
+		mesh.meshlets.push_back(meshlet);
+		meshletVertices.clear();
+	};
+
+	unsigned int lod0IndexCount = mesh.lods.empty() ? (unsigned int)indices.size() : mesh.lods[0].indexCount;
+	unsigned int meshletStart = 0;
+	unsigned int meshletTriangles = 0;
+	for (unsigned int i = 0; i + 2 < lod0IndexCount; i += 3) {
+		const unsigned int current = (unsigned int)mesh.meshlets.size();
+		unsigned int a = indices[i];
+		unsigned int b = indices[i + 1];
+		unsigned int c = indices[i + 2];
+		unsigned int newVertices = (meshletOfVertex[a] != current)
+			+ (meshletOfVertex[b] != current && b != a)
+			+ (meshletOfVertex[c] != current && c != a && c != b);
+		if (meshletTriangles > 0 && (meshletVertices.size() + newVertices > maxVertices || meshletTriangles + 1 > maxTriangles)) {
+			finishMeshlet(meshletStart, meshletTriangles);
+			meshletStart = i;
+			meshletTriangles = 0;
+		}
+
+		for (int j = 0; j < 3; j++) {
+			unsigned int vertex = indices[i + j];
+			if (meshletOfVertex[vertex] != (unsigned int)mesh.meshlets.size()) {
+				meshletOfVertex[vertex] = (unsigned int)mesh.meshlets.size();
+				meshletVertices.push_back(vertex);
+			}
+		}
+		meshletTriangles++;
+	}
+	if (meshletTriangles > 0) {
+		finishMeshlet(meshletStart, meshletTriangles);
+	}
+
+	if (stats) {
+		stats->meshletCount += (unsigned int)mesh.meshlets.size();
+	}
+}
+
+bool packIndices(MeshData& mesh) {
+	if (mesh.vertices.size() >= 65536) {
+		return false;
+	}
+
+	mesh.shortIndices.assign(mesh.indices.begin(), mesh.indices.end());
+	mesh.indices.clear();
+	mesh.indices.shrink_to_fit();
+	return true;
+}
+
+void optimizeMesh(MeshData& mesh, MeshOptimizationStats* stats) {
+	const unsigned int cacheSize = 16;
+	if (stats) {
+		stats->meshCount++;
+		stats->triangleCount += (unsigned int)(mesh.indices.size() / 3);
+		stats->vertexCountBefore += (unsigned int)mesh.vertices.size();
+		stats->transformsBefore += countCacheMisses(mesh.indices, (unsigned int)mesh.vertices.size(), cacheSize);
+	}
+
+	weldVertices(mesh);
+	optimizeVertexCache(mesh.indices, (unsigned int)mesh.vertices.size());
+	optimizeOverdraw(mesh.indices, mesh.vertices);
+	optimizeVertexFetch(mesh);
+
+	if (stats) {
+		stats->vertexCountAfter += (unsigned int)mesh.vertices.size();
+		stats->transformsAfter += countCacheMisses(mesh.indices, (unsigned int)mesh.vertices.size(), cacheSize);
+	}
+}
+
+void MeshOptimizationStats::print(const std::string& name) const {
+	double triangles = triangleCount ? (double)triangleCount : 1.0;
+	double vertices = vertexCountAfter ? (double)vertexCountAfter : 1.0;
+	std::cout << "Mesh optimization " << name << ": " << meshCount << " meshes, " << triangleCount << " triangles, "
+		<< shortIndexMeshCount << " with 16-bit indices" << std::endl
+		<< "  vertices " << vertexCountBefore << " -> " << vertexCountAfter << std::endl
+		<< "  meshlets " << meshletCount << ", LODs " << lodCount << " (" << (meshCount ? (float)lodCount / meshCount : 0.0f) << " per mesh), " << lodTriangleCount << " extra triangles" << std::endl
+		<< "  ACMR " << transformsBefore / triangles << " -> " << transformsAfter / triangles
+		<< ", ATVR " << transformsBefore / vertices << " -> " << transformsAfter / vertices << std::endl;
+}
@@ -0,0 +1,425 @@
+#include <mipmap.h>
+#include <gl_state.h>
+#include <texture_compression.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIPMAP_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define MIPMAP_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+	// Core in 4.2 only, the glad loader stops at 3.3
+	typedef void (APIENTRYP TexStorage2DProc)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+	TexStorage2DProc texStorage2D = nullptr;
+
+	const float NORMAL_SCALE = 1.0f / 510.0f;	// sum of 4 texels to [-1, 1] once 1 is subtracted
+
+	struct SRGBTables {
+		float toLinear[256];
+		unsigned char fromLinear[4096];		// 12 bits are enough to tell sRGB 0 from 1
+
+		SRGBTables() {
+			for (int i = 0; i < 256; i++) {
+				float value = i / 255.0f;
+				toLinear[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+			}
+			for (int i = 0; i < 4096; i++) {
+				float value = i / 4095.0f;
+				float encoded = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+				fromLinear[i] = (unsigned char)std::lrint(glm::clamp(encoded, 0.0f, 1.0f) * 255.0f);
+			}
+		}
+	};
+
+	const SRGBTables& getSRGBTables() {
+		static const SRGBTables tables;
+		return tables;
+	}
+
+	void filterTexel(const unsigned char* t0, const unsigned char* t1, const unsigned char* t2, const unsigned char* t3, MipFilter filter, unsigned char* output) {
+		for (int channel = 0; channel < 4; channel++) {
+			output[channel] = (unsigned char)((t0[channel] + t1[channel] + t2[channel] + t3[channel] + 2) >> 2);
+		}
+
+		if (filter == MipFilter::SRGB) {
+			const SRGBTables& tables = getSRGBTables();
+			for (int channel = 0; channel < 3; channel++) {
+				float linear = (tables.toLinear[t0[channel]] + tables.toLinear[t1[channel]] + tables.toLinear[t2[channel]] + tables.toLinear[t3[channel]]) * 0.25f;
+				output[channel] = tables.fromLinear[std::lrint(linear * 4095.0f)];
+			}
+		}
+		else if (filter == MipFilter::Normal) {
+			// Same operations in the same order as the SSE2 version, both give the same bytes
+			float normal[3];
+			for (int channel = 0; channel < 3; channel++) {
+				normal[channel] = (float)(t0[channel] + t1[channel] + t2[channel] + t3[channel]) * NORMAL_SCALE - 1.0f;
+			}
+			float lengthSquared = normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2];
+			if (lengthSquared > 1e-12f) {
+				float inverseLength = 1.0f / std::sqrt(lengthSquared);
+				for (float& component : normal) {
+					component *= inverseLength;
+				}
+			}
+			else {
+				normal[0] = normal[1] = 0.0f;
+				normal[2] = 1.0f;
+			}
+			for (int channel = 0; channel < 3; channel++) {
+				output[channel] = (unsigned char)std::lrint(glm::clamp((normal[channel] + 1.0f) * 127.5f, 0.0f, 255.0f));
+			}
+		}
+	}
+
+	void downsampleRow(const unsigned char* row0, const unsigned char* row1, unsigned int width, unsigned int firstTexel, unsigned int mipWidth, MipFilter filter, unsigned char* output) {
+		for (unsigned int x = firstTexel; x < mipWidth; x++) {
+			unsigned int x0 = std::min(x * 2, width - 1);
+			unsigned int x1 = std::min(x * 2 + 1, width - 1);
+			filterTexel(row0 + x0 * 4, row0 + x1 * 4, row1 + x0 * 4, row1 + x1 * 4, filter, output + x * 4);
+		}
+	}
+
+#ifdef MIPMAP_SSE2
+	// 8 texels of two rows to the 16-bit sums of 4 output texels, 2 per register
+	void sumQuads(const unsigned char* row0, const unsigned char* row1, __m128i& sum01, __m128i& sum23) {
+		const __m128i zero = _mm_setzero_si128();
+		__m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0));
+		__m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 16));
+		__m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1));
+		__m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 16));
+
+		// Vertical sums of texels 0-1, 2-3, 4-5 and 6-7, then horizontal sums of the pairs
+		__m128i v0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+		__m128i v1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+		__m128i v2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+		__m128i v3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+		sum01 = _mm_add_epi16(_mm_unpacklo_epi64(v0, v1), _mm_unpackhi_epi64(v0, v1));
+		sum23 = _mm_add_epi16(_mm_unpacklo_epi64(v2, v3), _mm_unpackhi_epi64(v2, v3));
+	}
+
+	__m128i averageQuads(__m128i sum01, __m128i sum23) {
+		const __m128i rounding = _mm_set1_epi16(2);
+		__m128i average01 = _mm_srli_epi16(_mm_add_epi16(sum01, rounding), 2);
+		__m128i average23 = _mm_srli_epi16(_mm_add_epi16(sum23, rounding), 2);
+		return _mm_packus_epi16(average01, average23);
+	}
+
+	__m128i renormalizeQuads(__m128i sum01, __m128i sum23, __m128i average) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 scale = _mm_set1_ps(NORMAL_SCALE);
+
+		// Texels to x, y, z rows
+		__m128 x = _mm_cvtepi32_ps(_mm_unpacklo_epi16(sum01, zero));
+		__m128 y = _mm_cvtepi32_ps(_mm_unpackhi_epi16(sum01, zero));
+		__m128 z = _mm_cvtepi32_ps(_mm_unpacklo_epi16(sum23, zero));
+		__m128 w = _mm_cvtepi32_ps(_mm_unpackhi_epi16(sum23, zero));
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+
+		x = _mm_sub_ps(_mm_mul_ps(x, scale), one);
+		y = _mm_sub_ps(_mm_mul_ps(y, scale), one);
+		z = _mm_sub_ps(_mm_mul_ps(z, scale), one);
+		__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+		__m128 valid = _mm_cmpgt_ps(lengthSquared, _mm_set1_ps(1e-12f));
+		__m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+		x = _mm_and_ps(valid, _mm_mul_ps(x, inverseLength));
+		y = _mm_and_ps(valid, _mm_mul_ps(y, inverseLength));
+		z = _mm_or_ps(_mm_and_ps(valid, _mm_mul_ps(z, inverseLength)), _mm_andnot_ps(valid, one));
+
+		const __m128 half = _mm_set1_ps(127.5f);
+		const __m128 maxValue = _mm_set1_ps(255.0f);
+		x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(x, one), half), _mm_setzero_ps()), maxValue);
+		y = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(y, one), half), _mm_setzero_ps()), maxValue);
+		z = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(z, one), half), _mm_setzero_ps()), maxValue);
+		w = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+
+		__m128i normals = _mm_packus_epi16(
+			_mm_packs_epi32(_mm_cvtps_epi32(x), _mm_cvtps_epi32(y)),
+			_mm_packs_epi32(_mm_cvtps_epi32(z), _mm_cvtps_epi32(w)));
+		// Alpha is a plain average
+		const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+		return _mm_or_si128(normals, _mm_and_si128(average, alphaMask));
+	}
+#endif
+
+#ifdef MIPMAP_AVX2
+	// 16 texels of two rows to 8 output texels
+	__m256i averageOctets(const unsigned char* row0, const unsigned char* row1) {
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i rounding = _mm256_set1_epi16(2);
+		__m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0));
+		__m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + 32));
+		__m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1));
+		__m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + 32));
+
+		// Unpacks stay within 128-bit lanes: texels 0-3 and 4-7 of each load are summed apart
+		__m256i v0 = _mm256_add_epi16(_mm256_unpacklo_epi8(a0, zero), _mm256_unpacklo_epi8(b0, zero));
+		__m256i v1 = _mm256_add_epi16(_mm256_unpackhi_epi8(a0, zero), _mm256_unpackhi_epi8(b0, zero));
+		__m256i v2 = _mm256_add_epi16(_mm256_unpacklo_epi8(a1, zero), _mm256_unpacklo_epi8(b1, zero));
+		__m256i v3 = _mm256_add_epi16(_mm256_unpackhi_epi8(a1, zero), _mm256_unpackhi_epi8(b1, zero));
+		__m256i sum0 = _mm256_add_epi16(_mm256_unpacklo_epi64(v0, v1), _mm256_unpackhi_epi64(v0, v1));
+		__m256i sum1 = _mm256_add_epi16(_mm256_unpacklo_epi64(v2, v3), _mm256_unpackhi_epi64(v2, v3));
+		__m256i average0 = _mm256_srli_epi16(_mm256_add_epi16(sum0, rounding), 2);
+		__m256i average1 = _mm256_srli_epi16(_mm256_add_epi16(sum1, rounding), 2);
+
+		// Outputs come out as 0-1, 4-5, 2-3, 6-7
+		return _mm256_permute4x64_epi64(_mm256_packus_epi16(average0, average1), _MM_SHUFFLE(3, 1, 2, 0));
+	}
+#endif
+}
+
+MipFilter getMipFilter(bool gamma, TextureCompression compression) {
+	if (compression == TextureCompression::BC5) {
+		return MipFilter::Normal;
+	}
+	return gamma ? MipFilter::SRGB : MipFilter::Linear;
+}
+
+const char* getMipFilterName(MipFilter filter) {
+	switch (filter) {
+	case MipFilter::SRGB:
+		return "sRGB";
+	case MipFilter::Normal:
+		return "Normal";
+	default:
+		return "Linear";
+	}
+}
+
+unsigned int getMipCount(unsigned int width, unsigned int height) {
+	unsigned int count = 1;
+	while (width > 1 || height > 1) {
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+		count++;
+	}
+	return count;
+}
+
+std::vector<unsigned char> expandToRGBA8(const unsigned char* data, unsigned int width, unsigned int height, int channelsNumber) {
+	const size_t texelCount = (size_t)width * height;
+	std::vector<unsigned char> rgba(texelCount * 4);
+	if (channelsNumber == 4) {
+		std::memcpy(rgba.data(), data, rgba.size());
+		return rgba;
+	}
+
+	for (size_t i = 0; i < texelCount; i++) {
+		const unsigned char* texel = data + i * channelsNumber;
+		unsigned char* output = &rgba[i * 4];
+		switch (channelsNumber) {
+		case 1:
+			output[0] = output[1] = output[2] = texel[0];
+			output[3] = 255;
+			break;
+		case 2:
+			output[0] = output[1] = output[2] = texel[0];
+			output[3] = texel[1];
+			break;
+		default:
+			output[0] = texel[0];
+			output[1] = texel[1];
+			output[2] = texel[2];
+			output[3] = 255;
+			break;
+		}
+	}
+	return rgba;
+}
+
+void downsampleRGBA8Scalar(const unsigned char* source, unsigned int width, unsigned int height, MipFilter filter, unsigned char* destination) {
+	unsigned int mipWidth = std::max(1u, width / 2);
+	unsigned int mipHeight = std::max(1u, height / 2);
+	for (unsigned int y = 0; y < mipHeight; y++) {
+		const unsigned char* row0 = source + (size_t)std::min(y * 2, height - 1) * width * 4;
+		const unsigned char* row1 = source + (size_t)std::min(y * 2 + 1, height - 1) * width * 4;
+		downsampleRow(row0, row1, width, 0, mipWidth, filter, destination + (size_t)y * mipWidth * 4);
+	}
+}
+
+void downsampleRGBA8(const unsigned char* source, unsigned int width, unsigned int height, MipFilter filter, unsigned char* destination) {
+	unsigned int mipWidth = std::max(1u, width / 2);
+	unsigned int mipHeight = std::max(1u, height / 2);
+	for (unsigned int y = 0; y < mipHeight; y++) {
+		const unsigned char* row0 = source + (size_t)std::min(y * 2, height - 1) * width * 4;
+		const unsigned char* row1 = source + (size_t)std::min(y * 2 + 1, height - 1) * width * 4;
+		unsigned char* output = destination + (size_t)y * mipWidth * 4;
+
+		// Pairs of source texels never need clamping below mipWidth unless width is 1
+		// sRGB goes through lookup tables, which don't vectorize without gathers
+		unsigned int x = 0;
+		if (width >= 2 && filter != MipFilter::SRGB) {
+#ifdef MIPMAP_AVX2
+			if (filter == MipFilter::Linear) {
+				for (; x + 8 <= mipWidth; x += 8) {
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(output + x * 4), averageOctets(row0 + x * 8, row1 + x * 8));
+				}
+			}
+#endif
+#ifdef MIPMAP_SSE2
+			for (; x + 4 <= mipWidth; x += 4) {
+				__m128i sum01, sum23;
+				sumQuads(row0 + x * 8, row1 + x * 8, sum01, sum23);
+				__m128i average = averageQuads(sum01, sum23);
+				if (filter == MipFilter::Normal) {
+					average = renormalizeQuads(sum01, sum23, average);
+				}
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(output + x * 4), average);
+			}
+#endif
+		}
+		downsampleRow(row0, row1, width, x, mipWidth, filter, output);
+	}
+}
+
+void buildMipChain(const unsigned char* rgba, unsigned int width, unsigned int height, MipFilter filter, std::vector<unsigned char>& data, std::vector<MipLevel>& levels) {
+	levels.clear();
+	size_t totalSize = 0;
+	for (unsigned int level = 0, mipWidth = width, mipHeight = height; level < getMipCount(width, height); level++) {
+		MipLevel mip;
+		mip.width = mipWidth;
+		mip.height = mipHeight;
+		mip.offset = totalSize;
+		mip.size = (size_t)mipWidth * mipHeight * 4;
+		levels.push_back(mip);
+		totalSize += mip.size;
+		mipWidth = std::max(1u, mipWidth / 2);
+		mipHeight = std::max(1u, mipHeight / 2);
+	}
+
+	data.resize(totalSize);
+	std::memcpy(data.data(), rgba, levels[0].size);
+	for (size_t level = 1; level < levels.size(); level++) {
+		const MipLevel& previous = levels[level - 1];
+		downsampleRGBA8(&data[previous.offset], previous.width, previous.height, filter, &data[levels[level].offset]);
+	}
+}
+
+void initMipmaps() {
+	GLint major = 0;
+	GLint minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (major > 4 || (major == 4 && minor >= 2) || hasGLExtension("GL_ARB_texture_storage")) {
+		texStorage2D = reinterpret_cast<TexStorage2DProc>(glfwGetProcAddress("glTexStorage2D"));
+	}
+	if (!texStorage2D) {
+		std::cout << "WARNING::MIPMAP::NO_TEXTURE_STORAGE: mip chains are uploaded level by level" << std::endl;
+	}
+}
+
+unsigned int uploadMipChain(const TextureImage& image, bool gamma) {
+	unsigned int textureID;
+	glGenTextures(1, &textureID);
+	GLState::getInstance().bindTexture(GL_TEXTURE_2D, textureID);
+
+	GLenum internalFormat = gamma ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+	GLsizei levelCount = (GLsizei)image.mips.size();
+	if (texStorage2D) {
+		texStorage2D(GL_TEXTURE_2D, levelCount, internalFormat, image.mips[0].width, image.mips[0].height);
+		for (GLsizei level = 0; level < levelCount; level++) {
+			const MipLevel& mip = image.mips[level];
+			glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, mip.width, mip.height, GL_RGBA, GL_UNSIGNED_BYTE, image.mipData.data() + mip.offset);
+		}
+	}
+	else {
+		for (GLsizei level = 0; level < levelCount; level++) {
+			const MipLevel& mip = image.mips[level];
+			glTexImage2D(GL_TEXTURE_2D, level, internalFormat, mip.width, mip.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.mipData.data() + mip.offset);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	return textureID;
+}
+
+void MipmapBenchmark::print(const std::string& name) const {
+	double megaTexels = texelCount / 1000000.0;
+	std::cout << "Mipmaps of " << name << ": " << textureCount << " textures, " << megaTexels << " Mtexels" << std::endl
+		<< "  glGenerateMipmap " << driverMs << " ms (GL thread)" << std::endl
+		<< "  CPU scalar " << scalarMs << " ms, " << (scalarMs > 0.0 ? megaTexels * 1000.0 / scalarMs : 0.0) << " Mtexels/s" << std::endl
+		<< "  CPU SIMD " << simdMs << " ms, " << (simdMs > 0.0 ? megaTexels * 1000.0 / simdMs : 0.0) << " Mtexels/s (worker threads)" << std::endl;
+}
+
+namespace {
+	typedef void (*DownsampleFunction)(const unsigned char*, unsigned int, unsigned int, MipFilter, unsigned char*);
+
+	double timeMipChain(std::vector<unsigned char>& data, const std::vector<MipLevel>& levels, MipFilter filter, DownsampleFunction downsample) {
+		auto start = std::chrono::steady_clock::now();
+		for (size_t level = 1; level < levels.size(); level++) {
+			const MipLevel& previous = levels[level - 1];
+			downsample(&data[previous.offset], previous.width, previous.height, filter, &data[levels[level].offset]);
+		}
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+MipmapBenchmark benchmarkMipmaps(const std::string& folderPath) {
+	MipmapBenchmark benchmark;
+	std::error_code error;
+	for (const auto& entry : std::filesystem::directory_iterator(folderPath, error)) {
+		std::string extension = entry.path().extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+		if (extension != ".png" && extension != ".jpg" && extension != ".jpeg" && extension != ".tga") {
+			continue;
+		}
+
+		int width, height, channelsNumber;
+		std::unique_ptr<unsigned char, stbiDeleter> data(stbi_load(entry.path().string().c_str(), &width, &height, &channelsNumber, 4));
+		if (!data) {
+			continue;
+		}
+		std::string fileName = entry.path().filename().string();
+		// Filtered as the loader would for a mesh: specular maps are data, the others diffuse maps
+		std::string typeName = fileName.find("_spec") != std::string::npos ? "specular" : "diffuse";
+		MipFilter filter = getMipFilter(isColorMap(typeName), getTextureCompression(typeName, fileName));
+
+		// Driver: level 0 is uploaded outside of the measure, only the generation is timed
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		GLState::getInstance().bindTexture(GL_TEXTURE_2D, textureID);
+		glTexImage2D(GL_TEXTURE_2D, 0, filter == MipFilter::SRGB ? GL_SRGB8_ALPHA8 : GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.get());
+		glFinish();
+		auto start = std::chrono::steady_clock::now();
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glFinish();
+		double driverMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		GLState::getInstance().onDeleteTexture(textureID);
+		glDeleteTextures(1, &textureID);
+
+		// CPU: the chain is allocated once, both builders then fill it in place
+		std::vector<unsigned char> mipData;
+		std::vector<MipLevel> levels;
+		buildMipChain(data.get(), width, height, filter, mipData, levels);
+
+		double scalarMs = timeMipChain(mipData, levels, filter, downsampleRGBA8Scalar);
+		double simdMs = timeMipChain(mipData, levels, filter, downsampleRGBA8);
+
+		std::cout << "  " << fileName << " " << width << "x" << height << " " << getMipFilterName(filter) << ": driver " << driverMs
+			<< " ms, scalar " << scalarMs << " ms, SIMD " << simdMs << " ms" << std::endl;
+		benchmark.textureCount++;
+		benchmark.texelCount += (size_t)width * height;
+		benchmark.driverMs += driverMs;
+		benchmark.scalarMs += scalarMs;
+		benchmark.simdMs += simdMs;
+	}
+	return benchmark;
+}
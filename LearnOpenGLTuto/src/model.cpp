@@ -1,52 +1,318 @@
 #include <model.h>
+#include <mesh_cache.h>
+#include <mesh_optimizer.h>
+#include <texture_loader.h>
 #include <utils.h>
 
+#include <assimp/DefaultIOSystem.h>
 #include <assimp/matrix4x4.h>
 
-Model::Model(const std::string& path) {
-	loadModel(path);
+#include <algorithm>
+#include <limits>
+
+namespace {
+	// Notes the files an import opens besides the source, the material library of an OBJ for one
+	class RecordingIOSystem : public Assimp::DefaultIOSystem
+	{
+	public:
+		RecordingIOSystem(const std::string& sourcePath, std::vector<std::string>& opened)
+			: sourcePath(sourcePath), opened(opened) {
+		}
+
+		Assimp::IOStream* Open(const char* file, const char* mode) override {
+			Assimp::IOStream* stream = DefaultIOSystem::Open(file, mode);
+			if (stream && file != sourcePath && std::find(opened.begin(), opened.end(), file) == opened.end()) {
+				opened.push_back(file);
+			}
+			return stream;
+		}
+
+	private:
+		std::string sourcePath;
+		std::vector<std::string>& opened;
+	};
+}
+
+Model::Model(const std::string& path, VertexFormat vertexFormat)
+	: vertexFormat(vertexFormat) {
+	std::unique_ptr<ModelData> data = loadData(path);
+	if (data) {
+		TextureLoader textureLoader;
+		upload(*data, textureLoader, std::chrono::steady_clock::time_point::max());
+	}
+}
+
+Model::~Model() {
+	meshes.clear();
 }
 
 void Model::Draw(const Shader& shader) {
 	for (const auto& mesh : meshes) {
 		mesh.Draw(shader);
 	}
+	BufferArena::unbind();
+}
+
+unsigned int Model::enqueue(RenderQueue& queue, ShaderVariants& variants, uint32_t lightFeatures, const glm::mat4& model, float depth,
+	const LodSelection& selection, ClusterCulling* culling, FrustumCulling* frustumCulling) {
+	meshLods.resize(meshes.size(), 0);
+	if (frustumCulling && !frustumCulling->isVisible(getBounds(), model)) {
+		return 0;
+	}
+	hierarchy.update();
+
+	unsigned int triangleCount = 0;
+	for (size_t i = 0; i < meshes.size(); i++) {
+		glm::mat4 meshModel = model * hierarchy.getWorld(meshNodes[i]);
+		if (frustumCulling && !frustumCulling->isVisible(meshes[i].getBounds(), meshModel)) {
+			continue;
+		}
+
+		DrawItem item;
+		item.shader = &variants.get(lightFeatures | meshes[i].getMaterialFeatures());
+		item.model = meshModel;
+		item.depth = depth;
+
+		meshLods[i] = meshes[i].selectLod(meshLods[i], meshModel, selection);
+		if (culling && meshLods[i] == 0 && meshes[i].hasMeshlets()) {
+			triangleCount += meshes[i].enqueueClusters(queue, std::move(item), selection, *culling);
+		}
+		else {
+			meshes[i].enqueue(queue, std::move(item), meshLods[i]);
+			triangleCount += meshes[i].getLod(meshLods[i]).indexCount / 3;
+		}
+	}
+	return triangleCount;
+}
+
+unsigned int Model::enqueueInstances(RenderQueue& queue, ShaderVariants& variants, uint32_t lightFeatures, const glm::mat4* models,
+	unsigned int instanceCount, unsigned int nearestInstance, float depth, const LodSelection& selection) {
+	if (instanceCount == 0) {
+		return 0;
+	}
+	instancedMeshLods.resize(meshes.size(), 0);
+	hierarchy.update();
+
+	// Meshes whose node leaves them where the model is share the instances as given, the others get their own copy
+	const unsigned int NO_INSTANCES = ~0u;
+	unsigned int sharedFirstInstance = NO_INSTANCES;
+	std::vector<glm::mat4> meshModels;
+
+	unsigned int triangleCount = 0;
+	for (size_t i = 0; i < meshes.size(); i++) {
+		const glm::mat4& meshTransform = hierarchy.getWorld(meshNodes[i]);
+		unsigned int firstInstance;
+		if (meshTransform == glm::mat4(1.0f)) {
+			if (sharedFirstInstance == NO_INSTANCES) {
+				sharedFirstInstance = queue.addInstances(models, instanceCount);
+			}
+			firstInstance = sharedFirstInstance;
+		}
+		else {
+			meshModels.resize(instanceCount);
+			for (unsigned int j = 0; j < instanceCount; j++) {
+				meshModels[j] = models[j] * meshTransform;
+			}
+			firstInstance = queue.addInstances(meshModels.data(), instanceCount);
+		}
+
+		DrawItem item;
+		item.shader = &variants.get(lightFeatures | meshes[i].getMaterialFeatures() | ShaderFeature::INSTANCED);
+		item.depth = depth;
+		item.call.firstInstance = firstInstance;
+		item.call.instanceCount = instanceCount;
+
+		// Not kept in meshLods, the single instance draws of the model have their own hysteresis
+		instancedMeshLods[i] = meshes[i].selectLod(instancedMeshLods[i], models[nearestInstance] * meshTransform, selection);
+		meshes[i].enqueue(queue, std::move(item), instancedMeshLods[i]);
+		triangleCount += meshes[i].getLod(instancedMeshLods[i]).indexCount / 3 * instanceCount;
+	}
+	return triangleCount;
+}
+
+std::unique_ptr<ModelData> Model::loadData(const std::string& path) {
+	std::unique_ptr<ModelData> data = std::make_unique<ModelData>();
+	data->path = path;
+	data->directory = path.substr(0, path.find_last_of('/'));
+
+	if (data->cache.open(path, IMPORT_FLAGS)) {
+		// Vertex and index data will go from the mapping to the GPU without any intermediate copy
+		for (unsigned int i = 0; i < data->cache.getMeshCount(); i++) {
+			data->meshViews.push_back(data->cache.getMesh(i));
+			data->meshTextures.push_back(data->cache.getTextures(i));
+		}
+		for (unsigned int i = 0; i < data->cache.getNodeCount(); i++) {
+			data->nodes.push_back(data->cache.getNode(i));
+		}
+	}
+	else {
+		std::vector<std::string> dependencies;
+		Assimp::Importer importer;
+		// Owned by the importer
+		importer.SetIOHandler(new RecordingIOSystem(path, dependencies));
+		const aiScene* scene = importer.ReadFile(path, IMPORT_FLAGS);
+
+		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+			std::cout << "ERROR:ASSIMP::" << importer.GetErrorString() << std::endl;
+			return nullptr;
+		}
+
+		processNode(scene->mRootNode, scene, ModelNode::NO_PARENT, data->meshesData, data->nodes);
+
+		// Done once here, the cache then stores the optimized meshes
+		MeshOptimizationStats optimizationStats;
+		for (auto& meshData : data->meshesData) {
+			optimizeMesh(meshData, &optimizationStats);
+			buildMeshlets(meshData, &optimizationStats);
+			generateLods(meshData, &optimizationStats);
+			if (packIndices(meshData)) {
+				optimizationStats.shortIndexMeshCount++;
+			}
+		}
+		optimizationStats.print(path);
+
+		for (const auto& meshData : data->meshesData) {
+			data->meshViews.push_back(meshData.getView());
+			data->meshTextures.push_back(meshData.textures);
+		}
+
+		if (!MeshCache::write(path, IMPORT_FLAGS, data->meshesData, data->nodes, dependencies)) {
+			std::cout << "WARNING::MESH_CACHE::WRITE_FAILED: " << MeshCache::getCachePath(path) << std::endl;
+		}
+	}
+
+	if (data->nodes.empty()) {
+		data->nodes.push_back({ glm::mat4(1.0f), ModelNode::NO_PARENT, 0, (uint32_t)data->meshViews.size(), 0 });
+	}
+
+	// Bounds, for placeholders while the model uploads: each mesh's box goes through its node and the ancestors
+	data->boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	data->boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+	std::vector<glm::mat4> nodeTransforms(data->nodes.size());
+	for (size_t i = 0; i < data->nodes.size(); i++) {
+		const ModelNode& node = data->nodes[i];
+		nodeTransforms[i] = node.parent == ModelNode::NO_PARENT ? node.transform : nodeTransforms[node.parent] * node.transform;
+		for (uint32_t mesh = node.firstMesh; mesh < node.firstMesh + node.meshCount; mesh++) {
+			const MeshView& view = data->meshViews[mesh];
+			if (view.vertexCount == 0) {
+				continue;
+			}
+			BoundingBox box{ view.vertices[0].Position, view.vertices[0].Position };
+			for (unsigned int j = 1; j < view.vertexCount; j++) {
+				box.min = glm::min(box.min, view.vertices[j].Position);
+				box.max = glm::max(box.max, view.vertices[j].Position);
+			}
+			box = box.transform(nodeTransforms[i]);
+			data->boundsMin = glm::min(data->boundsMin, box.min);
+			data->boundsMax = glm::max(data->boundsMax, box.max);
+		}
+	}
+	if (data->meshViews.empty()) {
+		data->boundsMin = data->boundsMax = glm::vec3(0.0f);
+	}
+
+	return data;
 }
 
-void Model::loadModel(const std::string& path) {
-	Assimp::Importer importer;
-	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_CalcTangentSpace);
+bool Model::upload(ModelData& data, TextureLoader& textureLoader, std::chrono::steady_clock::time_point deadline) {
+	// First call: images decode on the workers while the GL thread uploads the vertex data
+	if (meshes.empty()) {
+		directory = data.directory;
+		boundsMin = data.boundsMin;
+		boundsMax = data.boundsMax;
+		hierarchy.clear();
+		hierarchy.reserve(data.nodes.size());
+		meshNodes.assign(data.meshViews.size(), 0);
+		for (const auto& node : data.nodes) {
+			uint32_t index = hierarchy.addNode(node.transform, node.parent);
+			std::fill(meshNodes.begin() + node.firstMesh, meshNodes.begin() + node.firstMesh + node.meshCount, index);
+		}
+		hierarchy.update();
+		for (const auto& textures : data.meshTextures) {
+			for (const auto& texture : textures) {
+				textureLoader.request(directory, texture.path, isColorMap(texture.name), getTextureCompression(texture.name, texture.path));
+			}
+		}
+	}
+
+	// At least one step per call so the upload always progresses
+	while (meshes.size() < data.meshViews.size()) {
+		size_t index = meshes.size();
+		meshes.push_back(Mesh(data.meshViews[index], data.meshTextures[index], vertexFormat, &vertexFormatError));
+		if (std::chrono::steady_clock::now() >= deadline) {
+			return false;
+		}
+	}
 
-	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-		std::cout << "ERROR:ASSIMP::" << importer.GetErrorString() << std::endl;
+	if (deadline == std::chrono::steady_clock::time_point::max()) {
+		textureLoader.uploadAll();
 	}
+	while (!textureLoader.isDone()) {
+		if (textureLoader.uploadReady(1) == 0 || std::chrono::steady_clock::now() >= deadline) {
+			return false;
+		}
+	}
+
+	resolveTextures(textureLoader);
 
-	directory = path.substr(0, path.find_last_of('/'));
-	processNode(scene->mRootNode, scene);
+	if (vertexFormat != VertexFormat::Float) {
+		std::cout << data.path << ": ";
+		vertexFormatError.print(vertexFormat);
+	}
+	return true;
 }
 
-void Model::processNode(aiNode* node, const aiScene* scene) {
+void Model::resolveTextures(const TextureLoader& textureLoader) {
+	for (auto& mesh : meshes) {
+		for (auto& texture : mesh.textures) {
+			TextureHandle handle = textureLoader.getTexture(texture.path);
+			texture.ID = handle.getID();
+			texturesLoaded.push_back(std::move(handle));
+		}
+		mesh.buildMaterial();
+	}
+}
+
+void Model::processNode(aiNode* node, const aiScene* scene, uint32_t parent, std::vector<MeshData>& meshesData, std::vector<ModelNode>& nodes) {
+	// aiMatrix4x4 is row major, glm takes columns
+	const aiMatrix4x4& transform = node->mTransformation;
+	ModelNode modelNode = {};
+	modelNode.transform = glm::mat4(
+		transform.a1, transform.b1, transform.c1, transform.d1,
+		transform.a2, transform.b2, transform.c2, transform.d2,
+		transform.a3, transform.b3, transform.c3, transform.d3,
+		transform.a4, transform.b4, transform.c4, transform.d4);
+	modelNode.parent = parent;
+	modelNode.firstMesh = (uint32_t)meshesData.size();
+	modelNode.meshCount = node->mNumMeshes;
+	uint32_t index = (uint32_t)nodes.size();
+	nodes.push_back(modelNode);
+
 	// Process Meshes
 	for (unsigned int i = 0; i < node->mNumMeshes; i++) {
 		unsigned int meshIndex = node->mMeshes[i];
 		aiMesh* mesh = scene->mMeshes[meshIndex];
-		meshes.push_back(processMesh(mesh, scene));
+		meshesData.push_back(processMesh(mesh, scene));
 	}
 
 	// Process Nodes
 	for (unsigned int i = 0; i < node->mNumChildren; i++) {
-		processNode(node->mChildren[i], scene);
+		processNode(node->mChildren[i], scene, index, meshesData, nodes);
 	}
 }
 
-Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene) {
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
-	std::vector<Texture> textures;
+MeshData Model::processMesh(aiMesh* mesh, const aiScene* scene) {
+	MeshData meshData;
+	std::vector<Vertex>& vertices = meshData.vertices;
+	std::vector<unsigned int>& indices = meshData.indices;
+	std::vector<Texture>& textures = meshData.textures;
+
+	vertices.reserve(mesh->mNumVertices);
+	indices.reserve(mesh->mNumFaces * 3);
 
 	// Vertices
 	for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
-		Vertex vertex;
+		Vertex vertex = {};
 
 		// https://community.khronos.org/t/opengl-axis/61722
 		vertex.Position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
@@ -89,9 +355,12 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene) {
 
 		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "height");
 		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+
+		std::vector<Texture> emissionMaps = loadMaterialTextures(material, aiTextureType_EMISSIVE, "emission");
+		textures.insert(textures.end(), emissionMaps.begin(), emissionMaps.end());
 	}
 
-	return Mesh(vertices, indices, textures);
+	return meshData;
 }
 
 std::vector<Texture> Model::loadMaterialTextures(aiMaterial* material, aiTextureType type, std::string typeName) {
@@ -99,22 +368,13 @@ std::vector<Texture> Model::loadMaterialTextures(aiMaterial* material, aiTexture
 	for (unsigned int i = 0; i < material->GetTextureCount(type); i++) {
 		aiString str;
 		material->GetTexture(type, i, &str);
-		bool skip = false;
-		for (unsigned int j = 0; j < texturesLoaded.size(); j++) {
-			if (std::strcmp(texturesLoaded[j].path.c_str(), str.C_Str()) == 0) {
-				textures.push_back(texturesLoaded[j]);
-				skip = true;
-				break;
-			}
-		}
-		if (!skip) {
-			Texture texture;
-			texture.ID = createTexture(directory, str.C_Str());
-			texture.name = typeName;
-			texture.path = str.C_Str();
-			textures.push_back(texture);
-			texturesLoaded.push_back(texture);
-		}
+
+		// Loaded later, all at once, see resolveTextures
+		Texture texture;
+		texture.ID = 0;
+		texture.name = typeName;
+		texture.path = str.C_Str();
+		textures.push_back(texture);
 	}
 	return textures;
 }
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include <model_handle.h>
+
+#include <chrono>
+#include <iostream>
+
+ModelHandle::ModelHandle(const std::string& path, VertexFormat vertexFormat, ThreadPool& pool)
+	: path(path), vertexFormat(vertexFormat) {
+	pendingData = pool.submit([path]() { return Model::loadData(path); });
+}
+
+ModelHandle::~ModelHandle() {
+	// The import keeps running on its worker, wait for it rather than leave it writing into a dead future
+	if (pendingData.valid()) {
+		pendingData.wait();
+	}
+}
+
+void ModelHandle::update(double budgetMilliseconds) {
+	if (ready || failed) {
+		return;
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(budgetMilliseconds));
+
+	if (!data) {
+		if (pendingData.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			return;
+		}
+		data = pendingData.get();
+		if (!data) {
+			std::cout << "ERROR::MODEL_HANDLE::LOAD_FAILED: " << path << std::endl;
+			failed = true;
+			return;
+		}
+		textureLoader = std::make_unique<TextureLoader>();
+		model.reset(new Model(vertexFormat));
+	}
+
+	if (model->upload(*data, *textureLoader, deadline)) {
+		ready = true;
+
+		// CPU copies (or the cache mapping) aren't needed anymore
+		data.reset();
+		textureLoader.reset();
+	}
+}
+
+glm::vec3 ModelHandle::getBoundsMin() const {
+	if (ready) {
+		return model->getBoundsMin();
+	}
+	return data ? data->boundsMin : glm::vec3(0.0f);
+}
+
+glm::vec3 ModelHandle::getBoundsMax() const {
+	if (ready) {
+		return model->getBoundsMax();
+	}
+	return data ? data->boundsMax : glm::vec3(0.0f);
+}
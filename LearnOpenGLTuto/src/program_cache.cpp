@@ -0,0 +1,171 @@
+#include <program_cache.h>
+#include <utils.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// ARB_get_program_binary, core in 4.1 only: the glad loader stops at 3.3
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+namespace {
+	typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+	typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+	typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+	GetProgramBinaryProc getProgramBinary = nullptr;
+	ProgramBinaryProc programBinary = nullptr;
+	ProgramParameteriProc programParameteri = nullptr;
+
+	std::string getString(GLenum name) {
+		const char* text = reinterpret_cast<const char*>(glGetString(name));
+		return text ? text : "";
+	}
+}
+
+ProgramCache& ProgramCache::getInstance() {
+	static ProgramCache instance;
+	return instance;
+}
+
+std::string ProgramCache::getCachePath(const std::string& vertexPath, const std::string& fragmentPath, const std::string& variant) {
+	std::string path = vertexPath + "." + std::filesystem::path(fragmentPath).filename().string();
+	if (!variant.empty()) {
+		path += "." + variant;
+	}
+	return path + ".progbin";
+}
+
+void ProgramCache::init() {
+	GLint major = 0;
+	GLint minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (major > 4 || (major == 4 && minor >= 1) || hasGLExtension("GL_ARB_get_program_binary")) {
+		getProgramBinary = reinterpret_cast<GetProgramBinaryProc>(glfwGetProcAddress("glGetProgramBinary"));
+		programBinary = reinterpret_cast<ProgramBinaryProc>(glfwGetProcAddress("glProgramBinary"));
+		programParameteri = reinterpret_cast<ProgramParameteriProc>(glfwGetProcAddress("glProgramParameteri"));
+	}
+
+	GLint formatCount = 0;
+	if (getProgramBinary && programBinary && programParameteri) {
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	}
+	enabled = formatCount > 0;
+	if (!enabled) {
+		std::cout << "WARNING::PROGRAM_CACHE::NO_PROGRAM_BINARY: programs are built from source on every run" << std::endl;
+		return;
+	}
+
+	std::string driver = getString(GL_VENDOR) + "\n" + getString(GL_RENDERER) + "\n" + getString(GL_VERSION);
+	driverHash = hashBytes(driver.data(), driver.size());
+}
+
+unsigned int ProgramCache::load(const std::string& cachePath, uint64_t sourceHash) {
+	if (!enabled) {
+		return 0;
+	}
+
+	std::ifstream stream(cachePath, std::ios::binary | std::ios::ate);
+	if (!stream) {
+		stats.misses++;
+		return 0;
+	}
+	uint64_t fileSize = (uint64_t)stream.tellg();
+	stream.seekg(0);
+
+	ProgramBinaryHeader header;
+	std::vector<char> binary;
+	stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+	// The size comes from disk: a truncated or corrupt file must not get to allocate it
+	bool valid = stream
+		&& sizeof(header) + (uint64_t)header.binarySize == fileSize
+		&& header.magic == MAGIC
+		&& header.version == VERSION
+		&& header.sourceHash == sourceHash
+		&& header.driverHash == driverHash;
+	if (valid) {
+		binary.resize(header.binarySize);
+		stream.read(binary.data(), binary.size());
+		valid = (bool)stream;
+	}
+	if (!valid) {
+		stats.invalidations++;
+		return 0;
+	}
+
+	unsigned int program = glCreateProgram();
+	programBinary(program, header.binaryFormat, binary.data(), (GLsizei)binary.size());
+	int success;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success) {
+		// Driver updates are allowed to reject old binaries even under the same version string
+		glDeleteProgram(program);
+		stats.invalidations++;
+		return 0;
+	}
+
+	stats.hits++;
+	return program;
+}
+
+void ProgramCache::prepare(unsigned int program) const {
+	if (enabled) {
+		programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+}
+
+bool ProgramCache::save(const std::string& cachePath, uint64_t sourceHash, unsigned int program) {
+	if (!enabled) {
+		return false;
+	}
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) {
+		return false;
+	}
+
+	std::vector<char> binary(length);
+	GLenum binaryFormat = 0;
+	getProgramBinary(program, length, &length, &binaryFormat, binary.data());
+
+	ProgramBinaryHeader header;
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.binaryFormat = binaryFormat;
+	header.binarySize = (uint32_t)length;
+	header.sourceHash = sourceHash;
+	header.driverHash = driverHash;
+
+	// Write to a temporary file first so a crash never leaves a half-written binary behind
+	std::string temporaryPath = cachePath + ".tmp";
+	{
+		std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!stream) {
+			return false;
+		}
+		stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		stream.write(binary.data(), length);
+		if (!stream) {
+			return false;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, cachePath, error);
+	if (error) {
+		std::filesystem::remove(temporaryPath, error);
+		return false;
+	}
+	return true;
+}
+
+void ProgramCache::printStats() const {
+	std::cout << "Program cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.invalidations << " invalidations, "
+		<< stats.buildMs << " ms building programs" << std::endl;
+}
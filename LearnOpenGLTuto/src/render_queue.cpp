@@ -0,0 +1,380 @@
+#include <render_queue.h>
+#include <buffer_arena.h>
+#include <gl_state.h>
+#include <material.h>
+#include <utils.h>
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+namespace {
+	typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+	MultiDrawElementsIndirectProc multiDrawElementsIndirect = nullptr;
+
+	// Key layout, most significant first
+	constexpr unsigned int PASS_BITS = 4;
+	constexpr unsigned int SHADER_BITS = 10;
+	constexpr unsigned int TEXTURE_BITS = 16;
+	constexpr unsigned int VERTEX_ARRAY_BITS = 10;
+	constexpr unsigned int DEPTH_BITS = 24;
+	// Units a Material binds at most, the LightBlock ones come after
+	constexpr unsigned int MATERIAL_UNITS = 8;
+	static_assert(PASS_BITS + SHADER_BITS + TEXTURE_BITS + VERTEX_ARRAY_BITS + DEPTH_BITS == 64, "the key fields fill 64 bits");
+	static_assert(1u << PASS_BITS == RenderQueue::MAX_PASSES, "a pass per value of its key field");
+	static_assert(sizeof(DrawItem::textures) / sizeof(DrawItem::textures[0]) == RenderQueue::TEXTURE_UNITS, "a texture per unit");
+
+	// Rank of a state in order of first use, past the width of its key field the draws only stay sorted on the rest
+	template <typename T>
+	uint64_t getRank(std::unordered_map<T, uint32_t>& ranks, const T& state, unsigned int bits) {
+		uint32_t rank = ranks.emplace(state, (uint32_t)ranks.size()).first->second;
+		return std::min<uint64_t>(rank, (1ull << bits) - 1);
+	}
+
+	// Materials of the same textures and samplers bind the same state, whichever mesh they come from
+	bool sameTextures(const DrawItem& a, const DrawItem& b) {
+		if (a.material || b.material) {
+			return a.material && b.material && a.material->getStateKey() == b.material->getStateKey();
+		}
+		return std::memcmp(a.textures, b.textures, sizeof(a.textures)) == 0;
+	}
+
+	unsigned int getIndexSize(unsigned int indexType) {
+		return indexType == GL_UNSIGNED_SHORT ? 2 : indexType == GL_UNSIGNED_BYTE ? 1 : 4;
+	}
+
+	// Whether item can be drawn by the multi-draw of the batch starting with first: same state and uniforms, and a single
+	// indexed draw. The model matrix has to match unless both are instanced, their base instance then tells them apart
+	bool canBatch(const DrawItem& first, const DrawItem& item) {
+		const DrawCall& a = first.call;
+		const DrawCall& b = item.call;
+		if (a.indexType == 0 || a.rangeCount > 0 || b.rangeCount > 0 || a.mode != b.mode || a.indexType != b.indexType) {
+			return false;
+		}
+		if (first.pass != item.pass || first.shader != item.shader || first.vertexArray != item.vertexArray || !sameTextures(first, item)) {
+			return false;
+		}
+		if ((first.setUniforms || item.setUniforms) && (first.uniformKey == 0 || first.uniformKey != item.uniformKey)) {
+			return false;
+		}
+		if (a.instanceCount > 0 && b.instanceCount > 0) {
+			return multiDrawElementsIndirect != nullptr;
+		}
+		return a.instanceCount == 0 && b.instanceCount == 0 && first.model == item.model;
+	}
+}
+
+void RenderQueue::initMultiDrawIndirect() {
+	GLint major = 0;
+	GLint minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	// The base instance of the commands needs GL 4.2 or ARB_base_instance, on top of the multi-draw itself
+	if (major > 4 || (major == 4 && minor >= 3) || (hasGLExtension("GL_ARB_multi_draw_indirect") && hasGLExtension("GL_ARB_base_instance"))) {
+		multiDrawElementsIndirect = reinterpret_cast<MultiDrawElementsIndirectProc>(glfwGetProcAddress("glMultiDrawElementsIndirect"));
+	}
+	if (!multiDrawElementsIndirect) {
+		std::cout << "WARNING::RENDER_QUEUE::NO_MULTI_DRAW_INDIRECT: instanced draws are submitted one by one" << std::endl;
+	}
+}
+
+bool RenderQueue::hasMultiDrawIndirect() {
+	return multiDrawElementsIndirect != nullptr;
+}
+
+void RenderQueue::setPass(unsigned int pass, std::function<void()> begin, std::function<void()> end) {
+	passes[pass].begin = std::move(begin);
+	passes[pass].end = std::move(end);
+}
+
+void RenderQueue::add(DrawItem item) {
+	entries.push_back({ makeKey(item), (uint32_t)items.size() });
+	items.push_back(std::move(item));
+}
+
+unsigned int RenderQueue::addRanges(const int* counts, const void* const* offsets, unsigned int rangeCount, int baseVertex) {
+	unsigned int rangeOffset = (unsigned int)rangeCounts.size();
+	rangeCounts.insert(rangeCounts.end(), counts, counts + rangeCount);
+	rangeOffsets.insert(rangeOffsets.end(), offsets, offsets + rangeCount);
+	rangeBaseVertices.insert(rangeBaseVertices.end(), rangeCount, baseVertex);
+	return rangeOffset;
+}
+
+unsigned int RenderQueue::addInstances(const glm::mat4* models, unsigned int instanceCount) {
+	unsigned int firstInstance = (unsigned int)instanceModels.size();
+	instanceModels.insert(instanceModels.end(), models, models + instanceCount);
+	return firstInstance;
+}
+
+void RenderQueue::clear() {
+	glDeleteBuffers(1, &instanceBuffer);
+	glDeleteBuffers(1, &indirectBuffer);
+	instanceBuffer = 0;
+	instanceCapacity = 0;
+	indirectBuffer = 0;
+	indirectCapacity = 0;
+}
+
+uint64_t RenderQueue::makeKey(const DrawItem& item) {
+	uint64_t textureState = item.material ? item.material->getStateKey() : hashBytes(item.textures, sizeof(item.textures));
+	float depth = std::min(std::max(item.depth / farDepth, 0.0f), 1.0f);
+
+	uint64_t key = std::min(item.pass, MAX_PASSES - 1);
+	key = (key << SHADER_BITS) | getRank(shaderRanks, (const Shader*)item.shader, SHADER_BITS);
+	key = (key << TEXTURE_BITS) | getRank(textureRanks, textureState, TEXTURE_BITS);
+	key = (key << VERTEX_ARRAY_BITS) | getRank(vertexArrayRanks, item.vertexArray, VERTEX_ARRAY_BITS);
+	key = (key << DEPTH_BITS) | (uint64_t)(depth * ((1u << DEPTH_BITS) - 1));
+	return key;
+}
+
+// LSD radix sort, a byte at a time. Bytes equal in every key, the unused high ranks and passes mostly, are skipped
+void RenderQueue::sortEntries() {
+	sortBuffer.resize(entries.size());
+	for (unsigned int shift = 0; shift < 64; shift += 8) {
+		size_t counts[256] = {};
+		for (const auto& entry : entries) {
+			counts[(entry.key >> shift) & 0xFF]++;
+		}
+		if (counts[(entries[0].key >> shift) & 0xFF] == entries.size()) {
+			continue;
+		}
+
+		size_t offset = 0;
+		for (auto& count : counts) {
+			size_t bucketSize = count;
+			count = offset;
+			offset += bucketSize;
+		}
+		for (const auto& entry : entries) {
+			sortBuffer[counts[(entry.key >> shift) & 0xFF]++] = entry;
+		}
+		entries.swap(sortBuffer);
+	}
+}
+
+// Orphans the previous storage, the draws of last frame may still read it
+void RenderQueue::uploadInstances() {
+	if (instanceBuffer == 0) {
+		glGenBuffers(1, &instanceBuffer);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	instanceCapacity = std::max(instanceCapacity, instanceModels.size());
+	glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, instanceModels.size() * sizeof(glm::mat4), instanceModels.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// GL 3.3 has no base instance, the attributes are offset instead. They stay enabled in the vertex array,
+// the programs that don't declare them ignore them
+void RenderQueue::bindInstances(unsigned int firstInstance) const {
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	for (unsigned int column = 0; column < 4; column++) {
+		unsigned int location = INSTANCE_MODEL_LOCATION + column;
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(firstInstance * sizeof(glm::mat4) + column * sizeof(glm::vec4)));
+		glVertexAttribDivisor(location, 1);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Runs of sorted entries canBatch merges, then the commands or ranges of the multi-draws
+void RenderQueue::buildBatches() {
+	batches.clear();
+	indirectCommands.clear();
+	for (uint32_t i = 0; i < entries.size(); i++) {
+		const DrawItem& item = items[entries[i].item];
+		stats.instanceCount += item.call.instanceCount;
+		if (!batches.empty() && canBatch(items[entries[batches.back().firstEntry].item], item)) {
+			batches.back().entryCount++;
+			continue;
+		}
+		batches.push_back({ i, 1, 0 });
+	}
+
+	for (auto& batch : batches) {
+		if (batch.entryCount < 2) {
+			continue;
+		}
+		bool indirect = multiDrawElementsIndirect != nullptr;
+		batch.commandOffset = (uint32_t)(indirect ? indirectCommands.size() : rangeCounts.size());
+		for (uint32_t i = batch.firstEntry; i < batch.firstEntry + batch.entryCount; i++) {
+			const DrawCall& call = items[entries[i].item].call;
+			if (indirect) {
+				bool instanced = call.instanceCount > 0;
+				indirectCommands.push_back({ call.count, instanced ? call.instanceCount : 1, (uint32_t)(call.first / getIndexSize(call.indexType)),
+					call.baseVertex, instanced ? call.firstInstance : 0 });
+			}
+			else {
+				rangeCounts.push_back((int)call.count);
+				rangeOffsets.push_back((const void*)call.first);
+				rangeBaseVertices.push_back(call.baseVertex);
+			}
+		}
+	}
+}
+
+// Orphaned like the instances. Stays bound for the draws of the submit
+void RenderQueue::uploadCommands() {
+	if (indirectBuffer == 0) {
+		glGenBuffers(1, &indirectBuffer);
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+	indirectCapacity = std::max(indirectCapacity, indirectCommands.size());
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, indirectCapacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, indirectCommands.size() * sizeof(DrawElementsIndirectCommand), indirectCommands.data());
+}
+
+void RenderQueue::drawBatch(const Batch& batch) const {
+	const DrawItem& first = items[entries[batch.firstEntry].item];
+	if (batch.entryCount == 1) {
+		draw(first);
+	}
+	else if (multiDrawElementsIndirect) {
+		multiDrawElementsIndirect(first.call.mode, first.call.indexType, (const void*)(batch.commandOffset * sizeof(DrawElementsIndirectCommand)),
+			(GLsizei)batch.entryCount, 0);
+	}
+	else {
+		glMultiDrawElementsBaseVertex(first.call.mode, rangeCounts.data() + batch.commandOffset, first.call.indexType,
+			rangeOffsets.data() + batch.commandOffset, (GLsizei)batch.entryCount, const_cast<GLint*>(rangeBaseVertices.data() + batch.commandOffset));
+	}
+}
+
+void RenderQueue::draw(const DrawItem& item) const {
+	const DrawCall& call = item.call;
+	if (call.instanceCount > 0) {
+		if (call.indexType != 0) {
+			glDrawElementsInstancedBaseVertex(call.mode, call.count, call.indexType, (void*)call.first, call.instanceCount, call.baseVertex);
+		}
+		else {
+			glDrawArraysInstanced(call.mode, (GLint)call.first, call.count, call.instanceCount);
+		}
+	}
+	else if (call.rangeCount > 0) {
+		glMultiDrawElementsBaseVertex(call.mode, rangeCounts.data() + call.rangeOffset, call.indexType,
+			rangeOffsets.data() + call.rangeOffset, (GLsizei)call.rangeCount, const_cast<GLint*>(rangeBaseVertices.data() + call.rangeOffset));
+	}
+	else if (call.indexType != 0) {
+		glDrawElementsBaseVertex(call.mode, call.count, call.indexType, (void*)call.first, call.baseVertex);
+	}
+	else {
+		glDrawArrays(call.mode, (GLint)call.first, call.count);
+	}
+}
+
+UniformHandle<glm::mat4> RenderQueue::getModelUniform(const Shader& shader) {
+	auto it = modelUniforms.find(shader.ID);
+	if (it == modelUniforms.end()) {
+		it = modelUniforms.emplace(shader.ID, shader.getUniform<glm::mat4>("model")).first;
+	}
+	return it->second;
+}
+
+void RenderQueue::submit() {
+	stats = Stats();
+	stats.itemCount = (unsigned int)items.size();
+	if (!items.empty()) {
+		auto start = std::chrono::steady_clock::now();
+		sortEntries();
+		stats.sortMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+	if (!instanceModels.empty()) {
+		uploadInstances();
+	}
+	buildBatches();
+	if (!indirectCommands.empty()) {
+		uploadCommands();
+	}
+
+	GLState& glState = GLState::getInstance();
+	const DrawItem* previous = nullptr;
+	UniformHandle<glm::mat4> modelUniform;
+	unsigned int pass = MAX_PASSES;
+	for (const auto& batch : batches) {
+		// The first item stands for the batch, the others only differ by their draw call
+		const DrawItem& item = items[entries[batch.firstEntry].item];
+		if (item.shader == nullptr) {
+			continue;
+		}
+
+		if (item.pass != pass) {
+			if (pass < MAX_PASSES && passes[pass].end) {
+				passes[pass].end();
+			}
+			pass = item.pass;
+			if (passes[pass].begin) {
+				passes[pass].begin();
+			}
+		}
+
+		// The samplers of a Material are uniforms of the program, they are set again with a new program
+		bool shaderChanged = previous == nullptr || item.shader != previous->shader;
+		if (shaderChanged) {
+			item.shader->use();
+			modelUniform = getModelUniform(*item.shader);
+			stats.programChanges++;
+		}
+		if (shaderChanged || !sameTextures(item, *previous)) {
+			if (item.material) {
+				item.material->bind(*item.shader);
+			}
+			else {
+				for (unsigned int unit = 0; unit < TEXTURE_UNITS; unit++) {
+					if (item.textures[unit] != 0) {
+						glState.bindTexture(unit, GL_TEXTURE_2D, item.textures[unit]);
+					}
+				}
+			}
+			stats.textureChanges++;
+		}
+		if (previous == nullptr || item.vertexArray != previous->vertexArray) {
+			glState.bindVertexArray(item.vertexArray);
+			stats.vertexArrayChanges++;
+		}
+
+		if (item.call.instanceCount > 0) {
+			// The base instances of the indirect commands offset the attributes of a merged batch
+			bindInstances(batch.entryCount > 1 ? 0 : item.call.firstInstance);
+		}
+		else {
+			item.shader->set(modelUniform, item.model);
+		}
+		if (item.setUniforms) {
+			item.setUniforms(*item.shader);
+		}
+		drawBatch(batch);
+		stats.batchCount++;
+		previous = &item;
+	}
+	if (pass < MAX_PASSES && passes[pass].end) {
+		passes[pass].end();
+	}
+
+	// Back to a clean state for the rest of the frame, once rather than after every group of draws
+	// Materials can take more units than the items' textures
+	for (unsigned int unit = 0; unit < MATERIAL_UNITS; unit++) {
+		glState.bindTexture(unit, GL_TEXTURE_2D, 0);
+	}
+	glState.activeTexture(0);
+	Shader::release();
+	BufferArena::unbind();
+	if (!indirectCommands.empty()) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	items.clear();
+	entries.clear();
+	rangeCounts.clear();
+	rangeOffsets.clear();
+	rangeBaseVertices.clear();
+	instanceModels.clear();
+	shaderRanks.clear();
+	textureRanks.clear();
+	vertexArrayRanks.clear();
+}
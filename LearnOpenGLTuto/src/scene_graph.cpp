@@ -0,0 +1,78 @@
+#include <scene_graph.h>
+
+#include <algorithm>
+#include <chrono>
+
+uint32_t SceneGraph::addNode(const glm::mat4& local, uint32_t parent) {
+	uint32_t node = getNodeCount();
+	locals.push_back(local);
+	worlds.push_back(local);
+	parents.push_back(parent < node ? parent : NO_PARENT);
+	dirty.push_back(0);
+	markDirty(node);
+	stats.nodeCount = getNodeCount();
+	return node;
+}
+
+void SceneGraph::reserve(size_t nodeCount) {
+	locals.reserve(nodeCount);
+	worlds.reserve(nodeCount);
+	parents.reserve(nodeCount);
+	dirty.reserve(nodeCount);
+}
+
+void SceneGraph::clear() {
+	locals.clear();
+	worlds.clear();
+	parents.clear();
+	dirty.clear();
+	firstDirty = NO_PARENT;
+	updatedNodes.clear();
+	stats = Stats();
+}
+
+void SceneGraph::setLocal(uint32_t node, const glm::mat4& local) {
+	locals[node] = local;
+	markDirty(node);
+}
+
+void SceneGraph::markDirty(uint32_t node) {
+	dirty[node] = 1;
+	firstDirty = std::min(firstDirty, node);
+}
+
+// Nothing before the first dirty node can be below one. Past it a node is dirty when its parent was, the flag
+// carrying the change down the hierarchy, and the flags of what was updated are cleared once the sweep is done
+void SceneGraph::update() {
+	updatedNodes.clear();
+	stats.sweptNodeCount = 0;
+	stats.updatedNodeCount = 0;
+	stats.updateMs = 0.0;
+	if (firstDirty == NO_PARENT) {
+		return;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	uint32_t nodeCount = getNodeCount();
+	for (uint32_t node = firstDirty; node < nodeCount; node++) {
+		uint32_t parent = parents[node];
+		if (parent == NO_PARENT) {
+			if (dirty[node]) {
+				worlds[node] = locals[node];
+				updatedNodes.push_back(node);
+			}
+		}
+		else if (dirty[node] || dirty[parent]) {
+			dirty[node] = 1;
+			worlds[node] = worlds[parent] * locals[node];
+			updatedNodes.push_back(node);
+		}
+	}
+	for (uint32_t node : updatedNodes) {
+		dirty[node] = 0;
+	}
+	stats.sweptNodeCount = nodeCount - firstDirty;
+	stats.updatedNodeCount = static_cast<unsigned int>(updatedNodes.size());
+	stats.updateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	firstDirty = NO_PARENT;
+}
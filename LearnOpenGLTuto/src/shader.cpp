@@ -1,9 +1,65 @@
 #include <shader.h>
+#include <gl_state.h>
+#include <program_cache.h>
+#include <utils.h>
 
 #include <glad/glad.h>
 #include <glm/gtc/type_ptr.hpp>
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath) {
+#include <chrono>
+#include <cstdio>
+
+namespace {
+	// KHR_parallel_shader_compile (or its ARB twin), not part of the core profile glad was generated for
+	const GLenum COMPLETION_STATUS_KHR = 0x91B1;
+	typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+	bool parallelCompile = false;
+
+	double getElapsedMs(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// The #version line has to come first, the defines go right after it
+	std::string insertDefines(const std::string& code, const std::string& defines) {
+		if (code.compare(0, 8, "#version") != 0) {
+			return defines + code;
+		}
+		size_t lineEnd = code.find('\n');
+		if (lineEnd == std::string::npos) {
+			return code + "\n" + defines;
+		}
+		return code.substr(0, lineEnd + 1) + defines + code.substr(lineEnd + 1);
+	}
+}
+
+void Shader::initParallelCompile() {
+	MaxShaderCompilerThreadsProc maxShaderCompilerThreads = nullptr;
+	if (hasGLExtension("GL_KHR_parallel_shader_compile")) {
+		maxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+	}
+	else if (hasGLExtension("GL_ARB_parallel_shader_compile")) {
+		maxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+	}
+	if (maxShaderCompilerThreads) {
+		// Let the driver pick its thread count
+		maxShaderCompilerThreads(0xFFFFFFFF);
+		parallelCompile = true;
+	}
+	else {
+		std::cout << "WARNING::SHADER::NO_PARALLEL_COMPILE: poll() waits for each program to compile" << std::endl;
+	}
+}
+
+bool Shader::hasParallelCompile() {
+	return parallelCompile;
+}
+
+Shader::Shader(const char* vertexPath, const char* fragmentPath, bool async)
+	: Shader(vertexPath, fragmentPath, {}, async) {
+}
+
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines, bool async) {
+	auto start = std::chrono::steady_clock::now();
 	std::string vertexCode, fragmentCode;
 	std::ifstream vShaderFile, fShaderFile;
 
@@ -33,86 +89,329 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath) {
 		std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY LOADED" << std::endl;
 	}
 
+	// Each set of defines gets its own binary
+	std::string variant;
+	if (!defines.empty()) {
+		std::string defineBlock;
+		for (const auto& define : defines) {
+			defineBlock += "#define " + define + "\n";
+		}
+		vertexCode = insertDefines(vertexCode, defineBlock);
+		fragmentCode = insertDefines(fragmentCode, defineBlock);
+
+		char variantName[17];
+		snprintf(variantName, sizeof(variantName), "%016llx", (unsigned long long)hashBytes(defineBlock.data(), defineBlock.size()));
+		variant = variantName;
+	}
+
+	cachePath = ProgramCache::getCachePath(vertexPath, fragmentPath, variant);
+	compile(vertexCode, fragmentCode);
+	ProgramCache::getInstance().addBuildTime(getElapsedMs(start));
+
+	if (!async) {
+		finish();
+	}
+}
+
+Shader::Shader(Shader&& other) noexcept
+	: ID(other.ID), status(other.status), vertexShader(other.vertexShader), fragmentShader(other.fragmentShader),
+	cachePath(std::move(other.cachePath)), sourceHash(other.sourceHash), onReady(std::move(other.onReady)),
+	uniforms(std::move(other.uniforms)), uniformIndices(std::move(other.uniformIndices)) {
+	// The moved from shader must not finish the program a second time
+	other.status = Status::Failed;
+	other.vertexShader = 0;
+	other.fragmentShader = 0;
+}
+
+void Shader::compile(const std::string& vertexCode, const std::string& fragmentCode) {
+	// A binary from a previous run skips compiling and linking
+	ProgramCache& programCache = ProgramCache::getInstance();
+	sourceHash = hashBytes(fragmentCode.data(), fragmentCode.size(), hashBytes(vertexCode.data(), vertexCode.size()));
+	ID = programCache.load(cachePath, sourceHash);
+	if (ID != 0) {
+		reflectUniforms();
+		status = Status::Ready;
+		return;
+	}
+
+	// Nothing below waits for the driver, the statuses are only read by finish()
 	const char* vShaderCode = vertexCode.c_str();
 	const char* fShaderCode = fragmentCode.c_str();
 
-	// compilation
-	unsigned int vertex, fragment;
+	vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vertexShader, 1, &vShaderCode, nullptr);
+	glCompileShader(vertexShader);
+
+	fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(fragmentShader, 1, &fShaderCode, nullptr);
+	glCompileShader(fragmentShader);
+
+	// shader program
+	ID = glCreateProgram();
+	glAttachShader(ID, vertexShader);
+	glAttachShader(ID, fragmentShader);
+	programCache.prepare(ID);
+	glLinkProgram(ID);
+	status = Status::Compiling;
+}
+
+bool Shader::poll() {
+	if (status != Status::Compiling) {
+		return true;
+	}
+	if (parallelCompile) {
+		int completed = 0;
+		glGetProgramiv(ID, COMPLETION_STATUS_KHR, &completed);
+		if (!completed) {
+			return false;
+		}
+	}
+	finish();
+	return true;
+}
+
+void Shader::finish() {
+	if (status != Status::Compiling) {
+		return;
+	}
+	auto start = std::chrono::steady_clock::now();
+
 	int success;
 	char infoLog[512];
 
-	vertex = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertex, 1, &vShaderCode, nullptr);
-	glCompileShader(vertex);
-
-	glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
+	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
 	if (!success) {
-		glGetShaderInfoLog(vertex, 512, nullptr, infoLog);
+		glGetShaderInfoLog(vertexShader, 512, nullptr, infoLog);
 		std::cout << "ERROR::SHADER::VERTEX::COMPILATION::FAILED" << std::endl << infoLog << std::endl;
 	}
 
-	fragment = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragment, 1, &fShaderCode, nullptr);
-	glCompileShader(fragment);
-
-	glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
+	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
 	if (!success) {
-		glGetShaderInfoLog(fragment, 512, nullptr, infoLog);
+		glGetShaderInfoLog(fragmentShader, 512, nullptr, infoLog);
 		std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION::FAILED" << std::endl << infoLog << std::endl;
 	}
 
-	// shader program
-	ID = glCreateProgram();
-	glAttachShader(ID, vertex);
-	glAttachShader(ID, fragment);
-	glLinkProgram(ID);
-
 	glGetProgramiv(ID, GL_LINK_STATUS, &success);
 	if (!success) {
 		glGetProgramInfoLog(ID, 512, nullptr, infoLog);
 		std::cout << "ERROR::SHADER::PROGRAM::LINKING::FAILED" << std::endl << infoLog << std::endl;
+		status = Status::Failed;
+	}
+	else {
+		reflectUniforms();
+		ProgramCache::getInstance().save(cachePath, sourceHash, ID);
+		status = Status::Ready;
 	}
 
 	// cleanup
-	glDeleteShader(vertex);
-	glDeleteShader(fragment);
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+	vertexShader = 0;
+	fragmentShader = 0;
+	ProgramCache::getInstance().addBuildTime(getElapsedMs(start));
+
+	if (status == Status::Ready && onReady) {
+		onReady(*this);
+	}
+}
+
+void Shader::setOnReady(std::function<void(Shader&)> callback) {
+	onReady = std::move(callback);
+	if (status == Status::Ready && onReady) {
+		onReady(*this);
+	}
 }
 
 void Shader::use() {
-	glUseProgram(ID);
+	GLState::getInstance().useProgram(ID);
 }
 
 void Shader::release() {
-	glUseProgram(0);
+	GLState::getInstance().useProgram(0);
+}
+
+void Shader::reflectUniforms() {
+	int count = 0;
+	int maxLength = 0;
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+	std::vector<char> buffer(maxLength + 1);
+	for (int i = 0; i < count; i++) {
+		int length = 0;
+		int size = 0;
+		GLenum type;
+		glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+		std::string name(buffer.data(), length);
+
+		// Members of uniform blocks have no location
+		int location = glGetUniformLocation(ID, name.c_str());
+		if (location < 0) {
+			continue;
+		}
+
+		// Arrays of basic types are reported once as "name[0]", with their size
+		if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+			std::string baseName = name.substr(0, name.size() - 3);
+			addUniform(baseName, location, type, size);
+			addUniform(name, location, type, 1);
+			for (int element = 1; element < size; element++) {
+				std::string elementName = baseName + "[" + std::to_string(element) + "]";
+				addUniform(elementName, glGetUniformLocation(ID, elementName.c_str()), type, 1);
+			}
+		}
+		else {
+			addUniform(name, location, type, size);
+		}
+	}
+}
+
+void Shader::addUniform(const std::string& name, int location, unsigned int type, int size) {
+	uniformIndices.emplace(hashUniformName(name.c_str()), (unsigned int)uniforms.size());
+	uniforms.push_back({ name, location, type, size });
+}
+
+const Shader::Uniform* Shader::findUniform(const UniformName& name) const {
+	auto range = uniformIndices.equal_range(name.hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		const Uniform& uniform = uniforms[it->second];
+		if (uniform.name == name.name) {
+			return &uniform;
+		}
+	}
+	return nullptr;
+}
+
+int Shader::getLocation(const std::string& name) const {
+	const Uniform* uniform = findUniform(name);
+	return uniform ? uniform->location : -1;
+}
+
+namespace {
+	template <typename T> bool acceptsUniformType(GLenum type);
+
+	template <> bool acceptsUniformType<bool>(GLenum type) {
+		return type == GL_BOOL || type == GL_INT;
+	}
+
+	template <> bool acceptsUniformType<int>(GLenum type) {
+		switch (type) {
+		case GL_INT:
+		case GL_BOOL:
+		case GL_SAMPLER_2D:
+		case GL_SAMPLER_3D:
+		case GL_SAMPLER_CUBE:
+		case GL_SAMPLER_2D_SHADOW:
+		case GL_SAMPLER_2D_ARRAY:
+		case GL_SAMPLER_BUFFER:
+		case GL_INT_SAMPLER_BUFFER:
+		case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	template <> bool acceptsUniformType<float>(GLenum type) {
+		return type == GL_FLOAT;
+	}
+
+	template <> bool acceptsUniformType<glm::vec3>(GLenum type) {
+		return type == GL_FLOAT_VEC3;
+	}
+
+	template <> bool acceptsUniformType<glm::vec4>(GLenum type) {
+		return type == GL_FLOAT_VEC4;
+	}
+
+	template <> bool acceptsUniformType<glm::mat4>(GLenum type) {
+		return type == GL_FLOAT_MAT4;
+	}
+}
+
+template <typename T>
+UniformHandle<T> Shader::getUniform(const UniformName& name) const {
+	UniformHandle<T> handle;
+	const Uniform* uniform = findUniform(name);
+	if (uniform == nullptr) {
+		// Unused uniforms are optimized out by the GLSL compiler, not an error
+		return handle;
+	}
+	if (!acceptsUniformType<T>(uniform->type)) {
+		std::cout << "WARNING::SHADER::UNIFORM_TYPE_MISMATCH: " << name.name << std::endl;
+		return handle;
+	}
+	handle.location = uniform->location;
+	return handle;
+}
+
+template UniformHandle<bool> Shader::getUniform<bool>(const UniformName& name) const;
+template UniformHandle<int> Shader::getUniform<int>(const UniformName& name) const;
+template UniformHandle<float> Shader::getUniform<float>(const UniformName& name) const;
+template UniformHandle<glm::vec3> Shader::getUniform<glm::vec3>(const UniformName& name) const;
+template UniformHandle<glm::vec4> Shader::getUniform<glm::vec4>(const UniformName& name) const;
+template UniformHandle<glm::mat4> Shader::getUniform<glm::mat4>(const UniformName& name) const;
+
+bool Shader::bindUniformBlock(const char* name, unsigned int binding) const {
+	unsigned int index = glGetUniformBlockIndex(ID, name);
+	if (index == GL_INVALID_INDEX) {
+		return false;
+	}
+	glUniformBlockBinding(ID, index, binding);
+	return true;
+}
+
+void Shader::set(UniformHandle<bool> uniform, bool value) const {
+	glUniform1i(uniform.location, (int)value);
+}
+
+void Shader::set(UniformHandle<int> uniform, int value) const {
+	glUniform1i(uniform.location, value);
+}
+
+void Shader::set(UniformHandle<float> uniform, float value) const {
+	glUniform1f(uniform.location, value);
+}
+
+void Shader::set(UniformHandle<glm::vec3> uniform, const glm::vec3& value) const {
+	glUniform3fv(uniform.location, 1, &value[0]);
+}
+
+void Shader::set(UniformHandle<glm::vec4> uniform, const glm::vec4& value) const {
+	glUniform4fv(uniform.location, 1, &value[0]);
+}
+
+void Shader::set(UniformHandle<glm::mat4> uniform, const glm::mat4& value) const {
+	glUniformMatrix4fv(uniform.location, 1, GL_FALSE, glm::value_ptr(value));
 }
 
 void Shader::setBool(const std::string& name, bool value) const {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+	glUniform1i(getLocation(name), (int)value);
 }
 
 void Shader::setInt(const std::string& name, int value) const {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+	glUniform1i(getLocation(name), value);
 }
 
 void Shader::setFloat(const std::string& name, float value) const {
-	glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+	glUniform1f(getLocation(name), value);
 }
 
 void Shader::setFloat3(const std::string& name, const glm::vec3& value) const {
-	glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+	glUniform3fv(getLocation(name), 1, &value[0]);
 }
 void Shader::setFloat3(const std::string& name, float r, float g, float b) const {
-	glUniform3f(glGetUniformLocation(ID, name.c_str()), r, g, b);
+	glUniform3f(getLocation(name), r, g, b);
 }
 
 void Shader::setFloat4(const std::string& name, const glm::vec4& value) const {
-	glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+	glUniform4fv(getLocation(name), 1, &value[0]);
 }
 
 void Shader::setFloat4(const std::string& name, float r, float g, float b, float a) const {
-	glUniform4f(glGetUniformLocation(ID, name.c_str()), r, g, b, a);
+	glUniform4f(getLocation(name), r, g, b, a);
 }
 
 void Shader::setMatrixFloat4v(const std::string& name, int count ,const glm::mat4& mat) const {
-	glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), count, GL_FALSE, glm::value_ptr(mat));
+	glUniformMatrix4fv(getLocation(name), count, GL_FALSE, glm::value_ptr(mat));
 }
@@ -0,0 +1,75 @@
+#include <shader_variants.h>
+
+#include <utility>
+
+std::vector<std::string> ShaderFeature::getDefines(uint32_t features) {
+	static const std::pair<uint32_t, const char*> names[] = {
+		{ SPECULAR_MAP, "SPECULAR_MAP" },
+		{ EMISSION_MAP, "EMISSION_MAP" },
+		{ NORMAL_MAP, "NORMAL_MAP" },
+		{ HEIGHT_MAP, "HEIGHT_MAP" },
+		{ DIRECTIONAL_LIGHT, "DIRECTIONAL_LIGHT" },
+		{ POINT_LIGHTS, "POINT_LIGHTS" },
+		{ SPOT_LIGHTS, "SPOT_LIGHTS" },
+		{ INSTANCED, "INSTANCED" }
+	};
+
+	std::vector<std::string> defines;
+	for (const auto& name : names) {
+		if (features & name.first) {
+			defines.push_back(name.second);
+		}
+	}
+	return defines;
+}
+
+ShaderVariants::ShaderVariants(const std::string& vertexPath, const std::string& fragmentPath, Shader& fallback, Shader& instancedFallback,
+	std::function<void(Shader&)> onReady)
+	: vertexPath(vertexPath), fragmentPath(fragmentPath), fallback(fallback), instancedFallback(instancedFallback), onReady(std::move(onReady)) {
+}
+
+Shader& ShaderVariants::request(uint32_t features) {
+	auto it = variants.find(features);
+	if (it == variants.end()) {
+		std::unique_ptr<Shader> shader = std::make_unique<Shader>(vertexPath.c_str(), fragmentPath.c_str(), ShaderFeature::getDefines(features), true);
+		if (onReady) {
+			shader->setOnReady(onReady);
+		}
+		it = variants.emplace(features, std::move(shader)).first;
+	}
+	return *it->second;
+}
+
+Shader& ShaderVariants::get(uint32_t features) {
+	Shader& shader = request(features);
+	if (shader.isReady()) {
+		return shader;
+	}
+
+	uint32_t standInFeatures = features | ShaderFeature::LIGHT_MASK;
+	if (standInFeatures != features) {
+		Shader& standIn = request(standInFeatures);
+		if (standIn.isReady()) {
+			return standIn;
+		}
+	}
+	return features & ShaderFeature::INSTANCED ? instancedFallback : fallback;
+}
+
+unsigned int ShaderVariants::poll() {
+	unsigned int compilingCount = 0;
+	for (auto& variant : variants) {
+		if (!variant.second->poll()) {
+			compilingCount++;
+		}
+	}
+	return compilingCount;
+}
+
+void ShaderVariants::forEachReady(const std::function<void(Shader&)>& callback) {
+	for (auto& variant : variants) {
+		if (variant.second->isReady()) {
+			callback(*variant.second);
+		}
+	}
+}
@@ -0,0 +1,143 @@
+#include <texture_cache.h>
+#include <gl_state.h>
+
+#include <filesystem>
+
+TextureHandle::~TextureHandle() {
+	if (ID) {
+		TextureCache::getInstance().release(ID);
+	}
+}
+
+TextureHandle::TextureHandle(const TextureHandle& other)
+	: ID(other.ID) {
+	if (ID) {
+		TextureCache::getInstance().addReference(ID);
+	}
+}
+
+TextureHandle& TextureHandle::operator=(const TextureHandle& other) {
+	if (this != &other) {
+		TextureHandle copy(other);
+		std::swap(ID, copy.ID);
+	}
+	return *this;
+}
+
+TextureHandle::TextureHandle(TextureHandle&& other) noexcept
+	: ID(other.ID) {
+	other.ID = 0;
+}
+
+TextureHandle& TextureHandle::operator=(TextureHandle&& other) noexcept {
+	std::swap(ID, other.ID);
+	return *this;
+}
+
+TextureCache& TextureCache::getInstance() {
+	static TextureCache cache;
+	return cache;
+}
+
+std::string TextureCache::getPathKey(const std::string& path, bool gamma) {
+	std::error_code error;
+	std::filesystem::path canonicalPath = std::filesystem::weakly_canonical(path, error);
+	std::string key = error ? path : canonicalPath.generic_string();
+	return gamma ? key + "|srgb" : key;
+}
+
+uint64_t TextureCache::getContentKey(uint64_t contentHash, bool gamma) {
+	return gamma ? ~contentHash : contentHash;
+}
+
+TextureHandle TextureCache::find(const std::string& folderPath, const std::string& name, bool gamma) {
+	auto it = texturesByPath.find(getPathKey(folderPath + "/" + name, gamma));
+	if (it == texturesByPath.end()) {
+		return TextureHandle();
+	}
+	pathHits++;
+	return acquire(it->second);
+}
+
+TextureHandle TextureCache::add(const TextureImage& image, bool gamma) {
+	std::string pathKey = getPathKey(image.path, gamma);
+	auto pathIt = texturesByPath.find(pathKey);
+	if (pathIt != texturesByPath.end()) {
+		pathHits++;
+		return acquire(pathIt->second);
+	}
+
+	// Failed decodes aren't shared, every one of them keeps its own (empty) texture
+	if (image.isValid()) {
+		uint64_t contentKey = getContentKey(image.contentHash, gamma);
+		auto contentIt = texturesByContent.find(contentKey);
+		if (contentIt != texturesByContent.end()) {
+			// Same file under another path, remember the alias
+			contentHits++;
+			texturesByPath[pathKey] = contentIt->second;
+			entries[contentIt->second].pathKeys.push_back(pathKey);
+			return acquire(contentIt->second);
+		}
+	}
+
+	unsigned int textureID = uploadTexture(image, gamma);
+	Entry& entry = entries[textureID];
+	entry.pathKeys.push_back(pathKey);
+	texturesByPath[pathKey] = textureID;
+	if (image.isValid()) {
+		entry.contentKey = getContentKey(image.contentHash, gamma);
+		texturesByContent[entry.contentKey] = textureID;
+	}
+	return acquire(textureID);
+}
+
+TextureHandle TextureCache::load(const std::string& folderPath, const std::string& name, bool gamma) {
+	TextureHandle handle = find(folderPath, name, gamma);
+	if (handle) {
+		return handle;
+	}
+
+	TextureImage image;
+	decodeTexture(folderPath, name, image, TextureCompression::None, gamma);
+	return add(image, gamma);
+}
+
+void TextureCache::clear() {
+	for (const auto& entry : entries) {
+		GLState::getInstance().onDeleteTexture(entry.first);
+		glDeleteTextures(1, &entry.first);
+	}
+	entries.clear();
+	texturesByPath.clear();
+	texturesByContent.clear();
+}
+
+TextureHandle TextureCache::acquire(unsigned int textureID) {
+	addReference(textureID);
+	return TextureHandle(textureID);
+}
+
+void TextureCache::addReference(unsigned int textureID) {
+	auto it = entries.find(textureID);
+	if (it != entries.end()) {
+		it->second.refCount++;
+	}
+}
+
+void TextureCache::release(unsigned int textureID) {
+	auto it = entries.find(textureID);
+	if (it == entries.end() || --it->second.refCount > 0) {
+		return;
+	}
+
+	for (const auto& pathKey : it->second.pathKeys) {
+		texturesByPath.erase(pathKey);
+	}
+	auto contentIt = texturesByContent.find(it->second.contentKey);
+	if (contentIt != texturesByContent.end() && contentIt->second == textureID) {
+		texturesByContent.erase(contentIt);
+	}
+	GLState::getInstance().onDeleteTexture(textureID);
+	glDeleteTextures(1, &textureID);
+	entries.erase(it);
+}
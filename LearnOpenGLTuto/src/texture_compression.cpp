@@ -0,0 +1,578 @@
+#include <texture_compression.h>
+#include <gl_state.h>
+#include <utils.h>
+#include <mapped_file.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// EXT_texture_compression_s3tc and EXT_texture_sRGB, not part of the core profile glad was generated for
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+namespace {
+	std::atomic<bool> s3tcSupported(false);
+
+	// https://docs.microsoft.com/en-us/windows/win32/direct3ddds/dds-header
+	const uint32_t DDS_MAGIC = 0x20534444;		// "DDS "
+	const uint32_t DX10_FOURCC = 0x30315844;	// "DX10"
+	const uint32_t DDSD_CAPS = 0x1;
+	const uint32_t DDSD_HEIGHT = 0x2;
+	const uint32_t DDSD_WIDTH = 0x4;
+	const uint32_t DDSD_PIXELFORMAT = 0x1000;
+	const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+	const uint32_t DDSD_LINEARSIZE = 0x80000;
+	const uint32_t DDPF_FOURCC = 0x4;
+	const uint32_t DDSCAPS_COMPLEX = 0x8;
+	const uint32_t DDSCAPS_TEXTURE = 0x1000;
+	const uint32_t DDSCAPS_MIPMAP = 0x400000;
+	const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+	const uint32_t DXGI_FORMAT_BC1_UNORM = 71;
+	const uint32_t DXGI_FORMAT_BC3_UNORM = 77;
+	const uint32_t DXGI_FORMAT_BC4_UNORM = 80;
+	const uint32_t DXGI_FORMAT_BC5_UNORM = 83;
+
+	struct DDSPixelFormat {
+		uint32_t size;
+		uint32_t flags;
+		uint32_t fourCC;
+		uint32_t rgbBitCount;
+		uint32_t rBitMask;
+		uint32_t gBitMask;
+		uint32_t bBitMask;
+		uint32_t aBitMask;
+	};
+
+	// Copied in DDSHeader::reserved1, other tools ignore it
+	struct CompressedTextureStamp {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		uint64_t sourceHash;
+	};
+	const uint32_t STAMP_MAGIC = 0x43544F4C;	// "LOTC"
+	const uint32_t STAMP_VERSION = 2;
+
+	struct DDSHeader {
+		uint32_t size;
+		uint32_t flags;
+		uint32_t height;
+		uint32_t width;
+		uint32_t pitchOrLinearSize;
+		uint32_t depth;
+		uint32_t mipMapCount;
+		uint32_t reserved1[11];
+		DDSPixelFormat pixelFormat;
+		uint32_t caps;
+		uint32_t caps2;
+		uint32_t caps3;
+		uint32_t caps4;
+		uint32_t reserved2;
+	};
+	static_assert(sizeof(DDSHeader) == 124, "DDS_HEADER is 124 bytes");
+	static_assert(sizeof(CompressedTextureStamp) <= sizeof(DDSHeader::reserved1), "stamp must fit in reserved1");
+
+	struct DDSHeaderDX10 {
+		uint32_t dxgiFormat;
+		uint32_t resourceDimension;
+		uint32_t miscFlag;
+		uint32_t arraySize;
+		uint32_t miscFlags2;
+	};
+
+	size_t getBlockSize(TextureCompression compression) {
+		return compression == TextureCompression::BC1 || compression == TextureCompression::BC4 ? 8 : 16;
+	}
+
+	size_t getMipSize(TextureCompression compression, unsigned int width, unsigned int height) {
+		return (size_t)((width + 3) / 4) * ((height + 3) / 4) * getBlockSize(compression);
+	}
+
+	uint32_t getDxgiFormat(TextureCompression compression) {
+		switch (compression) {
+		case TextureCompression::BC1:
+			return DXGI_FORMAT_BC1_UNORM;
+		case TextureCompression::BC3:
+			return DXGI_FORMAT_BC3_UNORM;
+		case TextureCompression::BC4:
+			return DXGI_FORMAT_BC4_UNORM;
+		case TextureCompression::BC5:
+			return DXGI_FORMAT_BC5_UNORM;
+		default:
+			return 0;
+		}
+	}
+
+	TextureCompression getCompressionFromDxgi(uint32_t dxgiFormat) {
+		switch (dxgiFormat) {
+		case DXGI_FORMAT_BC1_UNORM:
+			return TextureCompression::BC1;
+		case DXGI_FORMAT_BC3_UNORM:
+			return TextureCompression::BC3;
+		case DXGI_FORMAT_BC4_UNORM:
+			return TextureCompression::BC4;
+		case DXGI_FORMAT_BC5_UNORM:
+			return TextureCompression::BC5;
+		default:
+			return TextureCompression::None;
+		}
+	}
+
+	int getChannelsNumber(TextureCompression compression) {
+		switch (compression) {
+		case TextureCompression::BC1:
+			return 3;
+		case TextureCompression::BC3:
+			return 4;
+		case TextureCompression::BC4:
+			return 1;
+		case TextureCompression::BC5:
+			return 2;
+		default:
+			return 0;
+		}
+	}
+
+	uint16_t packColor565(const glm::ivec3& color) {
+		int r = (color.r * 31 + 127) / 255;
+		int g = (color.g * 63 + 127) / 255;
+		int b = (color.b * 31 + 127) / 255;
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	glm::ivec3 unpackColor565(uint16_t color) {
+		int r = (color >> 11) & 31;
+		int g = (color >> 5) & 63;
+		int b = color & 31;
+		return glm::ivec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+	}
+
+	// van Waveren, "Real-Time DXT Compression": bounding box endpoints, the diagonal picked from the covariance
+	void encodeColorBlock(const uint8_t* texels, uint8_t* block) {
+		glm::ivec3 minColor(255);
+		glm::ivec3 maxColor(0);
+		glm::ivec3 sum(0);
+		for (int i = 0; i < 16; i++) {
+			glm::ivec3 color(texels[i * 4], texels[i * 4 + 1], texels[i * 4 + 2]);
+			minColor = glm::min(minColor, color);
+			maxColor = glm::max(maxColor, color);
+			sum += color;
+		}
+
+		glm::ivec3 mean = sum / 16;
+		int covarianceRG = 0;
+		int covarianceBG = 0;
+		for (int i = 0; i < 16; i++) {
+			int g = texels[i * 4 + 1] - mean.g;
+			covarianceRG += (texels[i * 4] - mean.r) * g;
+			covarianceBG += (texels[i * 4 + 2] - mean.b) * g;
+		}
+		if (covarianceRG < 0) {
+			std::swap(minColor.r, maxColor.r);
+		}
+		if (covarianceBG < 0) {
+			std::swap(minColor.b, maxColor.b);
+		}
+
+		// Pulled in by 1/16 of the range, the extremes are rarely worth an endpoint
+		glm::ivec3 inset = (maxColor - minColor) / 16;
+		maxColor = glm::clamp(maxColor - inset, 0, 255);
+		minColor = glm::clamp(minColor + inset, 0, 255);
+
+		uint16_t color0 = packColor565(maxColor);
+		uint16_t color1 = packColor565(minColor);
+		if (color0 < color1) {
+			std::swap(color0, color1);
+		}
+
+		// color0 > color1 selects the 4 colors mode, equal endpoints only ever use index 0
+		glm::ivec3 palette[4];
+		palette[0] = unpackColor565(color0);
+		palette[1] = unpackColor565(color1);
+		palette[2] = (palette[0] * 2 + palette[1]) / 3;
+		palette[3] = (palette[0] + palette[1] * 2) / 3;
+
+		uint32_t indices = 0;
+		if (color0 != color1) {
+			for (int i = 0; i < 16; i++) {
+				glm::ivec3 color(texels[i * 4], texels[i * 4 + 1], texels[i * 4 + 2]);
+				int bestIndex = 0;
+				int bestDistance = INT32_MAX;
+				for (int j = 0; j < 4; j++) {
+					glm::ivec3 difference = color - palette[j];
+					int distance = difference.r * difference.r + difference.g * difference.g + difference.b * difference.b;
+					if (distance < bestDistance) {
+						bestDistance = distance;
+						bestIndex = j;
+					}
+				}
+				indices |= (uint32_t)bestIndex << (i * 2);
+			}
+		}
+
+		std::memcpy(block, &color0, 2);
+		std::memcpy(block + 2, &color1, 2);
+		std::memcpy(block + 4, &indices, 4);
+	}
+
+	// 8 values mode only: endpoints are the min and max of the block
+	void encodeChannelBlock(const uint8_t* texels, int stride, uint8_t* block) {
+		int minValue = 255;
+		int maxValue = 0;
+		for (int i = 0; i < 16; i++) {
+			minValue = std::min(minValue, (int)texels[i * stride]);
+			maxValue = std::max(maxValue, (int)texels[i * stride]);
+		}
+
+		uint64_t indices = 0;
+		if (maxValue != minValue) {
+			int palette[8];
+			palette[0] = maxValue;
+			palette[1] = minValue;
+			for (int j = 2; j < 8; j++) {
+				palette[j] = ((8 - j) * maxValue + (j - 1) * minValue) / 7;
+			}
+
+			for (int i = 0; i < 16; i++) {
+				int value = texels[i * stride];
+				int bestIndex = 0;
+				int bestDistance = 256;
+				for (int j = 0; j < 8; j++) {
+					int distance = std::abs(value - palette[j]);
+					if (distance < bestDistance) {
+						bestDistance = distance;
+						bestIndex = j;
+					}
+				}
+				indices |= (uint64_t)bestIndex << (i * 3);
+			}
+		}
+
+		block[0] = (uint8_t)maxValue;
+		block[1] = (uint8_t)minValue;
+		for (int i = 0; i < 6; i++) {
+			block[2 + i] = (uint8_t)(indices >> (i * 8));
+		}
+	}
+
+	// 4x4 RGBA texels at (blockX, blockY), edges are clamped for sizes that aren't multiples of 4
+	void fetchBlock(const uint8_t* rgba, unsigned int width, unsigned int height, unsigned int blockX, unsigned int blockY, uint8_t* texels) {
+		for (unsigned int y = 0; y < 4; y++) {
+			unsigned int sourceY = std::min(blockY * 4 + y, height - 1);
+			for (unsigned int x = 0; x < 4; x++) {
+				unsigned int sourceX = std::min(blockX * 4 + x, width - 1);
+				std::memcpy(texels + (y * 4 + x) * 4, &rgba[((size_t)sourceY * width + sourceX) * 4], 4);
+			}
+		}
+	}
+
+	void encodeMip(const uint8_t* rgba, unsigned int width, unsigned int height, TextureCompression compression, uint8_t* output) {
+		const size_t blockSize = getBlockSize(compression);
+		uint8_t texels[64];
+		for (unsigned int blockY = 0; blockY < (height + 3) / 4; blockY++) {
+			for (unsigned int blockX = 0; blockX < (width + 3) / 4; blockX++) {
+				fetchBlock(rgba, width, height, blockX, blockY, texels);
+				switch (compression) {
+				case TextureCompression::BC1:
+					encodeColorBlock(texels, output);
+					break;
+				case TextureCompression::BC3:
+					encodeChannelBlock(texels + 3, 4, output);
+					encodeColorBlock(texels, output + 8);
+					break;
+				case TextureCompression::BC4:
+					encodeChannelBlock(texels, 4, output);
+					break;
+				case TextureCompression::BC5:
+					encodeChannelBlock(texels, 4, output);
+					encodeChannelBlock(texels + 1, 4, output + 8);
+					break;
+				default:
+					break;
+				}
+				output += blockSize;
+			}
+		}
+	}
+
+	// Specular maps are reduced to their luminance for BC4
+	void convertToLuminance(std::vector<uint8_t>& rgba) {
+		for (size_t i = 0; i < rgba.size(); i += 4) {
+			rgba[i] = (uint8_t)((rgba[i] * 54 + rgba[i + 1] * 183 + rgba[i + 2] * 19 + 128) >> 8);
+		}
+	}
+}
+
+void initTextureCompression() {
+	s3tcSupported = hasGLExtension("GL_EXT_texture_compression_s3tc");
+	if (s3tcSupported) {
+		return;
+	}
+	std::cout << "WARNING::TEXTURE_COMPRESSION::S3TC_NOT_SUPPORTED: diffuse maps stay uncompressed" << std::endl;
+}
+
+const char* getTextureCompressionName(TextureCompression compression) {
+	switch (compression) {
+	case TextureCompression::BC1:
+		return "BC1";
+	case TextureCompression::BC3:
+		return "BC3";
+	case TextureCompression::BC4:
+		return "BC4";
+	case TextureCompression::BC5:
+		return "BC5";
+	default:
+		return "None";
+	}
+}
+
+bool isNormalMap(const std::string& typeName, const std::string& path) {
+	return typeName == "normal" || path.find("_ddn") != std::string::npos;
+}
+
+bool isColorMap(const std::string& typeName) {
+	return typeName == "diffuse" || typeName == "emission";
+}
+
+TextureCompression getTextureCompression(const std::string& typeName, const std::string& path) {
+	if (isNormalMap(typeName, path)) {
+		return TextureCompression::BC5;
+	}
+	if (typeName == "specular") {
+		return TextureCompression::BC4;
+	}
+	if (typeName == "diffuse" && s3tcSupported) {
+		return TextureCompression::BC1;
+	}
+	return TextureCompression::None;
+}
+
+std::string getCompressedTexturePath(const std::string& sourcePath, TextureCompression compression) {
+	std::string name = getTextureCompressionName(compression);
+	std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	return sourcePath + "." + name + ".dds";
+}
+
+bool compressTexture(TextureImage& image, TextureCompression compression, MipFilter filter) {
+	if (!image.data || image.width <= 0 || image.height <= 0 || compression == TextureCompression::None) {
+		return false;
+	}
+
+	std::vector<uint8_t> rgba = expandToRGBA8(image.data.get(), image.width, image.height, image.channelsNumber);
+	if (compression == TextureCompression::BC4) {
+		convertToLuminance(rgba);
+	}
+	if (compression == TextureCompression::BC1) {
+		for (size_t i = 3; i < rgba.size(); i += 4) {
+			if (rgba[i] != 255) {
+				compression = TextureCompression::BC3;
+				break;
+			}
+		}
+	}
+
+	std::vector<uint8_t> mipData;
+	std::vector<MipLevel> levels;
+	buildMipChain(rgba.data(), image.width, image.height, filter, mipData, levels);
+
+	image.compression = compression;
+	image.compressedData.clear();
+	image.compressedMips.clear();
+	for (const MipLevel& level : levels) {
+		CompressedMip mip;
+		mip.width = level.width;
+		mip.height = level.height;
+		mip.offset = image.compressedData.size();
+		mip.size = getMipSize(compression, level.width, level.height);
+		image.compressedData.resize(mip.offset + mip.size);
+		encodeMip(&mipData[level.offset], level.width, level.height, compression, &image.compressedData[mip.offset]);
+		image.compressedMips.push_back(mip);
+	}
+	return true;
+}
+
+bool writeCompressedTexture(const std::string& sourcePath, const TextureImage& image, TextureCompression compression) {
+	if (image.compressedMips.empty()) {
+		return false;
+	}
+
+	SourceStamp sourceStamp;
+	if (!getSourceStamp(sourcePath, sourceStamp)) {
+		return false;
+	}
+
+	DDSHeader header = {};
+	header.size = sizeof(DDSHeader);
+	header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+	header.height = image.height;
+	header.width = image.width;
+	header.pitchOrLinearSize = (uint32_t)image.compressedMips[0].size;
+	header.mipMapCount = (uint32_t)image.compressedMips.size();
+	CompressedTextureStamp stamp;
+	stamp.magic = STAMP_MAGIC;
+	stamp.version = STAMP_VERSION;
+	stamp.sourceSize = sourceStamp.size;
+	stamp.sourceTime = sourceStamp.time;
+	stamp.sourceHash = image.contentHash;
+	std::memcpy(header.reserved1, &stamp, sizeof(stamp));
+	header.pixelFormat.size = sizeof(DDSPixelFormat);
+	header.pixelFormat.flags = DDPF_FOURCC;
+	header.pixelFormat.fourCC = DX10_FOURCC;
+	header.caps = DDSCAPS_TEXTURE | (image.compressedMips.size() > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+
+	DDSHeaderDX10 headerDX10 = {};
+	headerDX10.dxgiFormat = getDxgiFormat(image.compression);
+	headerDX10.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+	headerDX10.arraySize = 1;
+
+	// Same as the mesh cache: never leave a half-written file behind
+	std::string path = getCompressedTexturePath(sourcePath, compression);
+	std::string temporaryPath = path + ".tmp";
+	{
+		std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!stream) {
+			return false;
+		}
+		stream.write(reinterpret_cast<const char*>(&DDS_MAGIC), sizeof(DDS_MAGIC));
+		stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		stream.write(reinterpret_cast<const char*>(&headerDX10), sizeof(headerDX10));
+		stream.write(reinterpret_cast<const char*>(image.compressedData.data()), image.compressedData.size());
+		if (!stream) {
+			return false;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, path, error);
+	if (error) {
+		std::filesystem::remove(temporaryPath, error);
+		return false;
+	}
+	return true;
+}
+
+bool readCompressedTexture(const std::string& sourcePath, TextureImage& image, TextureCompression requested) {
+	MappedFile file;
+	if (!file.open(getCompressedTexturePath(sourcePath, requested))) {
+		return false;
+	}
+
+	const size_t headersSize = sizeof(uint32_t) + sizeof(DDSHeader) + sizeof(DDSHeaderDX10);
+	if (file.getSize() < headersSize) {
+		return false;
+	}
+	uint32_t magic;
+	DDSHeader header;
+	DDSHeaderDX10 headerDX10;
+	std::memcpy(&magic, file.getData(), sizeof(magic));
+	std::memcpy(&header, file.getData() + sizeof(magic), sizeof(header));
+	std::memcpy(&headerDX10, file.getData() + sizeof(magic) + sizeof(header), sizeof(headerDX10));
+	CompressedTextureStamp stamp;
+	std::memcpy(&stamp, header.reserved1, sizeof(stamp));
+
+	TextureCompression compression = getCompressionFromDxgi(headerDX10.dxgiFormat);
+	if (magic != DDS_MAGIC
+		|| header.size != sizeof(DDSHeader)
+		|| header.pixelFormat.fourCC != DX10_FOURCC
+		|| stamp.magic != STAMP_MAGIC
+		|| stamp.version != STAMP_VERSION
+		|| (compression != requested && !(requested == TextureCompression::BC1 && compression == TextureCompression::BC3))
+		|| header.width == 0 || header.height == 0 || header.mipMapCount == 0) {
+		return false;
+	}
+
+	// Staleness: same size and either same timestamp or same content
+	SourceStamp sourceStamp;
+	if (!getSourceStamp(sourcePath, sourceStamp) || sourceStamp.size != stamp.sourceSize) {
+		return false;
+	}
+	if (sourceStamp.time != stamp.sourceTime && hashFile(sourcePath) != stamp.sourceHash) {
+		return false;
+	}
+
+	std::vector<CompressedMip> mips;
+	size_t offset = 0;
+	unsigned int width = header.width;
+	unsigned int height = header.height;
+	for (uint32_t level = 0; level < header.mipMapCount; level++) {
+		CompressedMip mip;
+		mip.width = width;
+		mip.height = height;
+		mip.offset = offset;
+		mip.size = getMipSize(compression, width, height);
+		offset += mip.size;
+		mips.push_back(mip);
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+	if (headersSize + offset > file.getSize()) {
+		return false;
+	}
+
+	image.width = header.width;
+	image.height = header.height;
+	image.channelsNumber = getChannelsNumber(compression);
+	image.contentHash = stamp.sourceHash;
+	image.compression = compression;
+	image.compressedData.assign(file.getData() + headersSize, file.getData() + headersSize + offset);
+	image.compressedMips.swap(mips);
+	return true;
+}
+
+unsigned int uploadCompressedTexture(const TextureImage& image, bool gamma) {
+	unsigned int textureID;
+	glGenTextures(1, &textureID);
+	GLState::getInstance().bindTexture(GL_TEXTURE_2D, textureID);
+
+	GLenum internalFormat = 0;
+	switch (image.compression) {
+	case TextureCompression::BC1:
+		internalFormat = gamma ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		break;
+	case TextureCompression::BC3:
+		internalFormat = gamma ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		break;
+	case TextureCompression::BC4: {
+		// Single channel, the shaders read specular maps as a color
+		internalFormat = GL_COMPRESSED_RED_RGTC1;
+		GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+		glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+		break;
+	}
+	case TextureCompression::BC5:
+		internalFormat = GL_COMPRESSED_RG_RGTC2;
+		break;
+	default:
+		std::cout << "ERROR::TEXTURE_COMPRESSION::UNKNOWN_FORMAT: " << image.name << std::endl;
+		return textureID;
+	}
+
+	// Whole chain precomputed, no glGenerateMipmap
+	for (size_t level = 0; level < image.compressedMips.size(); level++) {
+		const CompressedMip& mip = image.compressedMips[level];
+		glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, internalFormat, mip.width, mip.height, 0, (GLsizei)mip.size, image.compressedData.data() + mip.offset);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.compressedMips.size() - 1);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	return textureID;
+}
@@ -0,0 +1,86 @@
+#include <texture_loader.h>
+
+TextureLoader::TextureLoader(ThreadPool& pool)
+	: pool(pool) {
+}
+
+TextureLoader::~TextureLoader() {
+	// Decode jobs reference this loader, wait for them even if nobody cares about the result anymore
+	std::unique_lock<std::mutex> lock(mutex);
+	decoded.wait(lock, [this]() { return pendingDecodes == 0; });
+}
+
+void TextureLoader::request(const std::string& folderPath, const std::string& name, bool gamma, TextureCompression compression) {
+	auto inserted = textures.emplace(name, TextureHandle());
+	if (!inserted.second) {
+		return;
+	}
+
+	inserted.first->second = TextureCache::getInstance().find(folderPath, name, gamma);
+	if (inserted.first->second) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pendingDecodes++;
+	}
+	pendingUploads++;
+
+	pool.submit([this, folderPath, name, gamma, compression]() {
+		DecodedTexture texture;
+		texture.gamma = gamma;
+		decodeTexture(folderPath, name, texture.image, compression, gamma);
+
+		// Notify under the lock, the destructor may run as soon as it is released
+		std::lock_guard<std::mutex> lock(mutex);
+		finished.push_back(std::move(texture));
+		pendingDecodes--;
+		decoded.notify_all();
+	});
+}
+
+unsigned int TextureLoader::uploadReady(unsigned int maxUploads) {
+	unsigned int uploaded = 0;
+	while (maxUploads == 0 || uploaded < maxUploads) {
+		DecodedTexture texture;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (finished.empty()) {
+				break;
+			}
+			texture = std::move(finished.front());
+			finished.pop_front();
+		}
+		upload(texture);
+		uploaded++;
+	}
+	return uploaded;
+}
+
+void TextureLoader::uploadAll() {
+	while (pendingUploads > 0) {
+		DecodedTexture texture;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			decoded.wait(lock, [this]() { return !finished.empty(); });
+			texture = std::move(finished.front());
+			finished.pop_front();
+		}
+		upload(texture);
+	}
+}
+
+bool TextureLoader::isDone() const {
+	return pendingUploads == 0;
+}
+
+TextureHandle TextureLoader::getTexture(const std::string& name) const {
+	auto it = textures.find(name);
+	return it != textures.end() ? it->second : TextureHandle();
+}
+
+void TextureLoader::upload(DecodedTexture& texture) {
+	textures[texture.image.name] = TextureCache::getInstance().add(texture.image, texture.gamma);
+	pendingUploads--;
+}
@@ -0,0 +1,50 @@
+#include <thread_pool.h>
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int threadCount) {
+	if (threadCount == 0) {
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = std::max(1u, hardwareThreads > 1 ? hardwareThreads - 1 : 1u);
+	}
+
+	workers.reserve(threadCount);
+	for (unsigned int i = 0; i < threadCount; ++i) {
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	taskAvailable.notify_all();
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+ThreadPool& ThreadPool::getInstance() {
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::workerLoop() {
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			taskAvailable.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+			// Drain what's left before leaving so no future is left without a value
+			if (tasks.empty()) {
+				return;
+			}
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+		task();
+	}
+}
@@ -1,4 +1,9 @@
 #include <utils.h>
+#include <gl_state.h>
+#include <mapped_file.h>
+
+#include <cstring>
+#include <filesystem>
 
 
 
@@ -32,32 +37,117 @@ void showImguiDemo()
 }
 
 unsigned int createTexture(const std::string& folderPath, const std::string& name, bool gamma) {
+	TextureImage image;
+	decodeTexture(folderPath, name, image, TextureCompression::None, gamma);
+	return uploadTexture(image, gamma);
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash) {
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+uint64_t hashFile(const std::string& path) {
+	MappedFile file;
+	if (!file.open(path)) {
+		return 0;
+	}
+	return hashBytes(file.getData(), file.getSize());
+}
+
+bool getSourceStamp(const std::string& path, SourceStamp& stamp) {
+	std::error_code error;
+	stamp.size = std::filesystem::file_size(path, error);
+	if (error) {
+		return false;
+	}
+	stamp.time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+	return !error;
+}
+
+bool hasGLExtension(const char* name) {
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+	for (GLint i = 0; i < extensionCount; i++) {
+		const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+		if (extension && std::strcmp(extension, name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
 
+bool decodeTexture(const std::string& folderPath, const std::string& name, TextureImage& image, TextureCompression compression, bool gamma) {
 	std::string filename(folderPath + "/" + name);
 
+	image.name = name;
+	image.path = filename;
+
+	if (compression != TextureCompression::None && readCompressedTexture(filename, image, compression)) {
+		return true;
+	}
+
+	// Map the file once, it is both hashed (for TextureCache) and decoded from memory
+	MappedFile file;
+	if (!file.open(filename)) {
+		return false;
+	}
+	image.contentHash = hashBytes(file.getData(), file.getSize());
+	image.data.reset(stbi_load_from_memory(file.getData(), (int)file.getSize(), &image.width, &image.height, &image.channelsNumber, 0));
+	if (!image.data) {
+		return false;
+	}
+
+	// First load: encode now, every later load reads the blocks straight from the compressed copy
+	MipFilter filter = getMipFilter(gamma, compression);
+	if (compression != TextureCompression::None && compressTexture(image, compression, filter)) {
+		if (!writeCompressedTexture(filename, image, compression)) {
+			std::cout << "WARNING::TEXTURE_COMPRESSION::WRITE_FAILED: " << getCompressedTexturePath(filename, compression) << std::endl;
+		}
+		image.data.reset();
+		return true;
+	}
+
+	// Mipmapped here rather than by glGenerateMipmap on the GL thread
+	std::vector<unsigned char> rgba = expandToRGBA8(image.data.get(), image.width, image.height, image.channelsNumber);
+	buildMipChain(rgba.data(), image.width, image.height, filter, image.mipData, image.mips);
+	image.channelsNumber = 4;
+	image.data.reset();
+	return true;
+}
+
+unsigned int uploadTexture(const TextureImage& image, bool gamma) {
+	if (!image.compressedMips.empty()) {
+		return uploadCompressedTexture(image, gamma);
+	}
+	if (!image.mips.empty()) {
+		return uploadMipChain(image, gamma);
+	}
+
 	unsigned int textureID;
 	glGenTextures(1, &textureID);
 
-	// load and generate texture
-	int width, height, channelsNumber;
-	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &channelsNumber, 0);
-	if (data) {
+	if (image.data) {
 		GLenum format;
-		if (channelsNumber == 1) {
+		if (image.channelsNumber == 1) {
 			format = GL_RED;
 		}
-		else if (channelsNumber == 3) {
+		else if (image.channelsNumber == 3) {
 			format = GL_RGB;
 		}
-		else if (channelsNumber == 4) {
+		else if (image.channelsNumber == 4) {
 			format = GL_RGBA;
 		}
 		else {
-			std::cout << "Weird number of channels for texture [" << name << "]: " << channelsNumber << std::endl;
+			std::cout << "Weird number of channels for texture [" << image.name << "]: " << image.channelsNumber << std::endl;
 			// TODO:
 		}
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+		GLState::getInstance().bindTexture(GL_TEXTURE_2D, textureID);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data.get());
 		glGenerateMipmap(GL_TEXTURE_2D);
 
 		// set texture wrapping/filtering options on currently bound texture
@@ -69,7 +159,6 @@ unsigned int createTexture(const std::string& folderPath, const std::string& nam
 	else {
 		std::cout << "Failed to load texture" << std::endl;
 	}
-	stbi_image_free(data);
 
 	return textureID;
 }
@@ -0,0 +1,157 @@
+#include <vertex_format.h>
+#include <mesh.h>
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+namespace {
+	glm::vec2 signNotZero(const glm::vec2& v) {
+		return glm::vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+	}
+
+	float angleBetween(const glm::vec3& reference, const glm::vec3& decoded) {
+		float referenceLength = glm::length(reference);
+		if (referenceLength < 1e-6f) {
+			return 0.0f;
+		}
+		float cosAngle = glm::clamp(glm::dot(reference / referenceLength, glm::normalize(decoded)), -1.0f, 1.0f);
+		return glm::degrees(glm::acos(cosAngle));
+	}
+
+	uint16_t packPositionComponent(float value, VertexFormat format) {
+		return format == VertexFormat::Half ? glm::packHalf1x16(value) : glm::packSnorm1x16(value);
+	}
+
+	float unpackPositionComponent(uint16_t value, VertexFormat format) {
+		return format == VertexFormat::Half ? glm::unpackHalf1x16(value) : glm::unpackSnorm1x16(value);
+	}
+
+	glm::vec2 unpackSnorm2(const int16_t value[2]) {
+		return glm::vec2(glm::unpackSnorm1x16((uint16_t)value[0]), glm::unpackSnorm1x16((uint16_t)value[1]));
+	}
+}
+
+void VertexFormatError::merge(const VertexFormatError& other) {
+	vertexCount += other.vertexCount;
+	sumPositionError += other.sumPositionError;
+	maxPositionError = std::max(maxPositionError, other.maxPositionError);
+	maxNormalAngle = std::max(maxNormalAngle, other.maxNormalAngle);
+	maxTangentAngle = std::max(maxTangentAngle, other.maxTangentAngle);
+	maxBitangentAngle = std::max(maxBitangentAngle, other.maxBitangentAngle);
+	maxTexCoordError = std::max(maxTexCoordError, other.maxTexCoordError);
+}
+
+void VertexFormatError::print(VertexFormat format) const {
+	std::cout << "Vertex format " << getVertexFormatName(format) << ": " << vertexCount << " vertices, "
+		<< getVertexSize(format) << " bytes/vertex instead of " << getVertexSize(VertexFormat::Float) << std::endl
+		<< "  position error max " << maxPositionError << ", avg " << (vertexCount ? sumPositionError / vertexCount : 0.0) << std::endl
+		<< "  normal error max " << maxNormalAngle << " deg, tangent " << maxTangentAngle << " deg, bitangent " << maxBitangentAngle << " deg" << std::endl
+		<< "  tex coords error max " << maxTexCoordError << std::endl;
+}
+
+const char* getVertexFormatName(VertexFormat format) {
+	switch (format) {
+	case VertexFormat::Half:
+		return "Half";
+	case VertexFormat::Snorm16:
+		return "Snorm16";
+	default:
+		return "Float";
+	}
+}
+
+unsigned int getVertexSize(VertexFormat format) {
+	return format == VertexFormat::Float ? sizeof(Vertex) : sizeof(CompactVertex);
+}
+
+// http://jcgt.org/published/0003/02/01/ (Survey of Efficient Representations for Independent Unit Vectors)
+glm::vec2 encodeOctahedral(const glm::vec3& direction) {
+	float l1Norm = glm::abs(direction.x) + glm::abs(direction.y) + glm::abs(direction.z);
+	if (l1Norm == 0.0f) {
+		return glm::vec2(0.0f);
+	}
+
+	glm::vec2 encoded = glm::vec2(direction.x, direction.y) / l1Norm;
+	if (direction.z < 0.0f) {
+		encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) * signNotZero(encoded);
+	}
+	return encoded;
+}
+
+glm::vec3 decodeOctahedral(const glm::vec2& encoded) {
+	glm::vec3 direction(encoded.x, encoded.y, 1.0f - glm::abs(encoded.x) - glm::abs(encoded.y));
+	if (direction.z < 0.0f) {
+		glm::vec2 folded = (1.0f - glm::abs(glm::vec2(direction.y, direction.x))) * signNotZero(glm::vec2(direction));
+		direction.x = folded.x;
+		direction.y = folded.y;
+	}
+	return glm::normalize(direction);
+}
+
+std::vector<CompactVertex> compressVertices(const Vertex* vertices, unsigned int vertexCount, VertexFormat format, VertexQuantization& quantization, VertexFormatError* error) {
+	std::vector<CompactVertex> compressed(vertexCount);
+
+	glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+	for (unsigned int i = 0; i < vertexCount; i++) {
+		boundsMin = glm::min(boundsMin, vertices[i].Position);
+		boundsMax = glm::max(boundsMax, vertices[i].Position);
+	}
+	quantization.Center = vertexCount ? (boundsMin + boundsMax) * 0.5f : glm::vec3(0.0f);
+	quantization.Extent = vertexCount ? glm::max((boundsMax - boundsMin) * 0.5f, glm::vec3(1e-6f)) : glm::vec3(1.0f);
+
+	VertexFormatError meshError;
+	meshError.vertexCount = vertexCount;
+
+	for (unsigned int i = 0; i < vertexCount; i++) {
+		const Vertex& vertex = vertices[i];
+		CompactVertex& compact = compressed[i];
+
+		glm::vec3 normalized = glm::clamp((vertex.Position - quantization.Center) / quantization.Extent, -1.0f, 1.0f);
+		float bitangentSign = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+		compact.Position[0] = packPositionComponent(normalized.x, format);
+		compact.Position[1] = packPositionComponent(normalized.y, format);
+		compact.Position[2] = packPositionComponent(normalized.z, format);
+		compact.Position[3] = packPositionComponent(bitangentSign, format);
+
+		glm::vec2 normal = encodeOctahedral(vertex.Normal);
+		compact.Normal[0] = (int16_t)glm::packSnorm1x16(normal.x);
+		compact.Normal[1] = (int16_t)glm::packSnorm1x16(normal.y);
+
+		glm::vec2 tangent = encodeOctahedral(vertex.Tangent);
+		compact.Tangent[0] = (int16_t)glm::packSnorm1x16(tangent.x);
+		compact.Tangent[1] = (int16_t)glm::packSnorm1x16(tangent.y);
+
+		compact.TexCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+		compact.TexCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+
+		if (error) {
+			glm::vec3 decodedPosition = quantization.Center + quantization.Extent * glm::vec3(
+				unpackPositionComponent(compact.Position[0], format),
+				unpackPositionComponent(compact.Position[1], format),
+				unpackPositionComponent(compact.Position[2], format));
+			float positionError = glm::length(decodedPosition - vertex.Position);
+			meshError.sumPositionError += positionError;
+			meshError.maxPositionError = std::max(meshError.maxPositionError, positionError);
+
+			glm::vec3 decodedNormal = decodeOctahedral(unpackSnorm2(compact.Normal));
+			glm::vec3 decodedTangent = decodeOctahedral(unpackSnorm2(compact.Tangent));
+			glm::vec3 decodedBitangent = glm::cross(decodedNormal, decodedTangent) * unpackPositionComponent(compact.Position[3], format);
+			meshError.maxNormalAngle = std::max(meshError.maxNormalAngle, angleBetween(vertex.Normal, decodedNormal));
+			meshError.maxTangentAngle = std::max(meshError.maxTangentAngle, angleBetween(vertex.Tangent, decodedTangent));
+			meshError.maxBitangentAngle = std::max(meshError.maxBitangentAngle, angleBetween(vertex.Bitangent, decodedBitangent));
+
+			glm::vec2 decodedTexCoords(glm::unpackHalf1x16(compact.TexCoords[0]), glm::unpackHalf1x16(compact.TexCoords[1]));
+			glm::vec2 texCoordsError = glm::abs(decodedTexCoords - vertex.TexCoords);
+			meshError.maxTexCoordError = std::max(meshError.maxTexCoordError, std::max(texCoordsError.x, texCoordsError.y));
+		}
+	}
+
+	if (error) {
+		error->merge(meshError);
+	}
+	return compressed;
+}